@@ -0,0 +1,202 @@
+/*
+ * chat_model_bench:
+ *   - ChatMessageModel に会話を流し込み、保存形式のコストを測る (ビューなし)
+ *       bytes_per_msg        : メッセージ1件あたりのメモリ (記録 + 本文バッファの容量 + 共有のロール名)
+ *       block_bytes_per_msg  : Markdown ブロック (MessageBlockModel) の分
+ *       legacy_bytes_per_msg : 以前の形式 (llama_chat_message + strdup した UTF-8 の role / content) の見積もり
+ *       update_ns            : 生成中の応答の更新1回 (= 1トークン) あたりの時間 (updateInterval = 0)
+ *       data_ns              : data() 1回あたりの時間 (全行の sender / messageContent を繰り返し読む = スクロール)
+ *       open_us              : 全件を履歴ログに保存したあと、別のモデルで openHistory() にかかる時間 (= 起動時)
+ *       paged_data_ns        : そのモデルでの data() 1回あたりの時間 (ログからの読み込みを含む)
+ *       index_us_per_msg     : 検索インデックスへの追加にかかる時間 (メッセージ1件あたり)
+ *       search_us            : search() 1回あたりの時間 (英語・日本語の検索語、抜粋の作成を含む)
+ *   - 応答は英語・日本語・コードブロックを混ぜた Markdown を数文字ずつ伸ばして流す
+ *
+ * 使用例:
+ *   chat_model_bench --messages 2000 --reply-chars 1500 --rounds 20
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+#include "ChatMessageModel.h"
+#include "llama.h"
+
+namespace {
+
+struct Options {
+    int messages   = 1000;
+    int replyChars = 1200;
+    int tokenChars = 3;     // 1トークンで増える文字数
+    int rounds     = 20;
+};
+
+bool parseOptions(const QCoreApplication &app, Options &options)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Fills ChatMessageModel with a streamed conversation and reports memory per message and data() cost."));
+    parser.addHelpOption();
+    const QCommandLineOption messagesOpt(QStringLiteral("messages"),
+                                         QStringLiteral("Messages in the conversation (default: 1000)."), QStringLiteral("n"));
+    const QCommandLineOption replyOpt(QStringLiteral("reply-chars"),
+                                      QStringLiteral("Length of each assistant reply (default: 1200)."), QStringLiteral("n"));
+    const QCommandLineOption tokenOpt(QStringLiteral("token-chars"),
+                                      QStringLiteral("Characters added per streamed update (default: 3)."), QStringLiteral("n"));
+    const QCommandLineOption roundsOpt(QStringLiteral("rounds"),
+                                       QStringLiteral("Passes over all rows for the data() timing (default: 20)."),
+                                       QStringLiteral("n"));
+    parser.addOptions({messagesOpt, replyOpt, tokenOpt, roundsOpt});
+    parser.process(app);
+
+    const auto positive = [&parser](const QCommandLineOption &option, int &value) {
+        if (!parser.isSet(option)) {
+            return true;
+        }
+        bool ok = false;
+        value = parser.value(option).toInt(&ok);
+        if (!ok || value <= 0) {
+            std::fprintf(stderr, "--%s must be a positive integer\n", qPrintable(option.names().constFirst()));
+            return false;
+        }
+        return true;
+    };
+    return positive(messagesOpt, options.messages) && positive(replyOpt, options.replyChars)
+           && positive(tokenOpt, options.tokenChars) && positive(roundsOpt, options.rounds);
+}
+
+// 英語・日本語・コードブロックを含む応答
+QString makeReply(int chars)
+{
+    static const QString paragraphs[] = {
+        QStringLiteral("Here is a short explanation of the approach, followed by an example.\n\n"),
+        QStringLiteral("まず入力を行ごとに分け、空行でブロックを区切ります。確定したブロックは変わりません。\n\n"),
+        QStringLiteral("```cpp\nfor (int i = 0; i < n; ++i) {\n    total += values[i];\n}\n```\n\n"),
+        QStringLiteral("- first item\n- second item with **bold** text\n- third item\n\n"),
+    };
+    QString reply;
+    for (int i = 0; reply.size() < chars; ++i) {
+        reply += paragraphs[i % std::size(paragraphs)];
+    }
+    reply.truncate(chars);
+    return reply;
+}
+
+int roleId(const ChatMessageModel &model, const QByteArray &name)
+{
+    return model.roleNames().key(name, -1);
+}
+
+// 全行の sender / messageContent を rounds 回読み、1回あたりの ns を返す
+double timeData(const ChatMessageModel &model, int rounds, qint64 &sink)
+{
+    const int senderRole  = roleId(model, QByteArrayLiteral("sender"));
+    const int contentRole = roleId(model, QByteArrayLiteral("messageContent"));
+    const int rows = model.rowCount(QModelIndex());
+    QElapsedTimer timer;
+    timer.start();
+    for (int round = 0; round < rounds; ++round) {
+        for (int row = 0; row < rows; ++row) {
+            const QModelIndex index = model.index(row, 0);
+            sink += model.data(index, senderRole).toString().size();
+            sink += model.data(index, contentRole).toString().size();
+        }
+    }
+    const qint64 calls = qint64(rounds) * rows * 2;
+    return calls > 0 ? double(timer.nsecsElapsed()) / double(calls) : 0.0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    Options options;
+    if (!parseOptions(app, options)) {
+        return 2;
+    }
+
+    ChatMessageModel model;
+    model.setUpdateInterval(0);   // 1更新ごとに反映 (トークンあたりのコストを測る)
+
+    const QString userText = QStringLiteral("Could you explain how this works? 例も見せてください。");
+    const QString reply    = makeReply(options.replyChars);
+
+    // 以前の形式: llama_chat_message + strdup した UTF-8 の文字列 (malloc の管理領域は含めない)
+    qsizetype legacyBytes = 0;
+    for (int i = 0; i < options.messages; ++i) {
+        const bool user = i % 2 == 0;
+        const QByteArray role    = user ? QByteArrayLiteral("user") : QByteArrayLiteral("assistant");
+        const QByteArray content = (user ? userText : reply).toUtf8();
+        legacyBytes += qsizetype(sizeof(llama_chat_message)) + role.size() + 1 + content.size() + 1;
+
+        if (user) {
+            model.appendSingle(QStringLiteral("user"), userText);
+            continue;
+        }
+        // 生成中と同じく、毎回先頭からの累積テキストを渡す
+        const int row = model.appendSingle(QStringLiteral("assistant"), QString());
+        for (qsizetype end = options.tokenChars; end < reply.size() + options.tokenChars; end += options.tokenChars) {
+            model.updateMessageContent(row, reply.left(std::min(end, reply.size())));
+        }
+    }
+    const ChatMessageModel::UpdateStats updates = model.takeUpdateStats();
+    const ChatMessageModel::StorageBytes storage = model.storageBytes();
+
+    // スクロール相当: 全行の sender / messageContent を読む
+    const int rows = model.rowCount(QModelIndex());
+    qint64 sink = 0;
+    const double dataNs = timeData(model, options.rounds, sink);
+
+    // 履歴ログに保存し、別のモデルで開き直す (起動時に相当)
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        std::fprintf(stderr, "cannot create a temporary directory\n");
+        return 1;
+    }
+    const QString historyPath = dir.filePath(QStringLiteral("chat-history.log"));
+    model.openHistory(historyPath);
+    for (int i = 0; i < options.messages; ++i) {
+        model.appendSingle(i % 2 == 0 ? QStringLiteral("user") : QStringLiteral("assistant"),
+                           i % 2 == 0 ? userText : reply);
+    }
+    model.commitHistory();
+    QElapsedTimer indexTimer;
+    indexTimer.start();
+    model.indexFinishedRows();
+    const qint64 indexNs = indexTimer.nsecsElapsed();
+
+    static const QString queries[] = {
+        QStringLiteral("values"), QStringLiteral("bold text"), QStringLiteral("ブロック"), QStringLiteral("空行で区切"),
+    };
+    QElapsedTimer searchTimer;
+    searchTimer.start();
+    for (int round = 0; round < options.rounds; ++round) {
+        for (const QString &query : queries) {
+            sink += model.search(query).size();
+        }
+    }
+    const double searchUs = double(searchTimer.nsecsElapsed()) / 1000.0 / (options.rounds * std::size(queries));
+
+    ChatMessageModel restored;
+    QElapsedTimer timer;
+    timer.start();
+    restored.openHistory(historyPath);
+    const qint64 openNs = timer.nsecsElapsed();
+    const double pagedDataNs = timeData(restored, options.rounds, sink);
+
+    std::printf("messages\tbytes_per_msg\tblock_bytes_per_msg\tlegacy_bytes_per_msg\tupdate_ns\tdata_ns\topen_us\tpaged_data_ns\tindex_us_per_msg\tsearch_us\n");
+    std::printf("%d\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.2f\t%.1f\n", rows,
+                double(storage.messages) / rows, double(storage.blocks) / rows, double(legacyBytes) / rows,
+                updates.updates > 0 ? double(updates.publishNs) / updates.updates : 0.0,
+                dataNs, double(openNs) / 1000.0, pagedDataNs,
+                double(indexNs) / 1000.0 / options.messages, searchUs);
+    std::fprintf(stderr, "(checksum %lld)\n", static_cast<long long>(sink));
+    return 0;
+}
@@ -0,0 +1,459 @@
+/*
+ * voice_latency_bench:
+ *   - WAV フィクスチャをマイクの代わりに VoiceDetector へ流し (WavFileCaptureSource)、
+ *     アプリと同じ経路 VoiceDetector → VoiceRecognitionEngine → LlamaResponseGenerator → SpeechOutputStage
+ *     (→ QTextToSpeech)
+ *     で発話終了から各段までの遅延を測る
+ *   - 基準時刻 (発話終了) はファイル本体の最後のサンプルを VoiceDetector に書き込んだ時刻
+ *       vad        : 発話終了 → VAD が発話の終わりを検出 (WhisperRunning)
+ *       whisper    : VAD 終了 → 最終認識結果
+ *       first_tok  : 最終認識結果 → LLM の最初のトークン
+ *       tts        : LLM の最初のトークン → 読み上げ開始 (最初の1文が揃うまで + TTS の起動。
+ *                    QTextToSpeech が Speaking になった時刻)
+ *       eos_*      : 発話終了からの通算
+ *   - VAD の遅延は末尾の無音を実時間で流したときだけ意味を持つ (--speed 1)。
+ *     それ以外の段は計算時間なので --speed を上げても変わらない
+ *   - フィクスチャは発話の直後で切っておくこと (ファイル内に長い無音が残っていると vad が負になる)
+ *
+ * 使用例 (Linux, tiny モデル):
+ *   voice_latency_bench --fixtures benchmarks/fixtures --whisper-model ggml-tiny.en.bin \
+ *                       --llama-model tinyllama-1.1b-chat-q4_0.gguf --runs 5 --no-tts
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QTextToSpeech>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "ComputeBudgetArbiter.h"
+#include "LlamaResponseGenerator.h"
+#include "SpeechOutputStage.h"
+#include "VoiceDetector.h"
+#include "VoiceRecognitionEngine.h"
+#include "WavFileCaptureSource.h"
+#include "common.h"   // COMMON_SAMPLE_RATE
+#include "llama.h"
+
+namespace {
+
+struct Options {
+    QStringList fixtures;
+    QString     whisperModel;
+    QString     llamaModel;
+    QString     language = QStringLiteral("en");
+    double      speed    = 1.0;
+    int         runs     = 3;
+    int         trailingSilenceMs = 1000;
+    int         timeoutMs = 60000;
+    int         nCtx      = 2048;
+    bool        tts       = true;
+};
+
+constexpr double kMissing = std::numeric_limits<double>::quiet_NaN();
+
+// 1回分の計測結果 [ms]。届かなかった段は NaN
+struct RunResult {
+    bool    ok = false;
+    double  vad = kMissing, whisper = kMissing, firstToken = kMissing, tts = kMissing;
+    double  eosToFirstToken = kMissing, eosToTts = kMissing;
+    QString recognized;
+};
+
+double deltaMs(qint64 from, qint64 to)
+{
+    return (from >= 0 && to >= 0) ? double(to - from) / 1e6 : kMissing;
+}
+
+double median(std::vector<double> values)
+{
+    values.erase(std::remove_if(values.begin(), values.end(), [](double v) { return std::isnan(v); }),
+                 values.end());
+    if (values.empty()) {
+        return kMissing;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2.0;
+}
+
+QString formatMs(double ms)
+{
+    return std::isnan(ms) ? QStringLiteral("-") : QString::number(ms, 'f', 1);
+}
+
+//------------------------------------------------------------------------------
+// 1つのフィクスチャを1回流す
+//  whisper は回ごとにロードし直し (計測外)、llama のモデル・コンテキストは使い回して KV キャッシュだけ空にする
+//------------------------------------------------------------------------------
+RunResult runOnce(const Options &options, const QString &wavPath,
+                  llama_model *model, llama_context *ctx, QTextToSpeech *tts)
+{
+    RunResult result;
+
+    VoiceRecParams vrParams;
+    vrParams.model    = options.whisperModel.toStdString();
+    vrParams.language = options.language.toStdString();
+
+    // 時刻は全スレッドからこの時計で取る (記録は DirectConnection で、発生したスレッド上で行う)
+    QElapsedTimer clock;
+    clock.start();
+    const auto now = [&clock] { return clock.nsecsElapsed(); };
+
+    QThread engineThread;
+    QThread detectorThread;
+    QThread llmThread;
+
+    auto *engine = new VoiceRecognitionEngine();
+    engine->moveToThread(&engineThread);
+
+    auto *source   = new WavFileCaptureSource(wavPath, options.speed, options.trailingSilenceMs);
+    auto *detector = new VoiceDetector(vrParams.length_for_inference_ms);
+    detector->setCaptureSource(source);
+    detector->moveToThread(&detectorThread);
+    engine->setAudioBuffer(detector->audioBuffer());
+    QObject::connect(detector, &VoiceDetector::audioAvailable,
+                     engine, &VoiceRecognitionEngine::processAvailableAudio);
+
+    llama_kv_cache_clear(ctx);
+    auto *generator = new LlamaResponseGenerator(nullptr, model, ctx);
+    generator->moveToThread(&llmThread);
+
+    engineThread.start();
+    detectorThread.start();
+    llmThread.start();
+
+    bool whisperOk = false;
+    QMetaObject::invokeMethod(engine, [engine, vrParams, &whisperOk] {
+        whisperOk = engine->initWhisper(vrParams);
+        if (whisperOk) {
+            engine->start();
+        }
+    }, Qt::BlockingQueuedConnection);
+
+    // ---- 以下はメインスレッドの状態 (各スレッドで取った時刻をキュー経由で受け取る) ----
+    QEventLoop loop;
+    qint64 tEndOfFile = -1, tVadEnd = -1, tFinal = -1, tFirstToken = -1, tSpeaking = -1;
+    bool   endOfFile = false, inSpeech = false, llmStarted = false;
+    int    utteranceEnds = 0, finalTexts = 0;
+    QStringList texts;
+    std::atomic<bool> firstTokenSeen {false};
+    // アプリと同じく、生成中の応答を文単位で読み上げる
+    SpeechOutputStage speech;
+    speech.setTextToSpeech(tts);
+
+    const auto finish = [&](bool ok) {
+        result.ok = ok;
+        loop.quit();
+    };
+    // 最後の発話の認識が揃ったら (ファイル終端以降で、認識待ちがない) LLM に渡す
+    const auto maybeStartLlm = [&] {
+        if (llmStarted || !endOfFile || inSpeech || utteranceEnds == 0 || finalTexts < utteranceEnds) {
+            return;
+        }
+        llmStarted = true;
+        result.recognized = texts.join(QLatin1Char(' '));
+        if (result.recognized.isEmpty()) {
+            qWarning() << "[voice_latency_bench] nothing recognized in" << wavPath;
+            finish(false);
+            return;
+        }
+        LlamaChatMessage msg;
+        msg.setRole(QStringLiteral("user"));
+        msg.setContent(result.recognized);
+        const QList<LlamaChatMessage> messages {msg};
+        ComputeBudgetArbiter::instance().setPhase(LlamaRunning);
+        QMetaObject::invokeMethod(generator, [generator, messages] {
+            generator->generate(messages);
+        }, Qt::QueuedConnection);
+    };
+    const auto onMain = [&loop](auto &&fn) {
+        QMetaObject::invokeMethod(&loop, std::forward<decltype(fn)>(fn), Qt::QueuedConnection);
+    };
+
+    QObject::connect(source, &WavFileCaptureSource::endOfFileReached, source, [&, onMain] {
+        const qint64 t = now();
+        onMain([&, t] {
+            endOfFile  = true;
+            tEndOfFile = t;
+            maybeStartLlm();
+        });
+    }, Qt::DirectConnection);
+    QObject::connect(source, &AudioCaptureSource::finished, source, [&, onMain] {
+        onMain([&] {
+            if (utteranceEnds == 0) {
+                qWarning() << "[voice_latency_bench] VAD found no speech in" << wavPath;
+                finish(false);
+            }
+        });
+    }, Qt::DirectConnection);
+    QObject::connect(engine, &VoiceRecognitionEngine::changeOperationPhaseTo, engine,
+                     [&, onMain](OperationPhase phase) {
+        const qint64 t = now();
+        onMain([&, phase, t] {
+            ComputeBudgetArbiter::instance().setPhase(phase);
+            if (phase == VadRunning) {
+                inSpeech = true;
+            } else if (phase == WhisperRunning) {
+                inSpeech = false;
+                ++utteranceEnds;
+                tVadEnd = t;
+            }
+        });
+    }, Qt::DirectConnection);
+    QObject::connect(engine, &VoiceRecognitionEngine::finalTextRecognized, engine,
+                     [&, onMain](const QString &text) {
+        const qint64 t = now();
+        onMain([&, text, t] {
+            ++finalTexts;
+            if (!text.trimmed().isEmpty()) {
+                texts << text.trimmed();
+            }
+            tFinal = t;
+            maybeStartLlm();
+        });
+    }, Qt::DirectConnection);
+    QObject::connect(generator, &LlamaResponseGenerator::partialResponseReady, generator,
+                     [&, onMain](const QString &textSoFar) {
+        if (!firstTokenSeen.exchange(true)) {
+            const qint64 t = now();
+            onMain([&, t] { tFirstToken = t; });
+        }
+        onMain([&, textSoFar] { speech.appendResponse(textSoFar); });
+    }, Qt::DirectConnection);
+    QObject::connect(generator, &LlamaResponseGenerator::generationFinished, &loop,
+                     [&](const QString &reply) {
+        ComputeBudgetArbiter::instance().setPhase(WaitingUserInput);
+        speech.finishResponse(reply);
+        if (!tts || tSpeaking >= 0 || !speech.isSpeaking()) {
+            finish(true);
+        }
+    }, Qt::QueuedConnection);
+    QObject::connect(generator, &LlamaResponseGenerator::generationError, &loop,
+                     [&](const QString &error) {
+        qWarning() << "[voice_latency_bench] generation error:" << error;
+        finish(false);
+    }, Qt::QueuedConnection);
+    QMetaObject::Connection ttsConnection;
+    if (tts) {
+        ttsConnection = QObject::connect(tts, &QTextToSpeech::stateChanged, &loop,
+                                         [&](QTextToSpeech::State state) {
+            if (state == QTextToSpeech::Speaking && tSpeaking < 0) {
+                tSpeaking = now();
+                speech.cancel();
+                finish(true);
+            }
+        });
+    }
+
+    QTimer::singleShot(options.timeoutMs, &loop, [&] {
+        qWarning() << "[voice_latency_bench] timed out:" << wavPath;
+        finish(false);
+    });
+
+    if (whisperOk) {
+        bool captureOk = false;
+        QMetaObject::invokeMethod(detector, [detector, &captureOk] {
+            captureOk = detector->init(COMMON_SAMPLE_RATE, 1) && detector->resume();
+        }, Qt::BlockingQueuedConnection);
+        if (captureOk) {
+            loop.exec();
+        } else {
+            qWarning() << "[voice_latency_bench] failed to open" << wavPath;
+        }
+    } else {
+        qWarning() << "[voice_latency_bench] failed to load whisper model" << options.whisperModel;
+    }
+    if (ttsConnection) {
+        QObject::disconnect(ttsConnection);
+    }
+
+    // ---- 後片付け (途中で打ち切った生成は中断させる) ----
+    generator->cancelGeneration(1);
+    QMetaObject::invokeMethod(detector, [detector] {
+        if (detector->isInitialized()) {
+            detector->pause();
+        }
+    }, Qt::BlockingQueuedConnection);
+    QMetaObject::invokeMethod(engine, [engine] {
+        if (engine->isRunning()) {
+            engine->stop();
+        }
+    }, Qt::BlockingQueuedConnection);
+    detectorThread.quit();
+    engineThread.quit();
+    llmThread.quit();
+    detectorThread.wait();
+    engineThread.wait();
+    llmThread.wait();
+    delete detector;
+    delete engine;
+    delete generator;
+    ComputeBudgetArbiter::instance().setPhase(WaitingUserInput);
+    ComputeBudgetArbiter::instance().setSpeechActive(false);
+
+    result.vad             = deltaMs(tEndOfFile, tVadEnd);
+    result.whisper         = deltaMs(tVadEnd, tFinal);
+    result.firstToken      = deltaMs(tFinal, tFirstToken);
+    result.tts             = deltaMs(tFirstToken, tSpeaking);
+    result.eosToFirstToken = deltaMs(tEndOfFile, tFirstToken);
+    result.eosToTts        = deltaMs(tEndOfFile, tSpeaking);
+    return result;
+}
+
+bool parseOptions(const QCoreApplication &app, Options &options)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Replays WAV fixtures through the voice pipeline and reports end-of-speech latencies."));
+    parser.addHelpOption();
+    const QCommandLineOption fixturesOpt(QStringLiteral("fixtures"),
+                                         QStringLiteral("WAV file or directory of WAV files."), QStringLiteral("path"));
+    const QCommandLineOption whisperOpt(QStringLiteral("whisper-model"),
+                                        QStringLiteral("whisper model file."), QStringLiteral("file"));
+    const QCommandLineOption llamaOpt(QStringLiteral("llama-model"),
+                                      QStringLiteral("llama gguf model file."), QStringLiteral("file"));
+    const QCommandLineOption languageOpt(QStringLiteral("language"),
+                                         QStringLiteral("whisper language (default: en)."), QStringLiteral("code"));
+    const QCommandLineOption speedOpt(QStringLiteral("speed"),
+                                      QStringLiteral("Playback speed; 1 = real time, 0 = as fast as possible (default: 1)."),
+                                      QStringLiteral("factor"));
+    const QCommandLineOption runsOpt(QStringLiteral("runs"),
+                                     QStringLiteral("Runs per fixture (default: 3)."), QStringLiteral("n"));
+    const QCommandLineOption silenceOpt(QStringLiteral("trailing-silence"),
+                                        QStringLiteral("Silence appended after each fixture in ms (default: 1000)."),
+                                        QStringLiteral("ms"));
+    const QCommandLineOption noTtsOpt(QStringLiteral("no-tts"),
+                                      QStringLiteral("Skip text-to-speech (no audio output device needed)."));
+    parser.addOptions({fixturesOpt, whisperOpt, llamaOpt, languageOpt, speedOpt, runsOpt, silenceOpt, noTtsOpt});
+    parser.process(app);
+
+    if (!parser.isSet(fixturesOpt) || !parser.isSet(whisperOpt) || !parser.isSet(llamaOpt)) {
+        std::fprintf(stderr, "--fixtures, --whisper-model and --llama-model are required\n");
+        return false;
+    }
+
+    const QFileInfo fixtures(parser.value(fixturesOpt));
+    if (fixtures.isDir()) {
+        const QDir dir(fixtures.absoluteFilePath());
+        for (const QString &name : dir.entryList({QStringLiteral("*.wav"), QStringLiteral("*.WAV")},
+                                                 QDir::Files, QDir::Name)) {
+            options.fixtures << dir.absoluteFilePath(name);
+        }
+    } else if (fixtures.isFile()) {
+        options.fixtures << fixtures.absoluteFilePath();
+    }
+    if (options.fixtures.isEmpty()) {
+        std::fprintf(stderr, "no WAV fixtures found in %s\n", qPrintable(fixtures.filePath()));
+        return false;
+    }
+
+    options.whisperModel = parser.value(whisperOpt);
+    options.llamaModel   = parser.value(llamaOpt);
+    if (parser.isSet(languageOpt)) {
+        options.language = parser.value(languageOpt);
+    }
+    if (parser.isSet(speedOpt)) {
+        options.speed = parser.value(speedOpt).toDouble();
+    }
+    if (parser.isSet(runsOpt)) {
+        options.runs = std::max(parser.value(runsOpt).toInt(), 1);
+    }
+    if (parser.isSet(silenceOpt)) {
+        options.trailingSilenceMs = std::max(parser.value(silenceOpt).toInt(), 0);
+    }
+    options.tts = !parser.isSet(noTtsOpt);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    Options options;
+    if (!parseOptions(app, options)) {
+        return 2;
+    }
+    if (options.speed != 1.0) {
+        std::fprintf(stderr, "note: --speed %.2f; the vad column is only meaningful at real time (--speed 1)\n",
+                     options.speed);
+    }
+
+    // llama はアプリ (LlamaChatEngine::doEngineInit) と同じ設定で1回だけロードする
+    ggml_backend_load_all();
+    llama_model_params modelParams = llama_model_default_params();
+    modelParams.n_gpu_layers = 99;   // LlamaChatEngine::mNGl
+    llama_model *model = llama_load_model_from_file(options.llamaModel.toUtf8().constData(), modelParams);
+    if (!model) {
+        std::fprintf(stderr, "unable to load llama model %s\n", qPrintable(options.llamaModel));
+        return 1;
+    }
+    llama_context_params ctxParams = llama_context_default_params();
+    ctxParams.n_ctx           = options.nCtx;
+    ctxParams.n_batch         = options.nCtx;
+    ctxParams.n_threads       = ComputeBudgetArbiter::instance().threadsFor(ComputeBudgetArbiter::LlmDecode);
+    ctxParams.n_threads_batch = ComputeBudgetArbiter::instance().threadsFor(ComputeBudgetArbiter::LlmPrefill);
+    llama_context *ctx = llama_new_context_with_model(model, ctxParams);
+    if (!ctx) {
+        std::fprintf(stderr, "failed to create llama_context\n");
+        llama_free_model(model);
+        return 1;
+    }
+
+    std::unique_ptr<QTextToSpeech> tts;
+    if (options.tts) {
+        tts = std::make_unique<QTextToSpeech>();
+    }
+
+    std::printf("fixture\trun\tvad_ms\twhisper_ms\tfirst_token_ms\ttts_ms\teos_to_first_token_ms\teos_to_tts_ms\n");
+    int failures = 0;
+    for (const QString &fixture : options.fixtures) {
+        const QString name = QFileInfo(fixture).fileName();
+        std::vector<double> vad, whisper, firstToken, ttsStart, eosToFirstToken, eosToTts;
+        QString recognized;
+        for (int run = 1; run <= options.runs; ++run) {
+            const RunResult r = runOnce(options, fixture, model, ctx, tts.get());
+            if (!r.ok) {
+                ++failures;
+                std::printf("%s\t%d\tFAILED\n", qPrintable(name), run);
+                std::fflush(stdout);
+                continue;
+            }
+            recognized = r.recognized;
+            vad.push_back(r.vad);
+            whisper.push_back(r.whisper);
+            firstToken.push_back(r.firstToken);
+            ttsStart.push_back(r.tts);
+            eosToFirstToken.push_back(r.eosToFirstToken);
+            eosToTts.push_back(r.eosToTts);
+            std::printf("%s\t%d\t%s\t%s\t%s\t%s\t%s\t%s\n", qPrintable(name), run,
+                        qPrintable(formatMs(r.vad)), qPrintable(formatMs(r.whisper)),
+                        qPrintable(formatMs(r.firstToken)), qPrintable(formatMs(r.tts)),
+                        qPrintable(formatMs(r.eosToFirstToken)), qPrintable(formatMs(r.eosToTts)));
+            std::fflush(stdout);
+        }
+        std::printf("%s\tmedian\t%s\t%s\t%s\t%s\t%s\t%s\n", qPrintable(name),
+                    qPrintable(formatMs(median(vad))), qPrintable(formatMs(median(whisper))),
+                    qPrintable(formatMs(median(firstToken))), qPrintable(formatMs(median(ttsStart))),
+                    qPrintable(formatMs(median(eosToFirstToken))), qPrintable(formatMs(median(eosToTts))));
+        std::fprintf(stderr, "%s: \"%s\"\n", qPrintable(name), qPrintable(recognized));
+    }
+
+    tts.reset();
+    llama_free(ctx);
+    llama_free_model(model);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+/*
+ * wire_protocol_bench:
+ *   - リモート生成の1トークンあたりの送受信コストを、JSON とバイナリ形式 (RemoteWireProtocol) で比べる (通信なし)
+ *       json   : サーバーが {"action":"partialResponse","content":<累積テキスト>} を作り、クライアントが解析する
+ *       binary : サーバーが Delta (増えた分の UTF-8、qlt-binary/3 の要求 ID 付き) を作り、クライアントが解析して累積テキストに繋ぐ
+ *   - 列:
+ *       bytes_per_token : 1トークンあたりの送信量
+ *       encode_ns       : 1トークンあたりのサーバー側の組み立て時間
+ *       decode_ns       : 1トークンあたりのクライアント側の解析時間 (累積テキストを得るまで)
+ *   - 続けて、turns 回目のターンの生成要求の大きさを比べる
+ *       json_request_bytes     : JSON で履歴を全部送る
+ *       generate_request_bytes : バイナリで履歴を全部送る (qlt-binary/1、または再同期)
+ *       append_request_bytes   : 増えたメッセージだけを送る (qlt-binary/2 のセッション)
+ *
+ * 使用例:
+ *   wire_protocol_bench --tokens 1000 --token-chars 4 --rounds 20 --turns 50
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringDecoder>
+#include <cstdio>
+#include <vector>
+
+#include "RemoteWireProtocol.h"
+
+namespace {
+
+struct Options {
+    int tokens     = 1000;
+    int tokenChars = 4;     // 1トークンの文字数 (英語 + 日本語)
+    int rounds     = 20;
+    int turns      = 50;    // 生成要求の大きさを比べるターン
+};
+
+bool parseOptions(const QCoreApplication &app, Options &options)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Compares the per-token cost of the JSON and binary remote generation protocols."));
+    parser.addHelpOption();
+    const QCommandLineOption tokensOpt(QStringLiteral("tokens"),
+                                       QStringLiteral("Tokens per reply (default: 1000)."), QStringLiteral("n"));
+    const QCommandLineOption tokenOpt(QStringLiteral("token-chars"),
+                                      QStringLiteral("Characters per token (default: 4)."), QStringLiteral("n"));
+    const QCommandLineOption roundsOpt(QStringLiteral("rounds"),
+                                       QStringLiteral("Replies to stream (default: 20)."), QStringLiteral("n"));
+    const QCommandLineOption turnsOpt(QStringLiteral("turns"),
+                                      QStringLiteral("Turn whose request size is compared (default: 50)."),
+                                      QStringLiteral("n"));
+    parser.addOptions({tokensOpt, tokenOpt, roundsOpt, turnsOpt});
+    parser.process(app);
+
+    const auto positive = [&parser](const QCommandLineOption &option, int &value) {
+        if (!parser.isSet(option)) {
+            return true;
+        }
+        bool ok = false;
+        value = parser.value(option).toInt(&ok);
+        if (!ok || value <= 0) {
+            std::fprintf(stderr, "--%s must be a positive integer\n", qPrintable(option.names().constFirst()));
+            return false;
+        }
+        return true;
+    };
+    return positive(tokensOpt, options.tokens) && positive(tokenOpt, options.tokenChars)
+           && positive(roundsOpt, options.rounds) && positive(turnsOpt, options.turns);
+}
+
+// 英語と日本語が交互に並ぶトークン (サーバーは UTF-8 のまま持っている)
+std::vector<QByteArray> makeTokens(const Options &options)
+{
+    static const QString text = QStringLiteral("The reply streams token by token. 応答はトークンごとに届きます。");
+    std::vector<QByteArray> tokens;
+    tokens.reserve(options.tokens);
+    for (int i = 0; i < options.tokens; ++i) {
+        const qsizetype start = (qsizetype(i) * options.tokenChars) % text.size();
+        tokens.push_back((text + text).mid(start, options.tokenChars).toUtf8());
+    }
+    return tokens;
+}
+
+struct Result {
+    qint64 bytes    = 0;
+    qint64 encodeNs = 0;
+    qint64 decodeNs = 0;
+};
+
+Result runJson(const std::vector<QByteArray> &tokens, int rounds, qint64 &sink)
+{
+    Result result;
+    QElapsedTimer timer;
+    for (int round = 0; round < rounds; ++round) {
+        QByteArray soFar;   // サーバーの累積テキスト
+        for (const QByteArray &token : tokens) {
+            soFar += token;
+            timer.start();
+            QJsonObject json;
+            json[QStringLiteral("action")]  = QStringLiteral("partialResponse");
+            json[QStringLiteral("content")] = QString::fromUtf8(soFar);
+            const QString message = QString::fromUtf8(QJsonDocument(json).toJson(QJsonDocument::Compact));
+            result.encodeNs += timer.nsecsElapsed();
+            result.bytes    += message.toUtf8().size();
+
+            timer.start();
+            const QJsonObject received = QJsonDocument::fromJson(message.toUtf8()).object();
+            const QString textSoFar = received.value(QStringLiteral("content")).toString();
+            result.decodeNs += timer.nsecsElapsed();
+            sink += textSoFar.size();
+        }
+    }
+    return result;
+}
+
+Result runBinary(const std::vector<QByteArray> &tokens, int rounds, qint64 &sink)
+{
+    using namespace RemoteWireProtocol;
+    const Route route {3, 1};
+    Result result;
+    QElapsedTimer timer;
+    for (int round = 0; round < rounds; ++round) {
+        QString textSoFar;
+        QStringDecoder decoder(QStringDecoder::Utf8);
+        for (const QByteArray &token : tokens) {
+            timer.start();
+            const QByteArray frame = encodeText(route, MessageType::Delta, QByteArrayView(token));
+            result.encodeNs += timer.nsecsElapsed();
+            result.bytes    += frame.size();
+
+            timer.start();
+            Message message;
+            if (decode(route.version, frame, message)) {
+                textSoFar += QString(decoder.decode(message.text));
+            }
+            result.decodeNs += timer.nsecsElapsed();
+            sink += textSoFar.size();
+        }
+    }
+    return result;
+}
+
+// 現在のクライアントと同じ JSON の生成要求
+QByteArray jsonRequest(const QList<LlamaChatMessage> &history)
+{
+    QJsonArray msgs;
+    for (const auto &m : history) {
+        QJsonObject obj;
+        obj["role"]    = m.role();
+        obj["content"] = m.content();
+        msgs.append(obj);
+    }
+    QJsonObject json;
+    json["action"]   = QStringLiteral("generate");
+    json["messages"] = msgs;
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    Options options;
+    if (!parseOptions(app, options)) {
+        return 2;
+    }
+
+    const std::vector<QByteArray> tokens = makeTokens(options);
+    const double count = double(options.tokens) * options.rounds;
+    qint64 sink = 0;
+
+    std::printf("protocol\ttokens\tbytes_per_token\tencode_ns\tdecode_ns\n");
+    const auto print = [&](const char *name, const Result &result) {
+        std::printf("%s\t%d\t%.1f\t%.1f\t%.1f\n", name, options.tokens,
+                    double(result.bytes) / count, double(result.encodeNs) / count, double(result.decodeNs) / count);
+    };
+    print("json", runJson(tokens, options.rounds, sink));
+    print("binary", runBinary(tokens, options.rounds, sink));
+
+    // turns 回目の生成要求 (チャット履歴はユーザーの発言だけ)
+    QList<LlamaChatMessage> history;
+    for (int turn = 0; turn < options.turns; ++turn) {
+        LlamaChatMessage message;
+        message.setRole(QStringLiteral("user"));
+        message.setContent(QStringLiteral("Turn %1: could you explain the previous answer in more detail? 詳しく教えてください。")
+                               .arg(turn));
+        history << message;
+    }
+    const RemoteWireProtocol::Route route {3, 1, 1};
+    std::printf("\nturns\tjson_request_bytes\tgenerate_request_bytes\tappend_request_bytes\n");
+    std::printf("%d\t%lld\t%lld\t%lld\n", options.turns,
+                static_cast<long long>(jsonRequest(history).size()),
+                static_cast<long long>(RemoteWireProtocol::encodeGenerate(route, history).size()),
+                static_cast<long long>(RemoteWireProtocol::encodeAppend(route, history, history.size() - 1).size()));
+    std::fprintf(stderr, "(checksum %lld)\n", static_cast<long long>(sink));
+    return 0;
+}
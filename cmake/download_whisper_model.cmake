@@ -124,3 +124,41 @@ add_custom_command(TARGET QllamaTalkApp POST_BUILD
     "$<TARGET_FILE_DIR:QllamaTalkApp>/${WHISPER_MODEL_NAME}"
     COMMENT "Copying Whisper model to QllamaTalkApp binary directory"
 )
+
+#
+# 2パス認識用の下書きモデル (任意)
+#   -DWHISPER_DRAFT_MODEL_NAME=ggml-tiny.bin のように指定すると、そのモデルで即時に認識し、
+#   WHISPER_MODEL_NAME のモデルでバックグラウンドに認識し直す (清書)。Android は未対応
+# (Optional fast model for two-pass recognition. The draft model transcribes
+#  immediately and WHISPER_MODEL_NAME refines the result in the background.)
+#
+set(WHISPER_DRAFT_MODEL_NAME "" CACHE STRING "Optional fast whisper model for two-pass recognition (e.g. ggml-tiny.bin)")
+if(WHISPER_DRAFT_MODEL_NAME AND NOT ANDROID)
+    set(WHISPER_DRAFT_MODEL_URL "https://huggingface.co/ggerganov/whisper.cpp/resolve/main/${WHISPER_DRAFT_MODEL_NAME}?download=true")
+    set(WHISPER_DRAFT_MODEL_OUTPUT_PATH "${WHISPER_MODEL_DIR}/${WHISPER_DRAFT_MODEL_NAME}")
+    message(STATUS "Draft model   : ${WHISPER_DRAFT_MODEL_OUTPUT_PATH}")
+
+    if(NOT EXISTS "${WHISPER_DRAFT_MODEL_OUTPUT_PATH}")
+        message(STATUS "Downloading whisper draft model from: ${WHISPER_DRAFT_MODEL_URL}")
+        file(DOWNLOAD
+            "${WHISPER_DRAFT_MODEL_URL}"
+            "${WHISPER_DRAFT_MODEL_OUTPUT_PATH}"
+            SHOW_PROGRESS
+            STATUS DRAFT_DOWNLOAD_STATUS
+        )
+        list(GET DRAFT_DOWNLOAD_STATUS 0 DRAFT_DOWNLOAD_RESULT_CODE)
+        list(GET DRAFT_DOWNLOAD_STATUS 1 DRAFT_DOWNLOAD_ERROR_MESSAGE)
+        if(NOT DRAFT_DOWNLOAD_RESULT_CODE EQUAL 0)
+            message(FATAL_ERROR "Failed to download Whisper draft model. Error: ${DRAFT_DOWNLOAD_ERROR_MESSAGE}")
+        endif()
+    endif()
+
+    add_custom_command(TARGET QllamaTalkApp POST_BUILD
+        COMMAND ${CMAKE_COMMAND} -E copy
+        "${WHISPER_DRAFT_MODEL_OUTPUT_PATH}"
+        "$<TARGET_FILE_DIR:QllamaTalkApp>/${WHISPER_DRAFT_MODEL_NAME}"
+        COMMENT "Copying Whisper draft model to QllamaTalkApp binary directory"
+    )
+elseif(ANDROID)
+    set(WHISPER_DRAFT_MODEL_NAME "")
+endif()
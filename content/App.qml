@@ -73,6 +73,13 @@ ApplicationWindow {
         }
     }
 
+    MessageDialog {
+        id: voiceRecognitionErrorDialog
+        text: qsTr("Failed to load the voice recognition model")
+        informativeText: qsTr("Turn voice recognition on again to retry.")
+        buttons: MessageDialog.Ok
+    }
+
     // ヘッダー部分
     header: Item {
         width: parent.width
@@ -143,28 +150,26 @@ ApplicationWindow {
     TextToSpeech {
         id: tts
 
-        onStateChanged: {
-            switch (state) {
-                case TextToSpeech.Ready:
-                LlamaChatEngine.resumeVoiceDetection()
-                LlamaChatEngine.operationPhase = 4 //LlamaChatEngine.WaitingUserInput
-                break
-                case TextToSpeech.Speaking:
-                break
-                case TextToSpeech.Paused:
-                break
-                case TextToSpeech.Error:
-                break
-            }
+        // 応答は生成中から文単位で LlamaChatEngine.speechOutput が読み上げる
+        Component.onCompleted: LlamaChatEngine.speechOutput.textToSpeech = tts
+    }
+    Connections {
+        target: LlamaChatEngine.speechOutput
+        // 読み上げ中のマイクの停止・再開 (または割り込み待ち) は LlamaChatEngine 側で行う
+        function onSpeechStarted() {
+            LlamaChatEngine.operationPhase = 5 //LlamaChatEngine.Speaking
+        }
+        function onSpeechFinished() {
+            LlamaChatEngine.operationPhase = 4 //LlamaChatEngine.WaitingUserInput
         }
     }
     Connections {
         target: LlamaChatEngine
         function onGenerationFinishedToQML(text) {
-            // 自分が読み上げたテキストを検知してしまわないように、voice detectionを一時的に止める
-            LlamaChatEngine.pauseVoiceDetection()
-            tts.say(text)
-            LlamaChatEngine.operationPhase = 5 //LlamaChatEngine.Speaking
+            // 生成が終わってもまだ読み上げ中なら Speaking のまま
+            if (LlamaChatEngine.speechOutput.speaking) {
+                LlamaChatEngine.operationPhase = 5 //LlamaChatEngine.Speaking
+            }
         }
     }
 
@@ -405,6 +410,31 @@ ApplicationWindow {
                                     property: "voiceRecognitionEnabled"
                                     value: voiceRecognitionSwitch.checked
                                 }
+                                Connections {
+                                    target: LlamaChatEngine
+                                    function onVoiceRecognitionInitFailed() {
+                                        // whisper のロードに失敗した。スイッチを戻す (もう一度オンにすると再試行する)
+                                        voiceRecognitionSwitch.checked = false
+                                        voiceRecognitionErrorDialog.open()
+                                    }
+                                }
+                            }
+                        }
+                    },
+                    Component {
+                        RowLayout {
+                            width: voiceSettingsExpander.width
+                            spacing: 8
+                            Label {
+                                text: qsTr("Barge-in")
+                                font.pointSize: 16
+                                Layout.alignment: Qt.AlignVCenter
+                                Layout.minimumWidth: voiceSettingsExpander.width * 0.3
+                            }
+                            // 読み上げ中も聞き取りを続け、話しかけたら読み上げと生成を止める
+                            Switch {
+                                checked: LlamaChatEngine.bargeInEnabled
+                                onToggled: LlamaChatEngine.bargeInEnabled = checked
                             }
                         }
                     },
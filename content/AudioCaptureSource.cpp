@@ -0,0 +1,119 @@
+#include "AudioCaptureSource.h"
+
+#include <QAudioDevice>
+#include <QAudioSource>
+#include <QDebug>
+#include <QMediaDevices>
+
+namespace {
+// デバイスのフォーマットを選ぶ (ネイティブのレート・チャンネル数で、VoiceDetector が変換できるサンプル形式)
+bool chooseCaptureFormat(const QAudioDevice &device, QAudioFormat &format)
+{
+    // ネイティブ (preferredFormat) のレートとチャンネル数を使い、サンプル形式は
+    // Float → ネイティブのまま → Int16 の順に試す
+    const QAudioFormat preferred = device.preferredFormat();
+    const auto convertible = [](QAudioFormat::SampleFormat sampleFormat) {
+        return sampleFormat == QAudioFormat::Float || sampleFormat == QAudioFormat::Int16
+               || sampleFormat == QAudioFormat::Int32 || sampleFormat == QAudioFormat::UInt8;
+    };
+
+    QAudioFormat candidate = preferred;
+    for (const QAudioFormat::SampleFormat sampleFormat
+         : {QAudioFormat::Float, preferred.sampleFormat(), QAudioFormat::Int16}) {
+        if (!convertible(sampleFormat)) {
+            continue;
+        }
+        candidate.setSampleFormat(sampleFormat);
+        if (candidate.sampleRate() > 0 && candidate.channelCount() > 0 && device.isFormatSupported(candidate)) {
+            format = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+MicrophoneCaptureSource::MicrophoneCaptureSource(QObject *parent)
+    : AudioCaptureSource(parent)
+{
+}
+
+MicrophoneCaptureSource::~MicrophoneCaptureSource()
+{
+    stop();
+}
+
+bool MicrophoneCaptureSource::open()
+{
+    if (m_audioSource) {
+        return true;
+    }
+
+    const QAudioDevice device = QMediaDevices::defaultAudioInput();
+    if (device.isNull()) {
+        qWarning() << "[MicrophoneCaptureSource] no audio input device";
+        return false;
+    }
+    m_description = device.description();
+    qDebug() << "[MicrophoneCaptureSource] default audio input device:" << m_description;
+
+    // OS にリサンプルさせると遅延と CPU が余計にかかるので、ネイティブの形式で開く
+    QAudioFormat formatWanted;
+    if (!chooseCaptureFormat(device, formatWanted)) {
+        qWarning() << "[MicrophoneCaptureSource] No usable capture format. preferredFormat.sampleFormat="
+                   << device.preferredFormat().sampleFormat()
+                   << " sampleRate=" << device.preferredFormat().sampleRate()
+                   << " channelCount=" << device.preferredFormat().channelCount();
+        return false;
+    }
+
+    m_audioSource = new QAudioSource(device, formatWanted, this);
+
+    // debug: stateChanged を監視
+    connect(m_audioSource, &QAudioSource::stateChanged,
+            this, [this](QAudio::State newState) {
+                qDebug() << "[MicrophoneCaptureSource] stateChanged ->" << newState
+                         << "error=" << m_audioSource->error();
+            });
+    return true;
+}
+
+QAudioFormat MicrophoneCaptureSource::format() const
+{
+    return m_audioSource ? m_audioSource->format() : QAudioFormat();
+}
+
+QString MicrophoneCaptureSource::description() const
+{
+    return m_description;
+}
+
+void MicrophoneCaptureSource::start(QIODevice *sink)
+{
+    if (m_audioSource) {
+        m_audioSource->start(sink);
+    }
+}
+
+void MicrophoneCaptureSource::stop()
+{
+    if (m_audioSource) {
+        m_audioSource->stop();
+        delete m_audioSource;
+        m_audioSource = nullptr;
+    }
+}
+
+void MicrophoneCaptureSource::suspend()
+{
+    if (m_audioSource) {
+        m_audioSource->suspend();
+    }
+}
+
+void MicrophoneCaptureSource::resume()
+{
+    if (m_audioSource) {
+        m_audioSource->resume();
+    }
+}
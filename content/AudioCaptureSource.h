@@ -0,0 +1,69 @@
+#ifndef AUDIOCAPTURESOURCE_H
+#define AUDIOCAPTURESOURCE_H
+
+#include <QObject>
+#include <QAudioFormat>
+#include <QString>
+
+class QAudioSource;
+class QIODevice;
+
+/*
+ * AudioCaptureSource:
+ *   - VoiceDetector に PCM を供給する入力元の抽象 (マイク / WAV ファイルなど)
+ *   - open() で入力元の形式 (レート・チャンネル数・サンプル形式) を決め、
+ *     start() で渡された QIODevice (VoiceDetector の pull デバイス) へ format() の形式のまま書き込む
+ *   - 変換 (float 化・ダウンミックス・リサンプル) は VoiceDetector 側で行うので、ここでは何もしない
+ *   - VoiceDetector と同じスレッドで使う (VoiceDetector::setCaptureSource() で子オブジェクトになる)
+ */
+class AudioCaptureSource : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AudioCaptureSource(QObject *parent = nullptr) : QObject(parent) {}
+    ~AudioCaptureSource() override = default;
+
+    // 入力元を開いて形式を決める。成功したら format() が有効になる
+    virtual bool open() = 0;
+    virtual QAudioFormat format() const = 0;
+    // ログ用の説明 (デバイス名やファイル名)
+    virtual QString description() const = 0;
+
+    // sink への書き込みを開始する。suspend() 中は書き込まない
+    virtual void start(QIODevice *sink) = 0;
+    virtual void stop() = 0;
+    virtual void suspend() = 0;
+    virtual void resume() = 0;
+
+signals:
+    // これ以上書き込むデータがない (ファイルの終端など。マイクでは発生しない)
+    void finished();
+};
+
+/*
+ * MicrophoneCaptureSource:
+ *   - 既定の入力デバイスを QAudioSource の pull モードで使う (アプリの通常の入力元)
+ *   - デバイスはネイティブのサンプルレート・チャンネル数のまま開く (OS 側のリサンプルを避ける)
+ */
+class MicrophoneCaptureSource : public AudioCaptureSource
+{
+    Q_OBJECT
+public:
+    explicit MicrophoneCaptureSource(QObject *parent = nullptr);
+    ~MicrophoneCaptureSource() override;
+
+    bool open() override;
+    QAudioFormat format() const override;
+    QString description() const override;
+
+    void start(QIODevice *sink) override;
+    void stop() override;
+    void suspend() override;
+    void resume() override;
+
+private:
+    QAudioSource *m_audioSource = nullptr;
+    QString       m_description;
+};
+
+#endif // AUDIOCAPTURESOURCE_H
@@ -0,0 +1,75 @@
+#include "AudioHistoryBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+AudioHistoryBuffer::AudioHistoryBuffer(size_t capacity)
+{
+    reset(capacity);
+}
+
+void AudioHistoryBuffer::reset(size_t capacity)
+{
+    m_capacity = capacity;
+    m_data.assign(capacity * 2, 0.0f);
+    m_data.shrink_to_fit();
+    m_total     = 0;
+    m_clearedAt = 0;
+}
+
+void AudioHistoryBuffer::clear()
+{
+    m_clearedAt = m_total;
+}
+
+void AudioHistoryBuffer::append(const float *samples, size_t count)
+{
+    if (m_capacity == 0 || count == 0) {
+        return;
+    }
+    // 容量を超える分は古い側を捨てる (最後の m_capacity サンプルだけ書けば十分)
+    if (count > m_capacity) {
+        samples  += count - m_capacity;
+        m_total  += count - m_capacity;
+        count     = m_capacity;
+    }
+
+    size_t pos = static_cast<size_t>(m_total % m_capacity);
+    size_t remaining = count;
+    while (remaining > 0) {
+        const size_t chunk = std::min(remaining, m_capacity - pos);
+        std::memcpy(m_data.data() + pos,              samples, chunk * sizeof(float));
+        std::memcpy(m_data.data() + pos + m_capacity, samples, chunk * sizeof(float));
+        samples   += chunk;
+        remaining -= chunk;
+        pos = 0;
+    }
+    m_total += count;
+}
+
+size_t AudioHistoryBuffer::size() const
+{
+    return static_cast<size_t>(std::min<uint64_t>(m_total - m_clearedAt, m_capacity));
+}
+
+AudioHistoryBuffer::View AudioHistoryBuffer::last(size_t count) const
+{
+    count = std::min(count, size());
+    return range(m_total - count, m_total);
+}
+
+AudioHistoryBuffer::View AudioHistoryBuffer::range(uint64_t begin, uint64_t end) const
+{
+    View view;
+    begin = std::max(begin, oldestAvailable());
+    end   = std::min(end, m_total);
+    if (m_capacity == 0 || begin >= end) {
+        view.begin = std::min(begin, m_total);
+        return view;
+    }
+    // begin の位置から最大 m_capacity 個はミラーのおかげで連続している
+    view.data  = m_data.data() + static_cast<size_t>(begin % m_capacity);
+    view.size  = static_cast<size_t>(end - begin);
+    view.begin = begin;
+    return view;
+}
@@ -0,0 +1,62 @@
+#ifndef AUDIOHISTORYBUFFER_H
+#define AUDIOHISTORYBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * AudioHistoryBuffer:
+ *   - 直近 capacity サンプルだけを保持する固定容量の循環バッファ (音声認識スレッド専用)
+ *   - 何時間録音し続けてもメモリ使用量は capacity で頭打ち
+ *   - 各サンプルを「本体」と「ミラー」(本体の直後) の2か所に書き込むことで、
+ *     保持範囲内の任意の区間を折り返しなしの連続領域として返せる
+ *     → VAD や whisper_full() にコピーなしでポインタを渡せる
+ *   - サンプル位置は録音開始からの通し番号 (絶対インデックス) で扱う
+ */
+class AudioHistoryBuffer
+{
+public:
+    // 連続したサンプル列への参照 (コピーなし)。次の append() までは有効
+    struct View {
+        const float *data  = nullptr;
+        size_t       size  = 0;
+        uint64_t     begin = 0;   // data[0] の絶対インデックス
+        uint64_t end() const { return begin + size; }
+        bool empty() const { return size == 0; }
+    };
+
+    AudioHistoryBuffer() = default;
+    explicit AudioHistoryBuffer(size_t capacity);
+
+    // 容量を変更する (内容は破棄される)
+    void reset(size_t capacity);
+    // 内容を破棄する (絶対インデックスは継続する)
+    void clear();
+
+    void append(const float *samples, size_t count);
+
+    size_t   capacity() const { return m_capacity; }
+    // 現在保持しているサンプル数
+    size_t   size() const;
+    // これまでに書き込まれた総サンプル数 (= 最新サンプルの次の絶対インデックス)
+    uint64_t totalWritten() const { return m_total; }
+    // 保持している最古サンプルの絶対インデックス
+    uint64_t oldestAvailable() const { return m_total - size(); }
+
+    // 直近 count サンプル (保持数より多ければ切り詰める)
+    View last(size_t count) const;
+    // 絶対インデックス [begin, end) の区間 (保持範囲外は切り詰める)
+    View range(uint64_t begin, uint64_t end) const;
+
+    // 確保済みメモリ [bytes]
+    size_t memoryBytes() const { return m_data.capacity() * sizeof(float); }
+
+private:
+    std::vector<float> m_data;      // 本体 + ミラーで 2 * m_capacity
+    size_t             m_capacity = 0;
+    uint64_t           m_total    = 0;
+    uint64_t           m_clearedAt = 0; // clear() 時点の m_total
+};
+
+#endif // AUDIOHISTORYBUFFER_H
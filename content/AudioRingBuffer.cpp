@@ -0,0 +1,102 @@
+#include "AudioRingBuffer.h"
+
+#include <algorithm>
+
+namespace {
+size_t roundUpToPowerOfTwo(size_t value)
+{
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+} // namespace
+
+AudioRingBuffer::AudioRingBuffer(size_t minCapacity)
+    : m_data(roundUpToPowerOfTwo(std::max<size_t>(minCapacity, 1)), 0.0f)
+    , m_mask(m_data.size() - 1)
+{
+}
+
+size_t AudioRingBuffer::writeAvailable() const
+{
+    const uint64_t w = m_writePos.load(std::memory_order_relaxed);
+    const uint64_t r = m_readPos.load(std::memory_order_acquire);
+    return m_data.size() - static_cast<size_t>(w - r);
+}
+
+AudioRingBuffer::Region AudioRingBuffer::beginWrite(size_t count)
+{
+    Region region;
+    count = std::min(count, writeAvailable());
+    if (count == 0) {
+        return region;
+    }
+
+    const size_t start = static_cast<size_t>(m_writePos.load(std::memory_order_relaxed)) & m_mask;
+    region.first      = m_data.data() + start;
+    region.firstCount = std::min(count, m_data.size() - start);
+    if (region.firstCount < count) {
+        region.second      = m_data.data();
+        region.secondCount = count - region.firstCount;
+    }
+    return region;
+}
+
+void AudioRingBuffer::commitWrite(size_t count)
+{
+    // release: 書き込んだサンプルがコンシューマから見えるようにする
+    m_writePos.fetch_add(count, std::memory_order_release);
+}
+
+void AudioRingBuffer::noteDropped(size_t count)
+{
+    m_dropped.fetch_add(count, std::memory_order_relaxed);
+}
+
+bool AudioRingBuffer::requestConsumerWakeup()
+{
+    return !m_wakeupPending.exchange(true, std::memory_order_acq_rel);
+}
+
+size_t AudioRingBuffer::readAvailable() const
+{
+    const uint64_t w = m_writePos.load(std::memory_order_acquire);
+    const uint64_t r = m_readPos.load(std::memory_order_relaxed);
+    return static_cast<size_t>(w - r);
+}
+
+AudioRingBuffer::ConstRegion AudioRingBuffer::beginRead(size_t count) const
+{
+    ConstRegion region;
+    count = std::min(count, readAvailable());
+    if (count == 0) {
+        return region;
+    }
+
+    const size_t start = static_cast<size_t>(m_readPos.load(std::memory_order_relaxed)) & m_mask;
+    region.first      = m_data.data() + start;
+    region.firstCount = std::min(count, m_data.size() - start);
+    if (region.firstCount < count) {
+        region.second      = m_data.data();
+        region.secondCount = count - region.firstCount;
+    }
+    return region;
+}
+
+void AudioRingBuffer::commitRead(size_t count)
+{
+    // release: 読み終えた領域をプロデューサが再利用できるようにする
+    m_readPos.fetch_add(count, std::memory_order_release);
+}
+
+void AudioRingBuffer::consumerAwake()
+{
+    m_wakeupPending.store(false, std::memory_order_release);
+}
+
+void AudioRingBuffer::discardAll()
+{
+    commitRead(readAvailable());
+}
@@ -0,0 +1,86 @@
+#ifndef AUDIORINGBUFFER_H
+#define AUDIORINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * AudioRingBuffer:
+ *   - 単一プロデューサ/単一コンシューマ (SPSC) のロックフリーなリングバッファ
+ *   - プロデューサ: VoiceDetector (オーディオデバイスのコールバックスレッド)
+ *   - コンシューマ: VoiceRecognitionEngine (音声認識スレッド)
+ *   - 容量はコンストラクタで確保したまま変化しないので、書き込み/読み出しでヒープ確保は発生しない
+ *
+ * 使用例 (プロデューサ側):
+ *   AudioRingBuffer::Region r = ring.beginWrite(n);
+ *   convert(src, r.first, r.firstCount);
+ *   convert(src + r.firstCount, r.second, r.secondCount);
+ *   ring.commitWrite(r.totalCount());
+ *   if (ring.requestConsumerWakeup()) { emit audioAvailable(); }
+ *
+ * 使用例 (コンシューマ側):
+ *   ring.consumerAwake();
+ *   AudioRingBuffer::ConstRegion r = ring.beginRead(ring.readAvailable());
+ *   ...
+ *   ring.commitRead(r.totalCount());
+ */
+class AudioRingBuffer
+{
+public:
+    // 折り返しがあるため、連続領域は最大2つに分かれる
+    struct Region {
+        float  *first       = nullptr;
+        size_t  firstCount  = 0;
+        float  *second      = nullptr;
+        size_t  secondCount = 0;
+        size_t totalCount() const { return firstCount + secondCount; }
+    };
+    struct ConstRegion {
+        const float *first       = nullptr;
+        size_t       firstCount  = 0;
+        const float *second      = nullptr;
+        size_t       secondCount = 0;
+        size_t totalCount() const { return firstCount + secondCount; }
+    };
+
+    // minCapacity 以上の 2 のべき乗サイズで確保する
+    explicit AudioRingBuffer(size_t minCapacity);
+
+    size_t capacity() const { return m_data.size(); }
+
+    // ---- プロデューサ側 ----
+    size_t writeAvailable() const;
+    // 最大 count サンプル分の書き込み先を返す (空きが足りなければ切り詰める)
+    Region beginWrite(size_t count);
+    void   commitWrite(size_t count);
+    // 空きがなくて捨てたサンプル数を記録
+    void   noteDropped(size_t count);
+    // コンシューマへの通知が必要なら true (通知済みで未処理の間は false)
+    // → 1コールバックごとにシグナル(=キューイベントのヒープ確保)を発生させないため
+    bool   requestConsumerWakeup();
+
+    // ---- コンシューマ側 ----
+    size_t      readAvailable() const;
+    ConstRegion beginRead(size_t count) const;
+    void        commitRead(size_t count);
+    // 通知を受け取ったことを示す。読み出しの「前」に呼ぶこと
+    void        consumerAwake();
+    // 溜まっているデータをすべて捨てる
+    void        discardAll();
+
+    uint64_t droppedSamples() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<float> m_data;
+    size_t             m_mask = 0;
+
+    // false sharing を避けるため読み書き位置は別キャッシュラインに置く
+    alignas(64) std::atomic<uint64_t> m_writePos {0};
+    alignas(64) std::atomic<uint64_t> m_readPos  {0};
+    alignas(64) std::atomic<bool>     m_wakeupPending {false};
+    std::atomic<uint64_t>             m_dropped  {0};
+};
+
+#endif // AUDIORINGBUFFER_H
@@ -0,0 +1,292 @@
+#include "BatchTranscriber.h"
+#include "AudioHistoryBuffer.h"
+#include "ComputeBudgetArbiter.h"
+#include "PolyphaseResampler.h"
+#include "SampleConversion.h"
+#include "StreamingVad.h"
+#include "VoiceRecognitionEngine.h"
+#include "WhisperStatePool.h"
+#include "common.h"   // COMMON_SAMPLE_RATE
+#include "dr_wav.h"
+#include "whisper.h"
+
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace {
+struct FileResult {
+    QString name;
+    bool    ok = false;
+    QString error;
+    double  audioSeconds = 0.0;
+    double  wallSeconds  = 0.0;
+    int     segments     = 0;
+};
+
+// 絶対サンプル位置 → "hh:mm:ss.mmm"
+QString formatTime(uint64_t sample)
+{
+    const qint64 ms = qint64(sample * 1000 / COMMON_SAMPLE_RATE);
+    return QString("%1:%2:%3.%4")
+        .arg(ms / 3600000, 2, 10, QChar('0'))
+        .arg(ms / 60000 % 60, 2, 10, QChar('0'))
+        .arg(ms / 1000 % 60, 2, 10, QChar('0'))
+        .arg(ms % 1000, 3, 10, QChar('0'));
+}
+
+// 1ファイル分の処理 (プールのスレッドで、state を占有して実行される)
+//  録音時の VoiceRecognitionEngine と同じく、届いた音声を VAD にかけ、発話区間ごとに認識する
+FileResult transcribeFile(whisper_context *ctx, whisper_state *state, const VoiceRecParams &params,
+                          const QString &inputPath, const QString &outputPath)
+{
+    FileResult result;
+    result.name = QFileInfo(inputPath).fileName();
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!state) {
+        result.error = "failed to create whisper state";
+        return result;
+    }
+
+    drwav wav;
+    if (!drwav_init_file(&wav, QFile::encodeName(inputPath).constData(), nullptr)) {
+        result.error = "failed to open as WAV";
+        return result;
+    }
+    QFile outputFile(outputPath);
+    if (!outputFile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)) {
+        drwav_uninit(&wav);
+        result.error = "failed to open " + outputPath;
+        return result;
+    }
+    QTextStream output(&outputFile);
+
+    // 100ms ずつ読み、ネイティブのレート・チャンネル数から 16kHz モノラルへ
+    //  (リサンプラの入力領域に直接読み込み、その場でダウンミックスする)
+    const int    channels    = std::max<int>(wav.channels, 1);
+    const size_t chunkFrames = std::max<size_t>(wav.sampleRate / 10, 1);
+    PolyphaseResampler resampler;
+    resampler.reset(int(wav.sampleRate), COMMON_SAMPLE_RATE);
+    resampler.reserveInput(chunkFrames * size_t(channels));
+    std::vector<float> resampled;
+
+    // 保持するのは録音時と同じく推論長 + 余裕分だけ (ファイルの長さによらない)
+    const int64_t historyMs = int64_t(params.length_for_inference_ms) + std::max(params.history_margin_ms, 0);
+    AudioHistoryBuffer history(size_t(COMMON_SAMPLE_RATE * historyMs / 1000));
+
+    StreamingVad vad;
+    vad.reset(VoiceRecognitionEngine::vadParamsFor(params), 0);
+    std::vector<VadEvent> events;
+
+    const uint64_t padding = uint64_t(COMMON_SAMPLE_RATE) * std::max(params.segment_padding_ms, 0) / 1000;
+    uint64_t segmentBegin  = 0;
+    uint64_t consumedUntil = 0;
+
+    const auto transcribe = [&](uint64_t begin, uint64_t end) {
+        const AudioHistoryBuffer::View view = history.range(begin, end);
+        std::string text;
+        if (!view.empty()
+            && VoiceRecognitionEngine::transcribeSegment(ctx, state, params, view.data, view.size, text)) {
+            const QString line = QString::fromUtf8(text).trimmed();
+            if (!line.isEmpty()) {
+                output << '[' << formatTime(view.begin) << " --> " << formatTime(view.end()) << "] "
+                       << line << '\n';
+                ++result.segments;
+            }
+        }
+        consumedUntil = std::max(consumedUntil, end);
+    };
+
+    while (true) {
+        float *in = resampler.prepareInput(chunkFrames * size_t(channels));
+        const size_t frames = size_t(drwav_read_pcm_frames_f32(&wav, chunkFrames, in));
+        if (frames == 0) {
+            break;
+        }
+        SampleConversion::downmixToMono(in, in, frames, channels);
+        resampler.commitInput(frames);
+        resampled.resize(resampler.available());
+        resampler.read(resampled.data(), resampled.size());
+
+        const uint64_t before = history.totalWritten();
+        history.append(resampled.data(), resampled.size());
+        const AudioHistoryBuffer::View fresh = history.range(before, history.totalWritten());
+        events.clear();
+        vad.process(fresh.data, fresh.size, fresh.begin, events);
+
+        for (const VadEvent &event : events) {
+            if (event.type == VadEvent::SpeechStart) {
+                segmentBegin = std::max(event.sample > padding ? event.sample - padding : 0, consumedUntil);
+            } else {
+                transcribe(segmentBegin, std::min(event.sample + padding, history.totalWritten()));
+            }
+        }
+    }
+    // ファイルの終わりまで発話が続いていたらそこで区切る
+    if (vad.inSpeech()) {
+        transcribe(segmentBegin, history.totalWritten());
+    }
+    drwav_uninit(&wav);
+
+    result.ok           = true;
+    result.audioSeconds = double(history.totalWritten()) / COMMON_SAMPLE_RATE;
+    result.wallSeconds  = double(timer.elapsed()) / 1000.0;
+    return result;
+}
+} // namespace
+
+bool BatchTranscriber::isRequested(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--batch-transcribe") == 0
+            || std::strncmp(argv[i], "--batch-transcribe=", 19) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int BatchTranscriber::runFromCommandLine(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Transcribe every WAV file in a directory without the GUI.");
+    parser.addHelpOption();
+    const QCommandLineOption inputOption("batch-transcribe", "Directory of WAV files to transcribe.", "dir");
+    const QCommandLineOption outputOption("output", "Directory for the transcripts (default: input directory).", "dir");
+    const QCommandLineOption jobsOption("jobs", "Files processed in parallel (default: cores / 4).", "n");
+    const QCommandLineOption modelOption("model", "whisper model file (default: the bundled model).", "path");
+    const QCommandLineOption languageOption("language", "Spoken language code, or \"auto\".", "code");
+    parser.addOptions({inputOption, outputOption, jobsOption, modelOption, languageOption});
+    parser.process(arguments);
+
+    Options options;
+    options.inputDir  = parser.value(inputOption);
+    options.outputDir = parser.value(outputOption);
+    options.model     = parser.value(modelOption);
+    options.language  = parser.value(languageOption);
+    options.jobs      = parser.value(jobsOption).toInt();
+    return run(options);
+}
+
+int BatchTranscriber::run(const Options &options)
+{
+    const QDir inputDir(options.inputDir);
+    if (options.inputDir.isEmpty() || !inputDir.exists()) {
+        qWarning() << "[BatchTranscriber] input directory does not exist:" << options.inputDir;
+        return 1;
+    }
+    const QStringList files = inputDir.entryList({"*.wav"}, QDir::Files, QDir::Name);
+    if (files.isEmpty()) {
+        qWarning() << "[BatchTranscriber] no WAV files in" << inputDir.absolutePath();
+        return 1;
+    }
+    const QString outputPath = options.outputDir.isEmpty() ? inputDir.absolutePath() : options.outputDir;
+    if (!QDir().mkpath(outputPath)) {
+        qWarning() << "[BatchTranscriber] cannot create output directory:" << outputPath;
+        return 1;
+    }
+    const QDir outputDir(outputPath);
+
+    // 録音時と同じ設定。GUI も LLM も動いていないのでコアはすべて whisper に回す
+    VoiceRecParams params;
+    if (!options.model.isEmpty()) {
+        params.model = options.model.toStdString();
+    }
+    if (!options.language.isEmpty()) {
+        params.language = options.language.toStdString();
+    }
+    const int cores = ComputeBudgetArbiter::instance().coreBudget();
+    const int jobs  = options.jobs > 0 ? options.jobs : std::max(cores / 4, 1);
+    params.n_threads = std::max(cores / jobs, 1);
+
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+    whisper_context *ctx = whisper_init_from_file_with_params_no_state(params.model.c_str(), cparams);
+    if (!ctx) {
+        qWarning() << "[BatchTranscriber] failed to load whisper model" << QString::fromStdString(params.model);
+        return 1;
+    }
+
+    std::printf("Transcribing %lld files with %d parallel jobs x %d threads\n",
+                static_cast<long long>(files.size()), jobs, params.n_threads);
+    std::fflush(stdout);
+
+    std::vector<FileResult> results;
+    QElapsedTimer total;
+    total.start();
+    {
+        WhisperStatePool pool;
+        pool.reset(ctx, jobs);
+        for (const QString &file : files) {
+            const QString in  = inputDir.absoluteFilePath(file);
+            const QString out = outputDir.absoluteFilePath(QFileInfo(file).completeBaseName() + ".transcript.txt");
+            pool.submit([&results, params, in, out](whisper_context *c, whisper_state *s) {
+                auto result = std::make_shared<FileResult>(transcribeFile(c, s, params, in, out));
+                // 完了処理はファイル名順に1つずつ呼ばれる
+                return WhisperStatePool::Completion([&results, result] {
+                    if (result->ok) {
+                        std::printf("%s: %.1f s audio in %.1f s (%.2fx), %d segments\n",
+                                    result->name.toLocal8Bit().constData(), result->audioSeconds,
+                                    result->wallSeconds,
+                                    result->audioSeconds / std::max(result->wallSeconds, 1e-3),
+                                    result->segments);
+                    } else {
+                        std::printf("%s: FAILED (%s)\n", result->name.toLocal8Bit().constData(),
+                                    result->error.toLocal8Bit().constData());
+                    }
+                    std::fflush(stdout);
+                    results.push_back(*result);
+                });
+            });
+        }
+        pool.waitForDone();
+        pool.reset(nullptr, 0);
+    }
+    whisper_free(ctx);
+    const double wallSeconds = double(total.elapsed()) / 1000.0;
+
+    // summary.tsv: ファイルごとの処理時間と、全体のスループット
+    double audioSeconds = 0.0;
+    int failed = 0;
+    QFile summaryFile(outputDir.absoluteFilePath("summary.tsv"));
+    const bool writeSummary = summaryFile.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate);
+    QTextStream summary(&summaryFile);
+    if (writeSummary) {
+        summary << "file\tstatus\taudio_s\twall_s\taudio_s_per_wall_s\tsegments\n";
+    }
+    for (const FileResult &result : results) {
+        audioSeconds += result.audioSeconds;
+        failed += result.ok ? 0 : 1;
+        if (writeSummary) {
+            summary << result.name << '\t' << (result.ok ? "ok" : result.error) << '\t'
+                    << QString::number(result.audioSeconds, 'f', 2) << '\t'
+                    << QString::number(result.wallSeconds, 'f', 2) << '\t'
+                    << QString::number(result.audioSeconds / std::max(result.wallSeconds, 1e-3), 'f', 2) << '\t'
+                    << result.segments << '\n';
+        }
+    }
+    const double throughput = audioSeconds / std::max(wallSeconds, 1e-3);
+    if (writeSummary) {
+        summary << "TOTAL\t" << (failed ? QString("%1 failed").arg(failed) : QString("ok")) << '\t'
+                << QString::number(audioSeconds, 'f', 2) << '\t'
+                << QString::number(wallSeconds, 'f', 2) << '\t'
+                << QString::number(throughput, 'f', 2) << "\t\n";
+    } else {
+        qWarning() << "[BatchTranscriber] cannot write" << summaryFile.fileName();
+    }
+
+    std::printf("Done: %.1f s of audio in %.1f s wall time = %.2f audio-seconds per wall-second (%d failed)\n",
+                audioSeconds, wallSeconds, throughput, failed);
+    return failed > 0 ? 2 : 0;
+}
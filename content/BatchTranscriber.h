@@ -0,0 +1,40 @@
+#ifndef BATCHTRANSCRIBER_H
+#define BATCHTRANSCRIBER_H
+
+#include <QString>
+#include <QStringList>
+
+/*
+ * BatchTranscriber:
+ *   - GUI なしで、ディレクトリ内の WAV ファイルをまとめて文字起こしする (録音の夜間再処理など)
+ *   - 録音時と同じ VAD (StreamingVad) と whisper 設定 (VoiceRecParams の既定値) を使う
+ *   - ファイルは dr_wav で少しずつ読み、ネイティブのレート・チャンネル数から 16kHz モノラルに変換しながら
+ *     VAD にかける (ファイル全体をメモリに読み込まない。保持するのは推論長 + 余裕分の履歴だけ)
+ *   - 複数ファイルを WhisperStatePool で並列に処理する (モデルは1回だけロードし、ファイルごとに state を使う)
+ *   - 出力: ファイルごとに <名前>.transcript.txt ([開始 --> 終了] テキスト の行)、
+ *     全体の summary.tsv と標準出力に処理時間とスループット (音声秒 / 実時間秒)
+ *
+ * 使用例:
+ *   QllamaTalkApp --batch-transcribe recordings/ --output transcripts/ --jobs 4
+ */
+class BatchTranscriber
+{
+public:
+    struct Options {
+        QString inputDir;
+        QString outputDir;       // 空なら inputDir
+        QString model;           // 空なら VoiceRecParams の既定モデル
+        QString language;        // 空なら VoiceRecParams の既定言語
+        int     jobs = 0;        // 並列に処理するファイル数。0 ならコア数から決める
+    };
+
+    // コマンドライン引数に --batch-transcribe があるか (QCoreApplication を作る前に判定する)
+    static bool isRequested(int argc, char **argv);
+    // 引数を解釈して実行する。戻り値は終了コード
+    //  QCoreApplication を作ってから呼ぶこと
+    static int runFromCommandLine(const QStringList &arguments);
+
+    static int run(const Options &options);
+};
+
+#endif // BATCHTRANSCRIBER_H
@@ -0,0 +1,245 @@
+#include "ChatHistoryLog.h"
+
+#include <QDebug>
+#include <QtEndian>
+#include <algorithm>
+
+namespace {
+constexpr char    kLogMagic[]    = "QLTLOG01";
+constexpr char    kIndexMagic[]  = "QLTIDX01";
+constexpr qint64  kMagicSize     = 8;
+constexpr qint64  kSizeFieldSize = sizeof(quint32);
+constexpr qint64  kOffsetSize    = sizeof(quint64);
+constexpr int     kMaxRoleBytes  = 255;
+
+// 空なら magic を書き (読み込み専用なら失敗)、あれば確認する
+bool initFile(QFile &file, const char *magic)
+{
+    if (file.size() == 0) {
+        return file.seek(0) && file.write(magic, kMagicSize) == kMagicSize && file.flush();
+    }
+    char header[kMagicSize] = {};
+    return file.seek(0) && file.read(header, kMagicSize) == kMagicSize
+           && std::equal(header, header + kMagicSize, magic);
+}
+} // namespace
+
+ChatHistoryLog::~ChatHistoryLog()
+{
+    close();
+}
+
+const uchar *ChatHistoryLog::MappedFile::data(qint64 end)
+{
+    if (end > mapped) {
+        // 追記で伸びた分を含めて張り直す
+        unmap();
+        const qint64 size = file.size();
+        if (end > size) {
+            return nullptr;
+        }
+        map = file.map(0, size);
+        if (!map) {
+            return nullptr;
+        }
+        mapped = size;
+    }
+    return map;
+}
+
+void ChatHistoryLog::MappedFile::unmap()
+{
+    if (map) {
+        file.unmap(map);
+        map = nullptr;
+    }
+    mapped = 0;
+}
+
+bool ChatHistoryLog::open(const QString &path)
+{
+    close();
+    m_log.file.setFileName(path);
+    if (!m_log.file.open(QIODevice::ReadWrite) || !initFile(m_log.file, kLogMagic)) {
+        qWarning() << "[ChatHistoryLog] cannot open" << path << m_log.file.errorString();
+        close();
+        return false;
+    }
+    if (!openIndex(path + QStringLiteral(".idx"))) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ChatHistoryLog::openReadOnly(const QString &path)
+{
+    close();
+    m_log.file.setFileName(path);
+    m_index.file.setFileName(path + QStringLiteral(".idx"));
+    if (!m_log.file.open(QIODevice::ReadOnly) || !m_index.file.open(QIODevice::ReadOnly)
+        || !initFile(m_log.file, kLogMagic) || !initFile(m_index.file, kIndexMagic)) {
+        close();
+        return false;
+    }
+    m_count = int((m_index.file.size() - kMagicSize) / kOffsetSize);
+    return true;
+}
+
+void ChatHistoryLog::close()
+{
+    m_log.unmap();
+    m_index.unmap();
+    m_log.file.close();
+    m_index.file.close();
+    m_count = 0;
+}
+
+bool ChatHistoryLog::openIndex(const QString &path)
+{
+    m_index.file.setFileName(path);
+    if (!m_index.file.open(QIODevice::ReadWrite)) {
+        qWarning() << "[ChatHistoryLog] cannot open" << path << m_index.file.errorString();
+        return false;
+    }
+    if (!initFile(m_index.file, kIndexMagic)) {
+        // 壊れている → ログから作り直す
+        qWarning() << "[ChatHistoryLog] rebuilding index" << path;
+        if (!m_index.file.resize(0) || !initFile(m_index.file, kIndexMagic)) {
+            return false;
+        }
+    }
+
+    // 件数はファイルサイズから (書きかけのエントリは捨てる)
+    m_count = int((m_index.file.size() - kMagicSize) / kOffsetSize);
+
+    // 末尾のレコードがログに収まっていなければ (ログの書き込み中に落ちた) インデックスから外す
+    const qint64 logSize = m_log.file.size();
+    quint32 bodySize = 0;
+    while (m_count > 0) {
+        const quint64 offset = offsetAt(m_count - 1);
+        if (offset >= quint64(kMagicSize) && recordAt(offset, bodySize)
+            && offset + kSizeFieldSize + bodySize <= quint64(logSize)) {
+            break;
+        }
+        --m_count;
+    }
+    m_index.unmap();
+    if (!m_index.file.resize(kMagicSize + qint64(m_count) * kOffsetSize)) {
+        return false;
+    }
+
+    // インデックスに入る前に落ちたレコードを拾う (通常は0件。インデックスがなければ全件)
+    quint64 next = quint64(kMagicSize);
+    if (m_count > 0) {
+        const quint64 last = offsetAt(m_count - 1);
+        recordAt(last, bodySize);
+        next = last + kSizeFieldSize + bodySize;
+    }
+    int recovered = 0;
+    while (next + kSizeFieldSize <= quint64(logSize) && recordAt(next, bodySize)
+           && next + kSizeFieldSize + bodySize <= quint64(logSize)) {
+        if (!appendOffset(next)) {
+            return false;
+        }
+        next += kSizeFieldSize + bodySize;
+        ++recovered;
+    }
+    if (recovered > 0) {
+        qDebug() << "[ChatHistoryLog] indexed" << recovered << "records missing from the index";
+    }
+    // 書きかけのレコードは捨てる
+    if (next < quint64(logSize)) {
+        qWarning() << "[ChatHistoryLog] dropping a truncated record at" << next;
+        m_log.unmap();
+        if (!m_log.file.resize(qint64(next))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ChatHistoryLog::recordAt(quint64 offset, quint32 &bodySize)
+{
+    const uchar *base = m_log.data(qint64(offset + kSizeFieldSize));
+    if (!base) {
+        return false;
+    }
+    bodySize = qFromLittleEndian<quint32>(base + offset);
+    return bodySize >= 1;   // ロールの長さの1バイトは必ずある
+}
+
+quint64 ChatHistoryLog::offsetAt(int index)
+{
+    const qint64 end = kMagicSize + qint64(index + 1) * kOffsetSize;
+    const uchar *base = m_index.data(end);
+    return base ? qFromLittleEndian<quint64>(base + end - kOffsetSize) : 0;
+}
+
+bool ChatHistoryLog::appendOffset(quint64 offset)
+{
+    uchar entry[kOffsetSize];
+    qToLittleEndian<quint64>(offset, entry);
+    if (!m_index.file.seek(kMagicSize + qint64(m_count) * kOffsetSize)
+        || m_index.file.write(reinterpret_cast<const char *>(entry), kOffsetSize) != kOffsetSize) {
+        qWarning() << "[ChatHistoryLog] failed to write the index" << m_index.file.errorString();
+        return false;
+    }
+    ++m_count;
+    return true;
+}
+
+bool ChatHistoryLog::append(const QString &role, const QString &content)
+{
+    if (!isOpen()) {
+        return false;
+    }
+    const QByteArray roleUtf8    = role.toUtf8().left(kMaxRoleBytes);
+    const QByteArray contentUtf8 = content.toUtf8();
+
+    QByteArray record;
+    record.reserve(kSizeFieldSize + 1 + roleUtf8.size() + contentUtf8.size());
+    uchar header[kSizeFieldSize + 1];
+    qToLittleEndian<quint32>(quint32(1 + roleUtf8.size() + contentUtf8.size()), header);
+    header[kSizeFieldSize] = uchar(roleUtf8.size());
+    record.append(reinterpret_cast<const char *>(header), sizeof(header));
+    record.append(roleUtf8);
+    record.append(contentUtf8);
+
+    // ログ → インデックスの順に書く (逆だと、落ちたときにインデックスが存在しないレコードを指す)
+    const qint64 offset = m_log.file.size();
+    if (!m_log.file.seek(offset) || m_log.file.write(record) != record.size() || !m_log.file.flush()) {
+        qWarning() << "[ChatHistoryLog] failed to append" << m_log.file.errorString();
+        return false;
+    }
+    return appendOffset(quint64(offset)) && m_index.file.flush();
+}
+
+bool ChatHistoryLog::read(int index, QString &role, QString &content)
+{
+    if (index < 0 || index >= m_count) {
+        return false;
+    }
+    const quint64 offset = offsetAt(index);
+    quint32 bodySize = 0;
+    if (!recordAt(offset, bodySize)) {
+        return false;
+    }
+    const uchar *base = m_log.data(qint64(offset + kSizeFieldSize + bodySize));
+    if (!base) {
+        return false;
+    }
+    const char *body = reinterpret_cast<const char *>(base + offset + kSizeFieldSize);
+    const quint32 roleSize = quint8(body[0]);
+    if (1 + roleSize > bodySize) {
+        return false;
+    }
+    role    = QString::fromUtf8(body + 1, roleSize);
+    content = QString::fromUtf8(body + 1 + roleSize, bodySize - 1 - roleSize);
+    return true;
+}
+
+qint64 ChatHistoryLog::diskBytes() const
+{
+    return isOpen() ? m_log.file.size() + m_index.file.size() : 0;
+}
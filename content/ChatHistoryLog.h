@@ -0,0 +1,62 @@
+#ifndef CHATHISTORYLOG_H
+#define CHATHISTORYLOG_H
+
+#include <QFile>
+#include <QString>
+
+/*
+ * ChatHistoryLog:
+ *   - 会話の履歴を追記専用のファイルに保存する (アプリを終了しても残る)
+ *   - ログ: "QLTLOG01" の後ろにレコードを並べる
+ *       レコード = 本体の長さ (u32, little endian) + ロールの長さ (u8) + ロール (UTF-8) + 本文 (UTF-8)
+ *   - インデックス (<ログ>.idx): "QLTIDX01" の後ろに各レコードの開始位置 (u64, little endian)
+ *     → open() はファイルサイズから件数がわかるので、履歴の件数によらず一定時間で終わる
+ *   - どちらもメモリマップして読む (read() はレコード1件分だけを見る)
+ *   - 書き込み順はログ → インデックス。途中で落ちた場合は open() で
+ *     (壊れた末尾を切り詰め、インデックスにないレコードを拾い直して) 復旧する
+ */
+class ChatHistoryLog
+{
+public:
+    ChatHistoryLog() = default;
+    ~ChatHistoryLog();
+    ChatHistoryLog(const ChatHistoryLog &) = delete;
+    ChatHistoryLog &operator=(const ChatHistoryLog &) = delete;
+
+    // path のログを開く (なければ作る)
+    bool open(const QString &path);
+    // 読むだけで開く (復旧はしない)。別のスレッドで、open() 済みのログの既存レコードを読むためのもの
+    bool openReadOnly(const QString &path);
+    void close();
+    bool isOpen() const { return m_log.file.isOpen(); }
+
+    int count() const { return m_count; }
+    bool append(const QString &role, const QString &content);
+    // index 番目 (0 始まり) のレコードを読む
+    bool read(int index, QString &role, QString &content);
+
+    // ログとインデックスのファイルサイズ (診断用)
+    qint64 diskBytes() const;
+
+private:
+    // ファイルと、その先頭からのメモリマップ (足りなくなったら張り直す)
+    struct MappedFile {
+        QFile  file;
+        uchar *map    = nullptr;
+        qint64 mapped = 0;
+
+        const uchar *data(qint64 end);
+        void unmap();
+    };
+
+    bool openIndex(const QString &path);
+    bool recordAt(quint64 offset, quint32 &bodySize);
+    quint64 offsetAt(int index);
+    bool appendOffset(quint64 offset);
+
+    MappedFile m_log;
+    MappedFile m_index;
+    int        m_count = 0;   // インデックスにあるレコード数
+};
+
+#endif // CHATHISTORYLOG_H
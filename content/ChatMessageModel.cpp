@@ -1,32 +1,96 @@
-#include <stdlib.h>
+#include <QDebug>
+#include <QtConcurrent>
+#include <algorithm>
+#include <utility>
 #include "ChatMessageModel.h"
+#include "MessageBlockModel.h"
+
+namespace {
+// About one display frame at 60 Hz
+// 60Hz のディスプレイの約1フレーム
+constexpr int kDefaultUpdateIntervalMs = 16;
+// Committed rows kept resident: several screens of a ListView plus its cache buffer
+// ログに移した行のうちメモリに残す数: ListView の数画面分 + キャッシュバッファ
+constexpr int kResidentRows = 256;
+// Characters of context around the first match in a search snippet
+// 検索結果の抜粋で、最初に一致した位置の前後に表示する文字数
+constexpr qsizetype kSnippetBefore = 30;
+constexpr qsizetype kSnippetLength = 100;
+
+// Indexes the first rows of a history log (runs on a worker thread with its own mapping)
+// 履歴ログの先頭 rows 行をインデックスする (ワーカースレッドで、別にマップして読む)
+ChatSearchIndex buildSearchIndex(const QString &path, int rows) {
+    ChatSearchIndex index;
+    ChatHistoryLog log;
+    if (!log.openReadOnly(path)) {
+        return index;
+    }
+    rows = std::min(rows, log.count());
+    QString sender;
+    QString content;
+    for (int row = 0; row < rows && log.read(row, sender, content); ++row) {
+        index.addDocument(row, content);
+    }
+    return index;
+}
+
+// Text around the earliest occurrence of a query term
+// 検索語が最初に現れる位置の前後
+QString makeSnippet(const QString &content, const QStringList &terms) {
+    qsizetype match = -1;
+    for (const QString &term : terms) {
+        const qsizetype pos = content.indexOf(term, 0, Qt::CaseInsensitive);
+        if (pos >= 0 && (match < 0 || pos < match)) {
+            match = pos;
+        }
+    }
+    const qsizetype start = std::max<qsizetype>(0, match - kSnippetBefore);
+    QString snippet = content.mid(start, kSnippetLength).simplified();
+    if (start > 0) {
+        snippet.prepend(QChar(0x2026));
+    }
+    if (start + kSnippetLength < content.size()) {
+        snippet.append(QChar(0x2026));
+    }
+    return snippet;
+}
+}
 
 // Constructor: initializes an empty QAbstractListModel
 // コンストラクタ: 空のQAbstractListModelを初期化
 ChatMessageModel::ChatMessageModel(QObject *parent)
-    : QAbstractListModel(parent) {
+    : QAbstractListModel(parent)
+    , m_resident(kResidentRows)
+    , m_publishTimer(this) {
+    m_publishTimer.setSingleShot(true);
+    m_publishTimer.setInterval(kDefaultUpdateIntervalMs);
+    connect(&m_publishTimer, &QTimer::timeout, this, &ChatMessageModel::flushPendingUpdates);
+    connect(&m_indexBuilder, &QFutureWatcher<ChatSearchIndex>::finished, this, &ChatMessageModel::onSearchIndexBuilt);
 }
 
 // Returns how many rows the model contains (number of messages)
 // モデルが保持する行数（メッセージ数）を返す
 int ChatMessageModel::rowCount(const QModelIndex &) const {
-    return static_cast<int>(m_messages.size());
+    return m_committedRows + static_cast<int>(m_messages.size());
 }
 
 // Retrieves data for display based on the requested role
 // 指定されたロールに応じて表示用データを返す
 QVariant ChatMessageModel::data(const QModelIndex &index, int role) const {
-    const int row = index.row();
-    if (row < 0 || row >= static_cast<int>(m_messages.size())) {
+    const Message *message = messageAt(index.row());
+    if (!message) {
         return QVariant();
     }
 
-    const auto &data = m_messages.at(row);
+    // QString fits in QVariant's inline storage and is implicitly shared: no allocation
+    // QString は QVariant の内部に収まり、暗黙の共有なので確保は起きない
     switch (role) {
     case Sender:
-        return QVariant::fromValue(QString(data.role));
+        return m_roles.at(message->roleId);
     case MessageContent:
-        return QVariant::fromValue(QString(data.content));
+        return message->content;
+    case Blocks:
+        return QVariant::fromValue(static_cast<QObject*>(message->blocks));
     }
 
     return QVariant();
@@ -39,6 +103,7 @@ QHash<int, QByteArray> ChatMessageModel::roleNames() const {
     if (s_roleNames.isEmpty()) {
         s_roleNames.insert(Sender,         "sender");
         s_roleNames.insert(MessageContent, "messageContent");
+        s_roleNames.insert(Blocks,         "blocks");
     }
     return s_roleNames;
 }
@@ -46,11 +111,13 @@ QHash<int, QByteArray> ChatMessageModel::roleNames() const {
 // Appends multiple llama_chat_message objects in one batch
 // 複数のllama_chat_messageを一度に追加
 void ChatMessageModel::append(const std::vector<llama_chat_message> &messages) {
+    flushPendingUpdates();
     if (!messages.empty()) {
-        beginInsertRows(QModelIndex(),
-                        static_cast<int>(m_messages.size()),
-                        static_cast<int>(m_messages.size() + messages.size() - 1));
-        m_messages.insert(m_messages.end(), messages.begin(), messages.end());
+        const int first = rowCount(QModelIndex());
+        beginInsertRows(QModelIndex(), first, first + static_cast<int>(messages.size()) - 1);
+        for (const auto &msg : messages) {
+            m_messages.push_back(makeMessage(QString::fromUtf8(msg.role), QString::fromUtf8(msg.content)));
+        }
         endInsertRows();
     }
 }
@@ -58,44 +125,377 @@ void ChatMessageModel::append(const std::vector<llama_chat_message> &messages) {
 // Appends a single message, returns the new row index
 // 単一のメッセージを追加し、新しい行インデックスを返す
 int ChatMessageModel::appendSingle(const QString &sender, const QString &content) {
-    llama_chat_message msg;
-
-    // Duplicate strings for consistent memory handling
-    // 一貫したメモリ管理のため文字列を複製
-    msg.role    = strdup(sender.toUtf8().constData());
-    msg.content = strdup(content.toUtf8().constData());
+    // Earlier messages are complete before a new row appears
+    // 新しい行より前に、それまでのメッセージを確定させる
+    flushPendingUpdates();
 
-    beginInsertRows(QModelIndex(),
-                    static_cast<int>(m_messages.size()),
-                    static_cast<int>(m_messages.size()));
-    m_messages.push_back(msg);
+    const int row = rowCount(QModelIndex());
+    beginInsertRows(QModelIndex(), row, row);
+    m_messages.push_back(makeMessage(sender, content));
     endInsertRows();
 
-    return static_cast<int>(m_messages.size()) - 1;
+    return row;
 }
 
-// Updates the content of an existing message at a specific row
+// Updates the content of an existing message at a specific row.
+// Only the latest text is kept; it is published when the timer fires, so the
+// delegate re-parses the message at most once per interval instead of per token.
 // 指定行の既存メッセージ内容を更新
+// 最新のテキストだけを保持し、タイマーで反映する (デリゲートの再解析をトークンごとではなく
+// 一定間隔に1回にする)
 void ChatMessageModel::updateMessageContent(int row, const QString &newContent) {
-    if (row < 0 || row >= static_cast<int>(m_messages.size())) {
-        return; // Out of range
+    if (!tailMessage(row)) {
+        return; // Out of range or already committed
+    }
+
+    if (row < m_searchIndex.documentCount()) {
+        // The indexed text is about to change (e.g. a refined transcript)
+        // インデックスした内容が変わる (清書された音声認識結果など)
+        unindexFrom(row);
+    }
+
+    ++m_updateStats.updates;
+    if (m_publishTimer.interval() <= 0) {
+        publishContent(row, newContent);
+        return;
+    }
+    m_pendingContent.insert(row, newContent);
+    if (!m_publishTimer.isActive()) {
+        m_publishTimer.start();
+    }
+}
+
+// Publishes every pending update now
+// 保留中の更新をすぐに反映
+void ChatMessageModel::flushPendingUpdates() {
+    m_publishTimer.stop();
+    const QHash<int, QString> pending = std::exchange(m_pendingContent, {});
+    for (auto it = pending.cbegin(); it != pending.cend(); ++it) {
+        publishContent(it.key(), it.value());
+    }
+}
+
+// Streaming replies grow by appending: only the new tail is copied into the
+// message's own buffer (amortized growth). A trailing U+FFFD (UTF-8 character cut
+// in the middle) is replaced by the real character in the next update.
+// If the buffer is shared (a view still holds the old value) appending would copy
+// it anyway, so the new string is shared instead.
+// 生成中の応答は追記で伸びる: 新しい末尾だけをメッセージのバッファにコピーする (容量は倍々に伸びる)
+// 末尾の置換文字 (UTF-8 の途中で切れた文字) は次の更新で正しい文字に置き換わる
+// バッファが共有中 (ビューが古い値を保持) なら追記しても複製になるので、新しい文字列を共有する
+void ChatMessageModel::publishContent(int row, const QString &content) {
+    QElapsedTimer timer;
+    timer.start();
+
+    Message &message = *tailMessage(row);
+    qsizetype keep = message.content.size();
+    while (keep > 0 && message.content.at(keep - 1) == QChar::ReplacementCharacter) {
+        --keep;
+    }
+    const bool continuation = content.size() >= keep
+                              && QStringView(content).first(keep) == QStringView(message.content).first(keep);
+    if (continuation && message.content.isDetached()) {
+        message.content.truncate(keep);
+        message.content.append(QStringView(content).sliced(keep));
+    } else {
+        message.content = content;
     }
 
-    free((void*)m_messages[row].content);
-    m_messages[row].content = strdup(newContent.toUtf8().constData());
+    // Only the trailing Markdown block is re-parsed by the delegate
+    // デリゲートが解析し直すのは末尾の Markdown ブロックだけ
+    message.blocks->setText(message.content, continuation);
 
     QModelIndex idx = index(row, 0);
     emit dataChanged(idx, idx, {MessageContent});
+
+    ++m_updateStats.publishes;
+    m_updateStats.publishNs += timer.nsecsElapsed();
 }
 
-// Destructor: cleans up allocated memory for each stored llama_chat_message
-// デストラクタ: 格納された各llama_chat_messageのメモリを解放
-ChatMessageModel::~ChatMessageModel() {
-    // Free 'role' and 'content' for all messages
-    // 全メッセージのroleとcontentを解放
-    for (auto & msg : m_messages) {
-        free((void*)msg.role);
-        free((void*)msg.content);
+int ChatMessageModel::updateInterval() const {
+    return m_publishTimer.interval();
+}
+
+void ChatMessageModel::setUpdateInterval(int intervalMs) {
+    intervalMs = std::max(intervalMs, 0);
+    if (m_publishTimer.interval() == intervalMs) {
+        return;
+    }
+    flushPendingUpdates();
+    m_publishTimer.setInterval(intervalMs);
+    emit updateIntervalChanged();
+}
+
+ChatMessageModel::Message ChatMessageModel::makeMessage(const QString &sender, const QString &content) {
+    Message message {content, new MessageBlockModel(this), internRole(sender)};
+    message.blocks->setText(message.content, false);
+    return message;
+}
+
+// Roles are a handful of strings; each message stores only the index
+// ロールは数種類なので、各メッセージは番号だけを持つ
+quint16 ChatMessageModel::internRole(const QString &sender) {
+    const qsizetype index = m_roles.indexOf(sender);
+    if (index >= 0) {
+        return static_cast<quint16>(index);
+    }
+    m_roles << sender;
+    return static_cast<quint16>(m_roles.size() - 1);
+}
+
+ChatMessageModel::StorageBytes ChatMessageModel::storageBytes() const {
+    StorageBytes bytes;
+    bytes.messages = static_cast<qsizetype>(m_messages.capacity() * sizeof(Message));
+    const auto add = [&bytes](const Message &message) {
+        bytes.messages += message.content.capacity() * static_cast<qsizetype>(sizeof(QChar));
+        bytes.blocks   += message.blocks->storageBytes();
+    };
+    for (const Message &message : m_messages) {
+        add(message);
+    }
+    const QList<int> resident = m_resident.keys();
+    for (int row : resident) {
+        bytes.messages += static_cast<qsizetype>(sizeof(CachedMessage));
+        add(m_resident.object(row)->message);
+    }
+    for (const QString &role : m_roles) {
+        bytes.messages += role.capacity() * static_cast<qsizetype>(sizeof(QChar));
+    }
+    return bytes;
+}
+
+ChatMessageModel::UpdateStats ChatMessageModel::takeUpdateStats() {
+    return std::exchange(m_updateStats, {});
+}
+
+// Removes messages from a specific row to the end (e.g. a reply being regenerated)
+// 指定行以降のメッセージを削除 (再生成する応答など)
+void ChatMessageModel::removeFrom(int row) {
+    if (!tailMessage(row)) {
+        if (row >= 0 && row < m_committedRows) {
+            qWarning() << "[ChatMessageModel] cannot remove committed row" << row;
+        }
+        return; // Out of range or already committed
+    }
+
+    unindexFrom(row);
+
+    // Pending updates for removed rows are dropped
+    // 削除する行の保留中の更新は捨てる
+    for (auto it = m_pendingContent.begin(); it != m_pendingContent.end();) {
+        it = it.key() >= row ? m_pendingContent.erase(it) : std::next(it);
+    }
+
+    beginRemoveRows(QModelIndex(), row, rowCount(QModelIndex()) - 1);
+    // Delegates may still hold the block models until they are destroyed
+    // デリゲートが破棄されるまでブロックのモデルを参照しているかもしれないので後で削除
+    const auto first = m_messages.begin() + (row - m_committedRows);
+    for (auto it = first; it != m_messages.end(); ++it) {
+        it->blocks->deleteLater();
+    }
+    m_messages.erase(first, m_messages.end());
+    endRemoveRows();
+}
+
+// Replaces the model's contents with the history in the log at path.
+// Only the index is read here; rows are paged in when a view asks for them.
+// path の履歴ログでモデルの内容を置き換える
+// ここで読むのはインデックスだけで、各行はビューが要求したときに読み込む
+bool ChatMessageModel::openHistory(const QString &path) {
+    flushPendingUpdates();
+    beginResetModel();
+    for (const Message &message : m_messages) {
+        message.blocks->deleteLater();
     }
     m_messages.clear();
+    m_resident.clear();
+    const bool opened = m_log.open(path);
+    m_committedRows = m_log.count();
+    endResetModel();
+
+    // The search index of the history is built in the background so that opening
+    // stays constant-time; rows committed meanwhile are added when it is done
+    // 起動を待たせないよう、履歴の検索インデックスはバックグラウンドで作る
+    // (その間に保存された行は完成後に追加する)
+    m_searchIndex.clear();
+    m_finishedRows  = m_committedRows;
+    m_indexBuilding = opened && m_committedRows > 0;
+    if (m_indexBuilding) {
+        m_indexBuilder.setFuture(QtConcurrent::run(buildSearchIndex, path, m_committedRows));
+    }
+
+    if (opened) {
+        qDebug() << "[ChatMessageModel] history:" << m_committedRows << "messages,"
+                 << m_log.diskBytes() << "bytes on disk";
+    }
+    return opened;
+}
+
+// Moves the uncommitted rows to the history log. Row numbers do not change, so
+// views are not notified; the rows stay resident until they are evicted.
+// 未保存の行を履歴ログに移す。行番号は変わらないのでビューには通知しない
+// (追い出されるまではメモリに残る)
+void ChatMessageModel::commitHistory() {
+    if (!m_log.isOpen() || m_messages.empty()) {
+        return;
+    }
+    flushPendingUpdates();
+
+    std::size_t committed = 0;
+    for (; committed < m_messages.size(); ++committed) {
+        Message &message = m_messages[committed];
+        if (!m_log.append(m_roles.at(message.roleId), message.content)) {
+            // Keep the rest in memory (they are retried on the next commit)
+            // 残りはメモリに置いたまま (次の保存で再試行する)
+            break;
+        }
+        const int committedRow = m_committedRows++;
+        m_resident.insert(committedRow, new CachedMessage {std::move(message), this, committedRow});
+    }
+    m_messages.erase(m_messages.begin(), m_messages.begin() + committed);
+}
+
+int ChatMessageModel::committedRows() const {
+    return m_committedRows;
+}
+
+void ChatMessageModel::indexFinishedRows() {
+    flushPendingUpdates();
+    m_finishedRows = rowCount(QModelIndex());
+    updateSearchIndex();
+}
+
+QVariantList ChatMessageModel::search(const QString &query, int limit) const {
+    QVariantList results;
+    const std::vector<ChatSearchIndex::Hit> hits = m_searchIndex.search(query, limit);
+    if (hits.empty()) {
+        return results;
+    }
+    // Snippets look for the query's words, then for its terms (e.g. Japanese bigrams)
+    // 抜粋は検索語の単語で探し、なければ分かち書きした語 (日本語の bigram など) で探す
+    const QStringList words = query.split(QLatin1Char(' '), Qt::SkipEmptyParts)
+                              + ChatSearchIndex::tokenize(query);
+    for (const ChatSearchIndex::Hit &hit : hits) {
+        const Message *message = messageAt(hit.row);
+        if (!message) {
+            continue;
+        }
+        results << QVariantMap {
+            {QStringLiteral("row"),     hit.row},
+            {QStringLiteral("sender"),  m_roles.at(message->roleId)},
+            {QStringLiteral("snippet"), makeSnippet(message->content, words)},
+            {QStringLiteral("score"),   hit.score},
+        };
+    }
+    return results;
+}
+
+// Indexes the finished rows that are not indexed yet
+// 確定した行のうち、まだインデックスしていない行を追加
+void ChatMessageModel::updateSearchIndex() {
+    if (m_indexBuilding) {
+        return; // Done when the history's index is ready
+    }
+    const int rows = std::min(m_finishedRows, rowCount(QModelIndex()));
+    for (int row = m_searchIndex.documentCount(); row < rows; ++row) {
+        const Message *message = messageAt(row);
+        if (!message) {
+            break;
+        }
+        m_searchIndex.addDocument(row, message->content);
+    }
+}
+
+// Takes row and the rows after it out of the index (call before their text changes)
+// row 以降をインデックスから外す (内容が変わる前に呼ぶ)
+void ChatMessageModel::unindexFrom(int row) {
+    m_finishedRows = std::min(m_finishedRows, row);
+    while (m_searchIndex.documentCount() > row) {
+        const Message *message = messageAt(m_searchIndex.documentCount() - 1);
+        m_searchIndex.removeLastDocument(message ? QStringView(message->content) : QStringView());
+    }
+}
+
+void ChatMessageModel::onSearchIndexBuilt() {
+    if (!m_indexBuilding || m_indexBuilder.future().resultCount() == 0) {
+        return;
+    }
+    m_searchIndex   = m_indexBuilder.result();
+    m_indexBuilding = false;
+    updateSearchIndex();
+    qDebug() << "[ChatMessageModel] search index ready:" << m_searchIndex.documentCount() << "messages";
+}
+
+// Returns the message at row, paging it in from the history log if needed
+// row のメッセージを返す (必要なら履歴ログから読み込む)
+const ChatMessageModel::Message *ChatMessageModel::messageAt(int row) const {
+    if (row < 0 || row >= rowCount(QModelIndex())) {
+        return nullptr;
+    }
+    if (row >= m_committedRows) {
+        return &m_messages[row - m_committedRows];
+    }
+    if (const CachedMessage *cached = m_resident.object(row)) {
+        return &cached->message;
+    }
+
+    QString sender;
+    QString content;
+    if (!m_log.read(row, sender, content)) {
+        qWarning() << "[ChatMessageModel] failed to read history row" << row;
+        return nullptr;
+    }
+    // Paging in does not change what the model shows
+    // 読み込みはモデルの見た目を変えない
+    auto *self = const_cast<ChatMessageModel *>(this);
+    auto *cached = new CachedMessage {self->makeMessage(sender, content), self, row};
+    m_resident.insert(row, cached);
+    return &cached->message;
+}
+
+// Returns the uncommitted message at row, or nullptr
+// row の未保存のメッセージを返す (なければ nullptr)
+ChatMessageModel::Message *ChatMessageModel::tailMessage(int row) {
+    if (row < m_committedRows || row >= rowCount(QModelIndex())) {
+        return nullptr;
+    }
+    return &m_messages[row - m_committedRows];
+}
+
+// Evicted rows: a delegate on screen may still be bound to the block model
+// 追い出した行: 表示中のデリゲートがまだブロックのモデルに結び付いているかもしれない
+ChatMessageModel::CachedMessage::~CachedMessage() {
+    owner->retireBlocks(row, message.blocks);
+}
+
+// Eviction happens inside messageAt() (often while a view is reading data()), so
+// views are notified later, from the event loop
+// 追い出しは messageAt() の中 (ビューが data() を読んでいる最中のことも多い) で起きるので、
+// ビューへの通知はイベントループに戻ってから行う
+void ChatMessageModel::retireBlocks(int row, MessageBlockModel *blocks) {
+    if (m_retiredBlocks.empty()) {
+        QMetaObject::invokeMethod(this, &ChatMessageModel::releaseRetiredBlocks, Qt::QueuedConnection);
+    }
+    m_retiredBlocks.push_back({row, blocks});
+}
+
+// Views rebind to a freshly paged-in block model, then the old one is deleted
+// ビューに新しく読み込んだブロックのモデルへ結び直させてから、古いモデルを削除する
+void ChatMessageModel::releaseRetiredBlocks() {
+    const std::vector<RetiredBlocks> retired = std::exchange(m_retiredBlocks, {});
+    for (const RetiredBlocks &entry : retired) {
+        if (entry.row < rowCount(QModelIndex())) {
+            const QModelIndex changed = index(entry.row);
+            emit dataChanged(changed, changed, {Blocks});
+        }
+        entry.blocks->deleteLater();
+    }
+}
+
+// Destructor: block models are children of this model and are deleted with it
+// デストラクタ: ブロックのモデルはこのモデルの子なので一緒に削除される
+ChatMessageModel::~ChatMessageModel() {
+    // Resident rows retire their block models into m_retiredBlocks, which must still exist
+    // 残っている行はブロックのモデルを m_retiredBlocks に移すので、メンバーが残っているうちに空にする
+    m_resident.clear();
 }
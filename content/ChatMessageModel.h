@@ -3,12 +3,31 @@
 
 #include <QObject>
 #include <QAbstractListModel>
+#include <QCache>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QStringList>
+#include <QTimer>
+#include <QVariantList>
+#include "ChatHistoryLog.h"
+#include "ChatSearchIndex.h"
 #include "llama.h"
 
+class MessageBlockModel;
+
 // This model holds and manages chat messages for display in a ListView or similar view.
-// It wraps llama_chat_message structures into a Qt-friendly model.
+// Storage is laid out for streaming chat: roles are interned, and content is kept as
+// UTF-16 that grows in place while a reply streams. data() hands out implicitly shared
+// strings, so scrolling does not allocate or convert.
+// With a history log open (openHistory), finished turns are moved to the log by
+// commitHistory() and only a window of recently viewed rows stays resident; older
+// rows are paged in from the log when a view asks for them.
+// Finished messages are added to a full-text index (see ChatSearchIndex) for search().
 class ChatMessageModel : public QAbstractListModel {
     Q_OBJECT
+    // Minimum interval between published content updates in ms (0 = publish every update).
+    Q_PROPERTY(int updateInterval READ updateInterval WRITE setUpdateInterval NOTIFY updateIntervalChanged FINAL)
 
 public:
     // Constructor: creates an empty chat message model.
@@ -20,7 +39,7 @@ public:
     QVariant data(const QModelIndex &index, int role) const override;
     QHash<int, QByteArray> roleNames() const override;
 
-    // Appends multiple llama_chat_message objects at once.
+    // Appends multiple llama_chat_message objects at once (the strings are copied).
     void append(const std::vector<llama_chat_message> &messages);
 
     // Appends a single message with a sender and content.
@@ -28,17 +47,121 @@ public:
     int appendSingle(const QString &sender, const QString &content);
 
     // Updates the content of a message at a given row index.
+    // Streaming updates are coalesced: the latest content is published
+    // (dataChanged) at most once per updateInterval.
     void updateMessageContent(int row, const QString &newContent);
 
+    // Publishes coalesced updates right away (e.g. when a reply is complete).
+    void flushPendingUpdates();
+
+    int updateInterval() const;
+    void setUpdateInterval(int intervalMs);
+
+    // GUI-thread cost of content updates since the last call.
+    struct UpdateStats {
+        int    updates   = 0;   // updateMessageContent() calls (≈ generated tokens)
+        int    publishes = 0;   // dataChanged emissions
+        qint64 publishNs = 0;   // time spent publishing, including the delegates' re-layout
+    };
+    UpdateStats takeUpdateStats();
+
+    // Approximate heap bytes held for the messages (diagnostics / benchmarks).
+    struct StorageBytes {
+        qsizetype messages = 0;   // per-message records and content buffers
+        qsizetype blocks   = 0;   // Markdown block models (see MessageBlockModel)
+    };
+    StorageBytes storageBytes() const;
+
+    // Removes the message at the given row and every message after it.
+    // Only rows not yet committed to the history log can be removed.
+    void removeFrom(int row);
+
+    // Opens (or creates) the on-disk history and shows its messages in place of the
+    // current ones. Only the log's index is read, so this takes constant time.
+    bool openHistory(const QString &path);
+
+    // Appends the rows not yet committed to the history log. They stay visible but
+    // can no longer be updated or removed, and are paged in from the log when evicted.
+    void commitHistory();
+
+    // Rows stored in the history log.
+    int committedRows() const;
+
+    // Adds every row to the search index (call when a reply is complete).
+    // A row that is updated or removed afterwards is taken out of the index again.
+    void indexFinishedRows();
+
+    // Full-text search over the indexed rows, best match first.
+    // Each hit is a map: row, sender, snippet, score.
+    // Returns nothing while the index of a just-opened history is still being built.
+    Q_INVOKABLE QVariantList search(const QString &query, int limit = 20) const;
+
+signals:
+    void updateIntervalChanged();
+
 private:
     // Custom roles to map sender and content into QML (or other view).
     enum Role {
         Sender = Qt::UserRole + 1,
         MessageContent,
+        Blocks,         // MessageBlockModel: the content split into Markdown blocks
+    };
+
+    struct Message {
+        QString            content;      // UTF-16, grows in place while streaming
+        MessageBlockModel *blocks;       // Markdown blocks (owned by this model)
+        quint16            roleId;       // Index into m_roles
+    };
+
+    // A committed row that is resident. On eviction its block model is retired:
+    // views still bound to it are told to fetch the row again before it is deleted.
+    struct CachedMessage {
+        Message           message;
+        ChatMessageModel *owner;
+        int               row;
+        ~CachedMessage();
     };
 
-    // Stores all messages in a vector.
-    std::vector<llama_chat_message> m_messages;
+    // A block model of an evicted row, deleted once views have rebound to a new one.
+    struct RetiredBlocks {
+        int                row;
+        MessageBlockModel *blocks;
+    };
+
+    const Message *messageAt(int row) const;
+    Message *tailMessage(int row);
+    void updateSearchIndex();
+    void unindexFrom(int row);
+    void onSearchIndexBuilt();
+    void retireBlocks(int row, MessageBlockModel *blocks);
+    void releaseRetiredBlocks();
+    void publishContent(int row, const QString &content);
+    Message makeMessage(const QString &sender, const QString &content);
+    quint16 internRole(const QString &sender);
+
+    // Rows [0, m_committedRows) are in the history log, the rest in m_messages.
+    mutable ChatHistoryLog m_log;      // Reading remaps the file as it grows
+    int                    m_committedRows = 0;
+    std::vector<RetiredBlocks> m_retiredBlocks;
+    // Recently used committed rows, by row (least recently used is evicted first).
+    mutable QCache<int, CachedMessage> m_resident;
+
+    // Rows [0, m_searchIndex.documentCount()) are indexed; rows below m_finishedRows
+    // are due to be. The index of an opened history is built on a worker thread.
+    ChatSearchIndex                 m_searchIndex;
+    QFutureWatcher<ChatSearchIndex> m_indexBuilder;
+    bool                            m_indexBuilding = false;
+    int                             m_finishedRows  = 0;
+
+    // Stores the messages not yet committed to the history log.
+    std::vector<Message> m_messages;
+    // Interned role names ("user", "assistant", ...), shared by every message.
+    QStringList m_roles;
+
+    // Content updates not yet published, by row.
+    QHash<int, QString> m_pendingContent;
+    QTimer              m_publishTimer;
+    UpdateStats         m_updateStats;
 };
 
 #endif // CHATMESSAGEMODEL_H
@@ -0,0 +1,166 @@
+#include "ChatSearchIndex.h"
+
+#include <QChar>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// BM25 のパラメータ (一般的な値)
+constexpr float kK1 = 1.2f;
+constexpr float kB  = 0.75f;
+// これより長い語は切り詰める (URL や base64 などでインデックスが膨らまないように)
+constexpr qsizetype kMaxTermLength = 64;
+
+bool isCjk(char32_t c)
+{
+    switch (QChar::script(c)) {
+    case QChar::Script_Han:
+    case QChar::Script_Hiragana:
+    case QChar::Script_Katakana:
+    case QChar::Script_Hangul:
+        return true;
+    default:
+        // 長音符 (ー) や繰り返し記号 (々) は Common / Inherited だが語の一部
+        return c == 0x30FC || c == 0x3005;
+    }
+}
+
+// 語ごとの出現回数
+QHash<QString, quint32> termCounts(QStringView text, quint32 &length)
+{
+    QHash<QString, quint32> counts;
+    const QStringList terms = ChatSearchIndex::tokenize(text);
+    for (const QString &term : terms) {
+        ++counts[term];
+    }
+    length = static_cast<quint32>(terms.size());
+    return counts;
+}
+} // namespace
+
+QStringList ChatSearchIndex::tokenize(QStringView text)
+{
+    // 全角英数字・半角カナを揃え、大文字小文字を区別しない
+    const QList<uint> chars = text.toString().normalized(QString::NormalizationForm_KC).toCaseFolded().toUcs4();
+
+    QStringList terms;
+    QString word;
+    QList<char32_t> cjkRun;
+    const auto flushWord = [&] {
+        if (!word.isEmpty()) {
+            terms << word.left(kMaxTermLength);
+            word.clear();
+        }
+    };
+    const auto flushCjk = [&] {
+        if (cjkRun.size() == 1) {
+            terms << QString::fromUcs4(cjkRun.constData(), 1);
+        }
+        for (qsizetype i = 0; i + 1 < cjkRun.size(); ++i) {
+            terms << QString::fromUcs4(cjkRun.constData() + i, 2);
+        }
+        cjkRun.clear();
+    };
+
+    for (uint c : chars) {
+        const char32_t ch = c;
+        if (isCjk(ch)) {
+            flushWord();
+            cjkRun << ch;
+        } else if (QChar::isLetterOrNumber(ch) || (ch == '_' && !word.isEmpty())) {
+            flushCjk();
+            word += QString::fromUcs4(&ch, 1);
+        } else {
+            flushWord();
+            flushCjk();
+        }
+    }
+    flushWord();
+    flushCjk();
+    return terms;
+}
+
+void ChatSearchIndex::addDocument(int row, QStringView text)
+{
+    Q_ASSERT(row == documentCount());
+    quint32 length = 0;
+    const QHash<QString, quint32> counts = termCounts(text, length);
+    for (auto it = counts.cbegin(); it != counts.cend(); ++it) {
+        m_postings[it.key()].push_back({row, it.value()});
+    }
+    m_docLengths.push_back(length);
+    m_totalLength += length;
+}
+
+void ChatSearchIndex::removeLastDocument(QStringView text)
+{
+    if (m_docLengths.empty()) {
+        return;
+    }
+    const int row = documentCount() - 1;
+    quint32 length = 0;
+    const QHash<QString, quint32> counts = termCounts(text, length);
+    for (auto it = counts.cbegin(); it != counts.cend(); ++it) {
+        const auto postings = m_postings.find(it.key());
+        if (postings == m_postings.end() || postings->empty() || postings->back().row != row) {
+            continue;
+        }
+        postings->pop_back();
+        if (postings->empty()) {
+            m_postings.erase(postings);
+        }
+    }
+    m_totalLength -= m_docLengths.back();
+    m_docLengths.pop_back();
+}
+
+void ChatSearchIndex::clear()
+{
+    m_postings.clear();
+    m_docLengths.clear();
+    m_totalLength = 0;
+}
+
+std::vector<ChatSearchIndex::Hit> ChatSearchIndex::search(QStringView query, int limit) const
+{
+    std::vector<Hit> hits;
+    const int documents = documentCount();
+    if (documents == 0 || limit <= 0) {
+        return hits;
+    }
+
+    QStringList terms = tokenize(query);
+    terms.removeDuplicates();
+    const float averageLength = std::max(1.0f, float(double(m_totalLength) / documents));
+
+    // 検索語を含む文書だけを数える (全文書は走査しない)
+    QHash<int, float> scores;
+    for (const QString &term : std::as_const(terms)) {
+        const auto postings = m_postings.constFind(term);
+        if (postings == m_postings.cend()) {
+            continue;
+        }
+        const float df  = float(postings->size());
+        const float idf = std::log(1.0f + (float(documents) - df + 0.5f) / (df + 0.5f));
+        for (const Posting &posting : *postings) {
+            if (posting.row >= documents) {
+                break;   // 取り除いた文書 (行番号の昇順なので以降も同じ)
+            }
+            const float tf   = float(posting.termFrequency);
+            const float norm = kK1 * (1.0f - kB + kB * float(m_docLengths[posting.row]) / averageLength);
+            scores[posting.row] += idf * tf * (kK1 + 1.0f) / (tf + norm);
+        }
+    }
+
+    hits.reserve(scores.size());
+    for (auto it = scores.cbegin(); it != scores.cend(); ++it) {
+        hits.push_back({it.key(), it.value()});
+    }
+    const auto better = [](const Hit &a, const Hit &b) {
+        return a.score != b.score ? a.score > b.score : a.row > b.row;
+    };
+    const auto top = hits.begin() + std::min<qsizetype>(limit, qsizetype(hits.size()));
+    std::partial_sort(hits.begin(), top, hits.end(), better);
+    hits.erase(top, hits.end());
+    return hits;
+}
@@ -0,0 +1,51 @@
+#ifndef CHATSEARCHINDEX_H
+#define CHATSEARCHINDEX_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+/*
+ * ChatSearchIndex:
+ *   - 会話のメッセージを全文検索するための転置インデックス (文書 = メッセージ、文書番号 = 行番号)
+ *   - 分かち書き: NFKC 正規化 + case folding のあと
+ *       英数字などの連続 → 1語
+ *       漢字・ひらがな・カタカナ・ハングルの連続 → 2文字ずつずらした bigram (1文字だけならその1文字)
+ *     検索語も同じ規則で分けるので、日本語は語の区切りがなくても部分一致で見つかる
+ *   - 順位付けは BM25。文書は行番号の順に追加し、末尾から取り除ける (再生成・清書で差し替わる最新のターン)
+ */
+class ChatSearchIndex
+{
+public:
+    struct Hit {
+        int   row;
+        float score;
+    };
+
+    // 検索語の分け方 (インデックスと同じ)
+    static QStringList tokenize(QStringView text);
+
+    // row は documentCount() と同じであること (行番号の順に追加する)
+    void addDocument(int row, QStringView text);
+    // 最後の文書を取り除く (text は追加したときと同じ内容)
+    void removeLastDocument(QStringView text);
+    void clear();
+
+    int documentCount() const { return static_cast<int>(m_docLengths.size()); }
+
+    // スコアの高い順 (同点なら新しい行が先) に最大 limit 件
+    std::vector<Hit> search(QStringView query, int limit) const;
+
+private:
+    struct Posting {
+        int     row;
+        quint32 termFrequency;
+    };
+
+    QHash<QString, std::vector<Posting>> m_postings;     // 語 → 出現する文書 (行番号の昇順)
+    std::vector<quint32>                 m_docLengths;   // 文書ごとの語数
+    quint64                              m_totalLength = 0;
+};
+
+#endif // CHATSEARCHINDEX_H
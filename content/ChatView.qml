@@ -44,6 +44,9 @@ Rectangle {
 
                 // Decide if it's a user message or assistant
                 property bool ownMessage: (model.sender === "user")
+                // Read the blocks role here: inside the Repeater, "model" is the Repeater's own property
+                // Repeater の中では model が Repeater 自身のプロパティを指すので、ここで受け取る
+                property var blockModel: model.blocks
 
                 anchors {
                     right: _outerWrapper.ownMessage ? parent.right : undefined
@@ -73,7 +76,7 @@ Rectangle {
                     }
 
                     // Dynamically compute total height from children
-                    height: _userName.implicitHeight + textBody.implicitHeight
+                    height: _userName.implicitHeight + _blocksColumn.implicitHeight
 
                     // Sender label (You / AI)
                     Text {
@@ -87,16 +90,27 @@ Rectangle {
                         text: from + ": "
                     }
 
-                    // The actual message text
-                    Text {
-                        id: textBody
+                    // The actual message text, one Text per Markdown block.
+                    // While a reply is streaming only the last block changes, so
+                    // completed blocks are not parsed and laid out again.
+                    // Markdown のブロックごとに1つの Text (生成中に変わるのは最後のブロックだけ)
+                    Column {
+                        id: _blocksColumn
                         anchors.left: parent.left
                         anchors.right: parent.right
-                        font.pointSize: 12
-                        color: "#f3f3f4"
-                        wrapMode: Text.Wrap
-                        text: model.messageContent
-                        textFormat: Text.MarkdownText
+                        spacing: 6
+
+                        Repeater {
+                            model: _outerWrapper.blockModel
+                            delegate: Text {
+                                width: _blocksColumn.width
+                                font.pointSize: 12
+                                color: "#f3f3f4"
+                                wrapMode: Text.Wrap
+                                text: model.blockText
+                                textFormat: Text.MarkdownText
+                            }
+                        }
                     }
                 }
             }
@@ -120,11 +134,22 @@ Rectangle {
             margins: 20
         }
 
-        placeholderText: qsTr("Start typing here...")
+        // 音声入力中は途中の認識結果を表示する
+        placeholderText: LlamaChatEngine.interimVoiceText !== "" ? LlamaChatEngine.interimVoiceText
+                                                                : qsTr("Start typing here...")
         onAccepted: {
+            draftPrefillTimer.stop()
             LlamaChatEngine.setUserInput(_inputField.text)
             _inputField.text = ""
         }
+
+        // 入力が止まったら、送信前にプロンプトを LLM に先読みさせる (送信時は差分だけ計算する)
+        onTextEdited: draftPrefillTimer.restart()
+        Timer {
+            id: draftPrefillTimer
+            interval: 400
+            onTriggered: LlamaChatEngine.setDraftInput(_inputField.text)
+        }
     }
 
     ColumnLayout {
@@ -0,0 +1,147 @@
+#include "ComputeBudgetArbiter.h"
+#include <QDebug>
+#include <QThread>
+#include <algorithm>
+
+namespace {
+// Usable cores: keep one for the GUI / audio capture threads
+// 使えるコア数 (GUI・録音スレッド用に1つ残す)
+int usableCores(int cores)
+{
+    return std::max(cores - 1, 1);
+}
+
+// Single-token decode is bound by memory bandwidth and stops scaling after a
+// few threads; more only steals cores from whisper
+// 1トークンずつのデコードはメモリ帯域律速で、数スレッドで頭打ちになる
+int decodeCap(int usable)
+{
+    return std::min(usable, std::max(4, usable / 2));
+}
+} // namespace
+
+ComputeBudgetArbiter &ComputeBudgetArbiter::instance()
+{
+    static ComputeBudgetArbiter arbiter;
+    return arbiter;
+}
+
+ComputeBudgetArbiter::ComputeBudgetArbiter()
+    : m_cores(std::max(QThread::idealThreadCount(), 1))
+{
+}
+
+ComputeBudgetArbiter::AsrScope::AsrScope()
+{
+    ComputeBudgetArbiter &arbiter = instance();
+    if (arbiter.m_asrJobs.fetch_add(1) == 0) {
+        arbiter.logBudget();
+    }
+}
+
+ComputeBudgetArbiter::AsrScope::~AsrScope()
+{
+    ComputeBudgetArbiter &arbiter = instance();
+    if (arbiter.m_asrJobs.fetch_sub(1) == 1) {
+        arbiter.logBudget();
+    }
+}
+
+/*
+  Inputs:
+    - setPhase() is fed from LlamaChatEngine::setOperationPhase()
+    - setSpeechActive() is fed from VoiceRecognitionEngine (the phase alone
+      does not show speech that starts while the LLM is running)
+
+  入力:
+    - setPhase() は LlamaChatEngine::setOperationPhase() から
+    - setSpeechActive() は VoiceRecognitionEngine から
+      (LLM 実行中に話し始めたことはフェーズには現れないため)
+*/
+void ComputeBudgetArbiter::setPhase(OperationPhase phase)
+{
+    if (m_phase.exchange(phase) != phase) {
+        logBudget();
+    }
+}
+
+void ComputeBudgetArbiter::setSpeechActive(bool active)
+{
+    if (m_speechActive.exchange(active) != active) {
+        logBudget();
+    }
+}
+
+void ComputeBudgetArbiter::setCoreBudget(int cores)
+{
+    m_cores = std::max(cores, 1);
+    logBudget();
+}
+
+bool ComputeBudgetArbiter::speechPathActive() const
+{
+    const int phase = m_phase.load();
+    return m_speechActive.load() || m_asrJobs.load() > 0
+           || phase == VadRunning || phase == WhisperRunning;
+}
+
+/*
+  threadsFor(...):
+    - Speech path active: ASR gets 3/4 of the usable cores, the LLM the rest
+      (it keeps running, just slower, so a reply already streaming continues)
+    - Otherwise: prefill may use every usable core, decode is capped, and ASR
+      keeps half for streaming hypotheses / VAD bursts
+    - Speculative prefill (nobody is waiting for it yet) gets at most half,
+      so typing and the GUI stay responsive
+
+  threadsFor(...):
+    - 音声処理中: ASR に使えるコアの 3/4、LLM は残り (止めずに遅くするだけ)
+    - それ以外: プリフィルは全コア、デコードは上限付き、ASR は半分
+    - 先読みのプリフィル (まだ誰も待っていない) は多くても半分 (入力や GUI を重くしない)
+*/
+int ComputeBudgetArbiter::threadsFor(Workload workload, int sharers) const
+{
+    const int usable = usableCores(m_cores.load());
+    const bool speech = speechPathActive();
+
+    int threads = 1;
+    switch (workload) {
+    case Asr:
+        threads = speech ? peakAsrThreads() : std::max(usable / 2, 1);
+        threads /= std::max(sharers, 1);
+        break;
+    case LlmPrefill:
+        threads = speech ? usable - peakAsrThreads() : usable;
+        break;
+    case LlmDecode:
+        threads = speech ? usable - peakAsrThreads() : decodeCap(usable);
+        break;
+    case LlmSpeculativePrefill:
+        threads = speech ? usable - peakAsrThreads() : usable / 2;
+        break;
+    }
+    return std::max(threads, 1);
+}
+
+int ComputeBudgetArbiter::peakAsrThreads() const
+{
+    const int usable = usableCores(m_cores.load());
+    return std::max(usable * 3 / 4, 1);
+}
+
+void ComputeBudgetArbiter::logBudget()
+{
+    // Only log when the speech / non-speech split flips
+    // 音声処理中かどうかが切り替わったときだけログを出す
+    const bool speech = speechPathActive();
+    std::lock_guard<std::mutex> lock(m_logMutex);
+    if (speech == m_lastLoggedSpeech) {
+        return;
+    }
+    m_lastLoggedSpeech = speech;
+    qDebug() << "[ComputeBudgetArbiter]" << (speech ? "speech" : "idle/llm")
+             << "asr =" << threadsFor(Asr)
+             << "prefill =" << threadsFor(LlmPrefill)
+             << "decode =" << threadsFor(LlmDecode)
+             << "of" << m_cores.load() << "cores";
+}
@@ -0,0 +1,90 @@
+#ifndef COMPUTE_BUDGET_ARBITER_H
+#define COMPUTE_BUDGET_ARBITER_H
+
+#include <atomic>
+#include <mutex>
+#include "OperationPhase.h"
+
+/*
+  ComputeBudgetArbiter:
+    - Process-wide split of the CPU cores between whisper (ASR) and llama
+      (prompt prefill / token decode), which otherwise each spin up their own
+      ggml worker threads and oversubscribe the machine
+    - The split follows the current OperationPhase and whether speech is being
+      processed; while the speech path is active the LLM yields most cores
+    - Thread-safe; callers ask for their thread count right before each
+      whisper_full / llama_decode, so a change applies from the next call
+
+  ComputeBudgetArbiterクラス:
+    - whisper (音声認識) と llama (プロンプトのプリフィル / トークンのデコード) に
+      CPU コアを配分するプロセス全体の調停役 (各ライブラリが勝手にスレッドを立てて
+      コア数を超えないように)
+    - 配分は OperationPhase と音声処理中かどうかで決まり、音声処理中は LLM がコアを譲る
+    - スレッドセーフ。whisper_full / llama_decode の直前に毎回問い合わせるので、
+      配分の変更は次の呼び出しから効く
+*/
+class ComputeBudgetArbiter
+{
+public:
+    enum Workload {
+        Asr,         // whisper_full (one decode; divide by the number of parallel decodes)
+        LlmPrefill,  // llama_decode with a prompt batch (compute-bound)
+        LlmDecode,   // llama_decode with a single token (memory-bandwidth-bound)
+        LlmSpeculativePrefill,  // prompt batch decoded ahead of a request (low priority)
+    };
+
+    //--------------------------------------------------------------------------
+    // RAII marker for a running ASR job (whisper_full on a pool thread).
+    // 実行中の音声認識ジョブの目印 (スコープを抜けると解除)
+    //--------------------------------------------------------------------------
+    class AsrScope
+    {
+    public:
+        AsrScope();
+        ~AsrScope();
+        AsrScope(const AsrScope &) = delete;
+        AsrScope &operator=(const AsrScope &) = delete;
+    };
+
+    static ComputeBudgetArbiter &instance();
+
+    //--------------------------------------------------------------------------
+    // Inputs
+    // 配分を決める入力
+    //--------------------------------------------------------------------------
+    void setPhase(OperationPhase phase);
+    // Speech is being captured (between VAD speech start and end)
+    // 発話中 (VAD の発話開始から終了まで)
+    void setSpeechActive(bool active);
+    // Number of cores to share (default: QThread::idealThreadCount())
+    // 配分するコア数 (既定は QThread::idealThreadCount())
+    void setCoreBudget(int cores);
+
+    //--------------------------------------------------------------------------
+    // Outputs
+    // 配分結果
+    //--------------------------------------------------------------------------
+    // Threads for one job of the given workload; ASR budget is divided between
+    // `sharers` concurrent decodes
+    // 指定ワークロード1本あたりのスレッド数 (ASR は sharers 本で等分)
+    int threadsFor(Workload workload, int sharers = 1) const;
+    // ASR budget while speech is active (the largest it gets), for sizing pools
+    // 音声処理中の ASR 配分 (最大値)。プールの大きさを決めるのに使う
+    int peakAsrThreads() const;
+    bool speechPathActive() const;
+    int coreBudget() const { return m_cores.load(); }
+
+private:
+    ComputeBudgetArbiter();
+    void logBudget();
+
+    std::atomic<int>  m_cores {1};
+    std::atomic<int>  m_phase {WaitingUserInput};
+    std::atomic<bool> m_speechActive {false};
+    std::atomic<int>  m_asrJobs {0};
+
+    std::mutex m_logMutex;
+    bool       m_lastLoggedSpeech {false};
+};
+
+#endif // COMPUTE_BUDGET_ARBITER_H
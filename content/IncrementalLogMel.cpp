@@ -0,0 +1,255 @@
+#include "IncrementalLogMel.h"
+#include "AudioHistoryBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr double kPi = 3.14159265358979323846;
+
+// slaney 方式の Hz <-> mel 変換 (librosa の htk=False と同じ)
+constexpr double kMinLogHz  = 1000.0;
+constexpr double kFSp       = 200.0 / 3.0;
+constexpr double kMinLogMel = kMinLogHz / kFSp;
+
+double hzToMel(double hz)
+{
+    if (hz < kMinLogHz) {
+        return hz / kFSp;
+    }
+    return kMinLogMel + std::log(hz / kMinLogHz) / (std::log(6.4) / 27.0);
+}
+
+double melToHz(double mel)
+{
+    if (mel < kMinLogMel) {
+        return mel * kFSp;
+    }
+    return kMinLogHz * std::exp((std::log(6.4) / 27.0) * (mel - kMinLogMel));
+}
+} // namespace
+
+IncrementalLogMel::IncrementalLogMel()
+    : m_hann(kFrameSize)
+    , m_sin(kFrameSize)
+    , m_cos(kFrameSize)
+    , m_fftIn(kFrameSize * 2)
+    , m_fftOut(kFrameSize * 8)
+{
+    // whisper と同じ periodic Hann 窓と sin/cos テーブル
+    for (int i = 0; i < kFrameSize; ++i) {
+        m_hann[i] = float(0.5 * (1.0 - std::cos(2.0 * kPi * i / kFrameSize)));
+        m_sin[i]  = float(std::sin(2.0 * kPi * i / kFrameSize));
+        m_cos[i]  = float(std::cos(2.0 * kPi * i / kFrameSize));
+    }
+}
+
+void IncrementalLogMel::reset(int nMel, size_t capacityFrames, uint64_t position)
+{
+    if (nMel != m_nMel) {
+        m_nMel = nMel;
+        initFilters();
+    }
+    m_capacityFrames = std::max<size_t>(capacityFrames, 1);
+    m_frames.assign(m_capacityFrames * size_t(m_nMel), 0.0f);
+    m_frameLog.assign(size_t(m_nMel), 0.0f);
+
+    // 窓全体が position 以降に収まる最初のフレームから計算する
+    m_streamStart = position;
+    m_firstFrame  = int64_t((position + kFrameSize / 2 + kHop - 1) / kHop);
+    m_nextFrame   = m_firstFrame;
+}
+
+void IncrementalLogMel::initFilters()
+{
+    m_filters.assign(size_t(m_nMel) * kBins, 0.0f);
+    m_filterBegin.assign(m_nMel, 0);
+    m_filterEnd.assign(m_nMel, 0);
+    if (m_nMel <= 0) {
+        return;
+    }
+
+    // librosa.filters.mel(sr=16000, n_fft=400, n_mels=m_nMel, fmin=0, fmax=8000, norm='slaney')
+    std::vector<double> melF(m_nMel + 2);
+    const double maxMel = hzToMel(kSampleRate / 2.0);
+    for (int i = 0; i < m_nMel + 2; ++i) {
+        melF[i] = melToHz(maxMel * i / (m_nMel + 1));
+    }
+    for (int m = 0; m < m_nMel; ++m) {
+        const double lowerWidth = melF[m + 1] - melF[m];
+        const double upperWidth = melF[m + 2] - melF[m + 1];
+        const double enorm      = 2.0 / (melF[m + 2] - melF[m]);
+        int first = kBins;
+        int last  = 0;
+        for (int k = 0; k < kBins; ++k) {
+            const double freq  = double(k) * kSampleRate / kFrameSize;
+            const double lower = (freq - melF[m]) / lowerWidth;
+            const double upper = (melF[m + 2] - freq) / upperWidth;
+            const double w     = std::max(0.0, std::min(lower, upper)) * enorm;
+            m_filters[size_t(m) * kBins + k] = float(w);
+            if (w > 0.0) {
+                first = std::min(first, k);
+                last  = k + 1;
+            }
+        }
+        m_filterBegin[m] = std::min(first, last);
+        m_filterEnd[m]   = last;
+    }
+}
+
+void IncrementalLogMel::update(const AudioHistoryBuffer &history)
+{
+    if (!isReady()) {
+        return;
+    }
+    const uint64_t available = history.totalWritten();
+    while (uint64_t(m_nextFrame) * kHop + kFrameSize / 2 <= available) {
+        float *dst = m_frames.data() + size_t(m_nextFrame % int64_t(m_capacityFrames)) * m_nMel;
+        computeFrame(history, m_nextFrame, dst);
+        ++m_nextFrame;
+        if (m_nextFrame - m_firstFrame > int64_t(m_capacityFrames)) {
+            ++m_firstFrame;
+        }
+    }
+}
+
+int IncrementalLogMel::buildWhisperInput(const AudioHistoryBuffer &history, uint64_t begin, uint64_t end,
+                                         int padFrames, std::vector<float> &out, int &nLen)
+{
+    nLen = 0;
+    if (!isReady() || end <= begin) {
+        return 0;
+    }
+
+    const int64_t firstFrame = int64_t((begin + kHop / 2) / kHop);
+    const int     nFrames    = std::max(1, int((end - begin) / kHop));
+    nLen = nFrames + std::max(padFrames, 0);
+    out.resize(size_t(nLen) * m_nMel);
+
+    // 計算済みならリングから、なければその場で計算 (発話終了直後の末尾数フレームなど)
+    float maxValue = -1e20f;
+    for (int i = 0; i < nFrames; ++i) {
+        const int64_t k = firstFrame + i;
+        const float *src = nullptr;
+        if (k >= m_firstFrame && k < m_nextFrame) {
+            src = m_frames.data() + size_t(k % int64_t(m_capacityFrames)) * m_nMel;
+        } else {
+            computeFrame(history, k, m_frameLog.data());
+            src = m_frameLog.data();
+        }
+        for (int m = 0; m < m_nMel; ++m) {
+            out[size_t(m) * nLen + i] = src[m];
+            maxValue = std::max(maxValue, src[m]);
+        }
+    }
+
+    // whisper_pcm_to_mel() と同じ正規化。パディングは無音 (log10(1e-10)) を正規化した値
+    const float floorValue = maxValue - 8.0f;
+    const float padValue   = (std::max(-10.0f, floorValue) + 4.0f) / 4.0f;
+    for (int m = 0; m < m_nMel; ++m) {
+        float *row = out.data() + size_t(m) * nLen;
+        for (int i = 0; i < nFrames; ++i) {
+            row[i] = (std::max(row[i], floorValue) + 4.0f) / 4.0f;
+        }
+        std::fill(row + nFrames, row + nLen, padValue);
+    }
+    return nFrames;
+}
+
+void IncrementalLogMel::computeFrame(const AudioHistoryBuffer &history, int64_t frameIndex, float *dst)
+{
+    // 窓は [k*160 - 200, k*160 + 200)。保持範囲外 (録音開始前・未着) は 0 とする
+    const int64_t start = frameIndex * kHop - kFrameSize / 2;
+    const uint64_t lo = std::max<uint64_t>(history.oldestAvailable(), m_streamStart);
+    const int64_t  validBegin = std::max<int64_t>(start, int64_t(lo));
+    const int64_t  validEnd   = std::min<int64_t>(start + kFrameSize, int64_t(history.totalWritten()));
+
+    std::fill(m_fftIn.begin(), m_fftIn.begin() + kFrameSize, 0.0f);
+    if (validBegin < validEnd) {
+        const AudioHistoryBuffer::View view = history.range(uint64_t(validBegin), uint64_t(validEnd));
+        const int offset = int(int64_t(view.begin) - start);
+        for (size_t i = 0; i < view.size; ++i) {
+            m_fftIn[offset + i] = m_hann[offset + i] * view.data[i];
+        }
+    }
+
+    fft(m_fftIn.data(), kFrameSize, m_fftOut.data());
+
+    // パワースペクトル。whisper は負の周波数側を折り返して足しているので 1..N/2 は2倍
+    float power[kBins];
+    for (int k = 0; k < kBins; ++k) {
+        const float re = m_fftOut[2 * k];
+        const float im = m_fftOut[2 * k + 1];
+        power[k] = re * re + im * im;
+        if (k > 0) {
+            power[k] *= 2.0f;
+        }
+    }
+
+    for (int m = 0; m < m_nMel; ++m) {
+        const float *filter = m_filters.data() + size_t(m) * kBins;
+        double sum = 0.0;
+        for (int k = m_filterBegin[m]; k < m_filterEnd[m]; ++k) {
+            sum += double(power[k]) * filter[k];
+        }
+        dst[m] = float(std::log10(std::max(sum, 1e-10)));
+    }
+}
+
+void IncrementalLogMel::dft(const float *in, int n, float *out)
+{
+    const int step = kFrameSize / n;
+    for (int k = 0; k < n; ++k) {
+        float re = 0.0f;
+        float im = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            const int idx = (k * i * step) % kFrameSize;
+            re += in[i] * m_cos[idx];
+            im -= in[i] * m_sin[idx];
+        }
+        out[2 * k]     = re;
+        out[2 * k + 1] = im;
+    }
+}
+
+// whisper.cpp と同じ再帰 FFT (400 = 2^4 * 25 なので最後は 25 点の DFT)
+//  in は 2n、out は 8n 要素の作業領域を前提とする (確保はコンストラクタで1回だけ)
+void IncrementalLogMel::fft(float *in, int n, float *out)
+{
+    if (n == 1) {
+        out[0] = in[0];
+        out[1] = 0.0f;
+        return;
+    }
+    const int half = n / 2;
+    if (n - half * 2 == 1) {
+        dft(in, n, out);
+        return;
+    }
+
+    float *even = in + n;
+    for (int i = 0; i < half; ++i) {
+        even[i] = in[2 * i];
+    }
+    float *evenFft = out + 2 * n;
+    fft(even, half, evenFft);
+
+    float *odd = even;
+    for (int i = 0; i < half; ++i) {
+        odd[i] = in[2 * i + 1];
+    }
+    float *oddFft = evenFft + n;
+    fft(odd, half, oddFft);
+
+    const int step = kFrameSize / n;
+    for (int k = 0; k < half; ++k) {
+        const float re    = m_cos[k * step];
+        const float im    = -m_sin[k * step];
+        const float reOdd = oddFft[2 * k];
+        const float imOdd = oddFft[2 * k + 1];
+        out[2 * k]              = evenFft[2 * k]     + re * reOdd - im * imOdd;
+        out[2 * k + 1]          = evenFft[2 * k + 1] + re * imOdd + im * reOdd;
+        out[2 * (k + half)]     = evenFft[2 * k]     - re * reOdd + im * imOdd;
+        out[2 * (k + half) + 1] = evenFft[2 * k + 1] - re * imOdd - im * reOdd;
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef INCREMENTALLOGMEL_H
+#define INCREMENTALLOGMEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class AudioHistoryBuffer;
+
+/*
+ * IncrementalLogMel:
+ *   - whisper と同じ手順 (Hann窓 400 / ホップ 160 / FFT / slaney メルフィルタ / log10) で
+ *     ログメルスペクトログラムを録音と並行して 10ms ずつ計算しておく
+ *   - フレーム k は絶対サンプル位置 k*160 を中心とする 400 サンプル
+ *     (AudioHistoryBuffer の通し番号に揃えてあるので、区間の切り出し位置が変わっても再利用できる)
+ *   - 計算済みフレームはリングバッファに保持し、認識時は whisper_set_mel() 用に
+ *     正規化 + 無音パディングした配列を組み立てるだけで済む
+ *     → 発話終了と同時にエンコーダを走らせられる
+ *   - メルフィルタはモデルファイルの値ではなく librosa.filters.mel(sr=16000, n_fft=400, norm='slaney')
+ *     と同じ式でここで計算する (whisper の mel_filters はこれで生成されている)
+ */
+class IncrementalLogMel
+{
+public:
+    static constexpr int kSampleRate = 16000;
+    static constexpr int kFrameSize  = 400;   // 25ms
+    static constexpr int kHop        = 160;   // 10ms
+    static constexpr int kBins       = kFrameSize / 2 + 1;
+
+    IncrementalLogMel();
+
+    // nMel: モデルのメル数 (whisper_model_n_mels)、capacityFrames: 保持するフレーム数
+    // position: 以降に届くサンプルの先頭 (これより前の音声は使わない)
+    void reset(int nMel, size_t capacityFrames, uint64_t position);
+    bool isReady() const { return m_nMel > 0; }
+    int  nMel() const { return m_nMel; }
+
+    // history に新しく届いたサンプルで計算できるフレームをすべて計算する
+    void update(const AudioHistoryBuffer &history);
+
+    // 絶対サンプル区間 [begin, end) を whisper_set_mel() の形式 (mel 優先の n_mel x nLen) で out に組み立てる
+    //  - whisper_pcm_to_mel() と同じく最大値 - 8 でクランプし (x + 4) / 4 で正規化
+    //  - 後ろに padFrames 分の無音フレームを付ける (whisper も 30 秒分の無音を付けている)
+    //  - 戻り値は音声部分のフレーム数、nLen はパディング込みのフレーム数
+    int buildWhisperInput(const AudioHistoryBuffer &history, uint64_t begin, uint64_t end,
+                          int padFrames, std::vector<float> &out, int &nLen);
+
+    size_t memoryBytes() const { return m_frames.capacity() * sizeof(float); }
+
+private:
+    void initFilters();
+    void computeFrame(const AudioHistoryBuffer &history, int64_t frameIndex, float *dst);
+    void fft(float *in, int n, float *out);
+    void dft(const float *in, int n, float *out);
+
+    int      m_nMel = 0;
+    size_t   m_capacityFrames = 0;
+    int64_t  m_firstFrame = 0;    // リングに保持している最古フレーム
+    int64_t  m_nextFrame  = 0;    // 次に計算するフレーム
+    uint64_t m_streamStart = 0;   // これより前のサンプルは 0 として扱う
+
+    std::vector<float> m_frames;  // [フレーム % capacity][mel]、log10 (正規化前)
+
+    // メルフィルタ (非ゼロ範囲だけを持つ)
+    std::vector<float> m_filters;      // [mel][kBins]
+    std::vector<int>   m_filterBegin;  // [mel]
+    std::vector<int>   m_filterEnd;    // [mel]
+
+    std::vector<float> m_hann;
+    std::vector<float> m_sin;
+    std::vector<float> m_cos;
+    std::vector<float> m_fftIn;
+    std::vector<float> m_fftOut;
+    std::vector<float> m_frameLog;     // buildWhisperInput() で使う1フレーム分の作業領域
+};
+
+#endif // INCREMENTALLOGMEL_H
@@ -11,7 +11,10 @@
 #include <QFile>
 #include <QEventLoop>
 #include <QTimer>
+#include <QScopedValueRollback>
+#include <utility>
 #include "LlamaResponseGenerator.h"
+#include "ComputeBudgetArbiter.h"
 #include "rep_LlamaResponseGenerator_replica.h"
 #include "common.h"
 
@@ -44,9 +47,24 @@ const std::string LlamaChatEngine::mModelPath {
 LlamaChatEngine::LlamaChatEngine(QObject *parent)
     : QObject(parent)
     , mMessages(this)
+    , mSpeechOutput(this)
 {
     qSetMessagePattern("[%{file}:%{line}] %{message}");
 
+    // 読み上げ中のマイクの扱い (停止 or 割り込み待ち)
+    connect(&mSpeechOutput, &SpeechOutputStage::speechStarted,
+            this, &LlamaChatEngine::onSpeechOutputStarted);
+    connect(&mSpeechOutput, &SpeechOutputStage::speechFinished,
+            this, &LlamaChatEngine::onSpeechOutputFinished);
+
+    // 前回までの会話を表示 (インデックスを開くだけなので件数によらずすぐ終わる)
+    const QString historyDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (!historyDir.isEmpty() && QDir().mkpath(historyDir)) {
+        mMessages.openHistory(historyDir + QStringLiteral("/chat-history.log"));
+    } else {
+        qWarning() << "[LlamaChatEngine] No writable directory for the chat history";
+    }
+
 #ifdef Q_OS_ANDROID
     // Android向け: 実行時にassetsからモデルファイルをコピー＆mModelPath設定
     if (!initializeModelPathForAndroid()) {
@@ -66,6 +84,8 @@ LlamaChatEngine::LlamaChatEngine(QObject *parent)
 //------------------------------------------------------------------------------
 LlamaChatEngine::~LlamaChatEngine()
 {
+    mMessages.commitHistory();
+    shutdownVoiceRecognition();
     llama_free(mCtx);
     llama_free_model(mModel);
 }
@@ -96,6 +116,10 @@ void LlamaChatEngine::doEngineInit()
     mCtxParams = llama_context_default_params();
     mCtxParams.n_ctx   = mNCtx;
     mCtxParams.n_batch = mNCtx;
+    // Initial split; LlamaResponseGenerator re-applies it before every decode
+    // 初期配分 (生成中は LlamaResponseGenerator がデコードのたびに設定し直す)
+    mCtxParams.n_threads       = ComputeBudgetArbiter::instance().threadsFor(ComputeBudgetArbiter::LlmDecode);
+    mCtxParams.n_threads_batch = ComputeBudgetArbiter::instance().threadsFor(ComputeBudgetArbiter::LlmPrefill);
 
     mCtx = llama_new_context_with_model(mModel, mCtxParams);
     if (!mCtx) {
@@ -115,6 +139,10 @@ void LlamaChatEngine::doEngineInit()
 void LlamaChatEngine::onEngineInitFinished()
 {
     mLocalGenerator = new LlamaResponseGenerator(nullptr, mModel, mCtx);
+    mLocalGenerationCount    = 0;
+    mLastTurnGeneration      = 0;
+    mPendingLocalGenerations = 0;
+    mStaleLocalGenerations   = 0;
     mLocalWorkerThread = new QThread(this);
 
     mLocalGenerator->moveToThread(mLocalWorkerThread);
@@ -131,6 +159,12 @@ void LlamaChatEngine::onEngineInitFinished()
     configureRemoteObjects();
     // Default to local
     doImmediateEngineSwitch(Mode_Local);
+
+#ifndef Q_OS_ANDROID
+    // whisper モデルをバックグラウンドで先読みしておく
+    // (Android はモデルのダウンロード完了時に onWhisperDownloadFinished() から行う)
+    initVoiceRecognition();
+#endif
 }
 
 //------------------------------------------------------------------------------
@@ -265,6 +299,10 @@ void LlamaChatEngine::teardownLocalConnections()
         disconnect(*mLocalGenerationErrorToQmlConnection);
         mLocalGenerationErrorToQmlConnection.reset();
     }
+    if (mLocalGenerationCancelledConnection.has_value()) {
+        disconnect(*mLocalGenerationCancelledConnection);
+        mLocalGenerationCancelledConnection.reset();
+    }
 
     qDebug() << "[teardownLocalConnections] Local connections torn down.";
 }
@@ -307,6 +345,11 @@ void LlamaChatEngine::setupLocalConnections()
         this, &LlamaChatEngine::inferenceErrorToQML
         );
 
+    mLocalGenerationCancelledConnection = connect(
+        mLocalGenerator, &LlamaResponseGenerator::generationCancelled,
+        this, &LlamaChatEngine::onGenerationCancelled
+        );
+
     qDebug() << "[setupLocalConnections] Local connections established.";
 }
 
@@ -347,6 +390,10 @@ void LlamaChatEngine::teardownRemoteConnections()
         disconnect(*mRemoteGenerationErrorToQmlConnection);
         mRemoteGenerationErrorToQmlConnection.reset();
     }
+    if (mRemoteGenerationCancelledConnection.has_value()) {
+        disconnect(*mRemoteGenerationCancelledConnection);
+        mRemoteGenerationCancelledConnection.reset();
+    }
 
     qDebug() << "[teardownRemoteConnections] Remote connections torn down.";
 }
@@ -385,6 +432,11 @@ void LlamaChatEngine::setupRemoteConnections()
         this, &LlamaChatEngine::onInferenceError
         );
 
+    mRemoteGenerationCancelledConnection = connect(
+        &mRemoteGenerator, &RemoteResponseGeneratorCompositor::generationCancelled,
+        this, &LlamaChatEngine::onGenerationCancelled
+        );
+
     qDebug() << "[setupRemoteConnections] Remote connections established.";
 }
 
@@ -395,10 +447,16 @@ void LlamaChatEngine::setupRemoteConnections()
 void LlamaChatEngine::handleNewUserInput()
 {
     if (mInProgress) {
+        if (!mPendingVoiceDraft.isEmpty() && mUserInput == mPendingVoiceDraft) {
+            // An utterance that interrupted the reply (barge-in): send it when the reply ends
+            // 応答に割り込んだ発話: 応答が終わったら送る
+            qDebug() << "Generation in progress, voice input queued:" << mUserInput;
+            mQueuedVoiceInput = mUserInput;
+            return;
+        }
         qDebug() << "Generation in progress, ignoring new input.";
         return;
     }
-    static QList<LlamaChatMessage> messages;
     if (mUserInput.isEmpty()) {
         return;
     }
@@ -407,10 +465,42 @@ void LlamaChatEngine::handleNewUserInput()
     LlamaChatMessage msg;
     msg.setRole(QStringLiteral("user"));
     msg.setContent(mUserInput);
-    messages.append(msg);
+    mChatHistory.append(msg);
+    mLastUserHistoryIndex = mChatHistory.size() - 1;
+
+    // The previous turn can no longer be refined or regenerated: save it to the log
+    // 前のターンはもう差し替わらないので履歴ログに保存する
+    mMessages.commitHistory();
+    mLastUserMessageIndex = mMessages.appendSingle("user", msg.content());
 
-    mMessages.appendSingle("user", msg.content());
-    emit requestGeneration(messages);
+    // Remember whether this turn came from a voice draft (it may be refined later)
+    // 音声認識の下書きから来たターンなら覚えておく (あとで清書に差し替わることがある)
+    mLastTurnVoiceDraft = (mUserInput == mPendingVoiceDraft) ? mUserInput : QString();
+    mPendingVoiceDraft.clear();
+    mDraftInput.clear();
+
+    emitGenerationRequest();
+}
+
+//------------------------------------------------------------------------------
+// emitGenerationRequest
+// 現在のチャット履歴で生成を要求 (ローカル生成器に送った回数を数える)
+//------------------------------------------------------------------------------
+void LlamaChatEngine::emitGenerationRequest()
+{
+    if (mCurrentEngineMode == Mode_Local) {
+        // Prefills still queued are stale; generate() reuses what was already decoded
+        // キューに残っている先読みは不要 (デコード済みの分は generate() が再利用する)
+        if (mLocalGenerator) {
+            mLocalGenerator->supersedePrefill(mPrefillEpoch);
+        }
+        mPrefilledUserText.clear();
+        mLastTurnGeneration = ++mLocalGenerationCount;
+        ++mPendingLocalGenerations;
+    } else {
+        mLastTurnGeneration = 0;
+    }
+    emit requestGeneration(mChatHistory);
 }
 
 //------------------------------------------------------------------------------
@@ -437,7 +527,8 @@ void LlamaChatEngine::pauseVoiceDetection()
         qWarning() << "Voice detector not initialized.";
         return;
     }
-    m_voiceDetector->pause();
+    // VoiceDetector は専用スレッドに属しているのでキュー経由で呼ぶ
+    QMetaObject::invokeMethod(m_voiceDetector, "pause", Qt::QueuedConnection);
 }
 
 void LlamaChatEngine::resumeVoiceDetection()
@@ -446,7 +537,11 @@ void LlamaChatEngine::resumeVoiceDetection()
         qWarning() << "Voice detector not initialized.";
         return;
     }
-    m_voiceDetector->resume();
+    if (!m_voiceRecognitionEnabled) {
+        // 音声入力が無効なときはマイクを再開しない
+        return;
+    }
+    QMetaObject::invokeMethod(m_voiceDetector, "resume", Qt::QueuedConnection);
 }
 
 void LlamaChatEngine::setVoiceRecognitionLanguage(const QString &language)
@@ -455,11 +550,16 @@ void LlamaChatEngine::setVoiceRecognitionLanguage(const QString &language)
         qWarning() << "Voice recognition engine not initialized.";
         return;
     }
-    m_voiceRecognitionEngine->setLanguage(language);
+    VoiceRecognitionEngine *engine = m_voiceRecognitionEngine;
+    QMetaObject::invokeMethod(engine, [engine, language] {
+        engine->setLanguage(language);
+    }, Qt::QueuedConnection);
 }
 
 void LlamaChatEngine::initiateVoiceRecognition()
 {
+    m_voiceRecognitionEnabled = true;
+    // 先読みが済んでいなければここでロードを開始 (完了後に自動で開始される)
     initVoiceRecognition();
     startVoiceRecognition();
 }
@@ -470,12 +570,18 @@ void LlamaChatEngine::initiateVoiceRecognition()
 //------------------------------------------------------------------------------
 void LlamaChatEngine::onPartialResponse(const QString &textSoFar)
 {
+    if (mStaleLocalGenerations > 0) {
+        return; // A draft turn replaced by a refined transcript
+    }
     if (!mInProgress) {
         mCurrentAssistantIndex = mMessages.appendSingle("assistant", textSoFar);
         mInProgress = true;
     } else {
         mMessages.updateMessageContent(mCurrentAssistantIndex, textSoFar);
     }
+    // Speak each sentence as soon as it is complete
+    // 文が揃ったところから読み上げる
+    mSpeechOutput.appendResponse(textSoFar);
 }
 
 //------------------------------------------------------------------------------
@@ -484,11 +590,32 @@ void LlamaChatEngine::onPartialResponse(const QString &textSoFar)
 //------------------------------------------------------------------------------
 void LlamaChatEngine::onGenerationFinished(const QString &finalResponse)
 {
+    if (mStaleLocalGenerations > 0) {
+        // The replaced draft turn finished before its cancel took effect
+        // 差し替えた下書きのターンが中断より先に完了した
+        --mStaleLocalGenerations;
+        endLocalGeneration();
+        return;
+    }
     if (mInProgress) {
         mMessages.updateMessageContent(mCurrentAssistantIndex, finalResponse);
+        // The turn is complete: make it searchable (this also publishes the final text)
+        // ターンが完了したので検索できるようにする (最終的なテキストの反映も兼ねる)
+        mMessages.indexFinishedRows();
         mInProgress = false;
         mCurrentAssistantIndex = -1;
+
+        // GUI-thread cost of streaming the reply into the chat view
+        // 応答を逐次表示するのにかかった GUI スレッドの時間
+        const ChatMessageModel::UpdateStats stats = mMessages.takeUpdateStats();
+        if (stats.updates > 0) {
+            qDebug().nospace() << "[LlamaChatEngine] chat view updates: " << stats.publishes
+                               << " publishes for " << stats.updates << " tokens, "
+                               << double(stats.publishNs) / 1000.0 / stats.updates << " us/token on the GUI thread";
+        }
     }
+    mSpeechOutput.finishResponse(finalResponse);
+    endLocalGeneration();
 
     // Switch mode if needed
     if (mPendingEngineSwitchMode.has_value()) {
@@ -497,11 +624,189 @@ void LlamaChatEngine::onGenerationFinished(const QString &finalResponse)
         doImmediateEngineSwitch(pending);
     }
 
-    if(m_voiceDetector && m_voiceRecognitionEngine) {
+    if(m_voiceRecognitionEnabled) {
         setOperationPhase(Listening);
     } else {
         setOperationPhase(WaitingUserInput);
     }
+    submitQueuedVoiceInput();
+}
+
+//------------------------------------------------------------------------------
+// submitQueuedVoiceInput
+// 生成中に届いた発話 (割り込み) を、生成が終わったところで送る
+//------------------------------------------------------------------------------
+void LlamaChatEngine::submitQueuedVoiceInput()
+{
+    if (mQueuedVoiceInput.isEmpty() || mInProgress || mPendingLocalGenerations > 0 || mHoldQueuedVoiceInput) {
+        return;
+    }
+    const QString text = std::exchange(mQueuedVoiceInput, QString());
+    mPendingVoiceDraft = text;
+    if (mUserInput == text) {
+        handleNewUserInput();
+    } else {
+        setUserInput(text);
+    }
+}
+
+//------------------------------------------------------------------------------
+// endLocalGeneration
+// ローカル生成が1件終わった (完了・中断)。生成がすべて終わったら、
+// 入力中のテキスト (なければ音声認識の途中結果) を応答を含む履歴で先読みし直す
+//------------------------------------------------------------------------------
+void LlamaChatEngine::endLocalGeneration()
+{
+    if (mCurrentEngineMode != Mode_Local || mPendingLocalGenerations == 0) {
+        return;
+    }
+    if (--mPendingLocalGenerations == 0) {
+        requestSpeculativePrefill(!mDraftInput.isEmpty() ? mDraftInput : m_interimVoiceText);
+    }
+}
+
+//------------------------------------------------------------------------------
+// onGenerationCancelled
+// 中断された生成の途中表示を取り除く
+//------------------------------------------------------------------------------
+void LlamaChatEngine::onGenerationCancelled()
+{
+    if (mStaleLocalGenerations > 0) {
+        --mStaleLocalGenerations;
+    }
+    if (mInProgress) {
+        mMessages.removeFrom(mCurrentAssistantIndex);
+        mMessages.takeUpdateStats();
+        mInProgress = false;
+        mCurrentAssistantIndex = -1;
+    }
+    mSpeechOutput.cancel();
+    endLocalGeneration();
+    submitQueuedVoiceInput();
+}
+
+//------------------------------------------------------------------------------
+// onTranscriptRefined
+// 2パス音声認識: 清書結果が下書きと大きく違えば、最新ターンを差し替えて生成し直す
+//------------------------------------------------------------------------------
+void LlamaChatEngine::onTranscriptRefined(const QString &draftText, const QString &refinedText)
+{
+    if (mLastTurnVoiceDraft.isEmpty() || mLastTurnVoiceDraft != draftText
+        || mLastUserHistoryIndex < 0 || mLastUserMessageIndex < 0) {
+        // A newer turn has started (or it was typed): keep the draft
+        // 既に次のターンに進んでいる (またはキーボード入力): 下書きのままにする
+        qDebug() << "[LlamaChatEngine] refined transcript is stale, ignored:" << refinedText;
+        return;
+    }
+    if (mCurrentEngineMode == Mode_Local) {
+        if (!mLocalGenerator || mLastTurnGeneration == 0) {
+            return;
+        }
+        qDebug() << "[LlamaChatEngine] transcript refined:" << draftText << "=>" << refinedText;
+
+        // Stop the draft turn (if still running) and drop it from the KV cache.
+        // Both are processed on the worker thread before the new request below.
+        // 下書きのターンを (実行中なら) 中断し、KV キャッシュから取り除く
+        // どちらも下の新しい生成要求より先にワーカースレッドで処理される
+        mLocalGenerator->cancelGeneration(mLastTurnGeneration);
+        QMetaObject::invokeMethod(mLocalGenerator, "rollbackGeneration", Qt::QueuedConnection,
+                                  Q_ARG(int, mLastTurnGeneration));
+        // Signals of the draft turn still queued (partials, then its end) belong to the
+        // discarded reply. Ignore them until that generation has ended.
+        // キューに残っている下書きのターンのシグナル (途中結果と、最後に終了) は捨てた応答のもの
+        // その生成が終わるまで無視する
+        mStaleLocalGenerations = mPendingLocalGenerations;
+    } else {
+        // Cancel the draft request; the server's history is replaced by the re-issued one.
+        // generationCancelled arrives synchronously: an utterance queued during the reply
+        // must wait for the re-issued one, not be sent while the turn is being replaced.
+        // 下書きの要求を中断する (サーバーの履歴は送り直す履歴で置き換わる)
+        // 中断の通知はこの場で届くので、待たせている発話は差し替え後の応答が終わるまで送らない
+        const QScopedValueRollback<bool> holdQueuedVoiceInput(mHoldQueuedVoiceInput, true);
+        if (!mRemoteGenerator.cancelGeneration()) {
+            // This remote generator cannot cancel a running request
+            // この接続方式は実行中の生成を中断できない
+            qDebug() << "[LlamaChatEngine] refined transcript not re-issued in remote mode:" << refinedText;
+            return;
+        }
+        qDebug() << "[LlamaChatEngine] transcript refined:" << draftText << "=>" << refinedText;
+    }
+
+    // Replace the user message and remove the draft reply
+    // ユーザーメッセージを差し替え、下書きへの応答を消す
+    mChatHistory.resize(mLastUserHistoryIndex + 1);
+    mChatHistory[mLastUserHistoryIndex].setContent(refinedText);
+    mMessages.updateMessageContent(mLastUserMessageIndex, refinedText);
+    mMessages.removeFrom(mLastUserMessageIndex + 1);
+    mSpeechOutput.cancel();
+    mInProgress = false;
+    mCurrentAssistantIndex = -1;
+    mLastTurnVoiceDraft.clear();
+
+    setOperationPhase(LlamaRunning);
+    emitGenerationRequest();
+}
+
+//------------------------------------------------------------------------------
+// onSpeechOutputStarted / onSpeechOutputFinished
+// 読み上げ中は自分の声を認識しないようにする
+//   - 割り込み無効: マイクを止める
+//   - 割り込み有効: マイクは止めず、VAD をエコーガード (読み上げの音量より大きい声だけ発話とみなす) にする
+//------------------------------------------------------------------------------
+void LlamaChatEngine::onSpeechOutputStarted()
+{
+    if (!m_voiceRecognitionEnabled || !m_voiceDetector) {
+        return;
+    }
+    if (m_bargeInEnabled && m_voiceRecognitionEngine) {
+        m_echoGuardActive = true;
+        QMetaObject::invokeMethod(m_voiceRecognitionEngine, "setEchoGuard", Qt::QueuedConnection,
+                                  Q_ARG(bool, true));
+    } else {
+        m_voicePausedForSpeech = true;
+        pauseVoiceDetection();
+    }
+}
+
+void LlamaChatEngine::onSpeechOutputFinished()
+{
+    if (m_echoGuardActive) {
+        m_echoGuardActive = false;
+        QMetaObject::invokeMethod(m_voiceRecognitionEngine, "setEchoGuard", Qt::QueuedConnection,
+                                  Q_ARG(bool, false));
+    }
+    if (m_voicePausedForSpeech) {
+        m_voicePausedForSpeech = false;
+        resumeVoiceDetection();
+    }
+}
+
+//------------------------------------------------------------------------------
+// onBargeInDetected
+// 読み上げ中にユーザーが話し始めた: 読み上げと生成を中断して聞き取りに戻る
+//------------------------------------------------------------------------------
+void LlamaChatEngine::onBargeInDetected()
+{
+    if (!m_echoGuardActive) {
+        // 読み上げは既に終わっている (通常の発話として扱われる)
+        return;
+    }
+    qDebug() << "[LlamaChatEngine] barge-in: interrupting speech";
+    // エンジン側は検出時に自分でガードを解除している
+    m_echoGuardActive = false;
+
+    if (mInProgress && mCurrentEngineMode == Mode_Local && mLocalGenerator && mLastTurnGeneration > 0) {
+        // Partial reply is removed in onGenerationCancelled()
+        // 途中までの応答は onGenerationCancelled() で取り除かれる
+        mLocalGenerator->cancelGeneration(mLastTurnGeneration);
+    } else if (mInProgress && mCurrentEngineMode == Mode_Remote && !mRemoteGenerator.cancelGeneration()) {
+        // This remote generator keeps running; the rest of its reply is shown but not spoken,
+        // and the interrupting utterance is sent once it finishes (handleNewUserInput)
+        // 中断できない接続方式なら、残りは表示だけして読み上げない
+        // (割り込んだ発話は応答が終わってから送る)
+        qDebug() << "[LlamaChatEngine] barge-in: remote generation cannot be cancelled";
+    }
+    mSpeechOutput.interrupt();
 }
 
 //------------------------------------------------------------------------------
@@ -510,6 +815,12 @@ void LlamaChatEngine::onGenerationFinished(const QString &finalResponse)
 //------------------------------------------------------------------------------
 void LlamaChatEngine::onInferenceError(const QString &errorMessage)
 {
+    // The engine is re-created below: nothing is left to prefill behind
+    // and a queued utterance is dropped
+    // エンジンを作り直すので、先読みし直さず、待たせていた発話も捨てる
+    mPendingLocalGenerations = 0;
+    mStaleLocalGenerations   = 0;
+    mQueuedVoiceInput.clear();
     if (mCurrentEngineMode == Mode_Local) {
         setLocalAiInError(true);
         QThreadPool::globalInstance()->start([this]() {
@@ -759,6 +1070,9 @@ void LlamaChatEngine::onWhisperDownloadFinished(bool success)
     mWhisperModelReady = true;
 
     qDebug() << "[onWhisperDownloadFinished] Whisper model is ready at" << localModelPath;
+
+    // ダウンロード済みモデルをバックグラウンドで先読み
+    initVoiceRecognition();
 }
 
 //------------------------------------------------------------------------------
@@ -795,32 +1109,23 @@ void LlamaChatEngine::setCurrentEngineMode(EngineMode newCurrentEngineMode)
     emit currentEngineModeChanged();
 }
 
+//------------------------------------------------------------------------------
+// initVoiceRecognition
+// 音声認識エンジン/音声検出器を一度だけ生成し、専用スレッド上で whisper をロードする
+//   - GUI スレッドはブロックしない (ロード完了は onWhisperInitialized() で受け取る)
+//   - 二回目以降の呼び出しは何もしない
+//------------------------------------------------------------------------------
 void LlamaChatEngine::initVoiceRecognition()
 {
-    // すでに存在しているならクリーンアップする
-    if (m_voiceDetectorThread) {
-        m_voiceDetectorThread->quit();
-        m_voiceDetectorThread->wait();
-        m_voiceDetectorThread->deleteLater();
-        m_voiceDetectorThread = nullptr;
-    }
-
-    if (m_voiceRecognitionThread) {
-        m_voiceRecognitionThread->quit();
-        m_voiceRecognitionThread->wait();
-        m_voiceRecognitionThread->deleteLater();
-        m_voiceRecognitionThread = nullptr;
-    }
-
-    m_voiceDetectorThread = new QThread(this);
-    m_voiceRecognitionThread = new QThread(this);
-
     if (m_voiceRecognitionEngine) {
-        // すでに作ってたら再初期化など
-        delete m_voiceRecognitionEngine;
-        m_voiceRecognitionEngine = nullptr;
+        return;
+    }
+#ifdef Q_OS_ANDROID
+    if (!mWhisperModelReady) {
+        qWarning() << "[initVoiceRecognition] Whisper model is not downloaded yet.";
+        return;
     }
-    m_voiceRecognitionEngine = new VoiceRecognitionEngine(this);
+#endif
 
     // Whisper設定
     VoiceRecParams vrParams;
@@ -833,71 +1138,123 @@ void LlamaChatEngine::initVoiceRecognition()
     vrParams.length_for_inference_ms  = 10000;  // 10秒取りたい
     vrParams.vad_thold  = 0.6f;
     vrParams.freq_thold = 100.0f;
+#if !defined(Q_OS_ANDROID) && defined(WHISPER_DRAFT_MODEL_NAME)
+    // 下書き用の軽いモデルが指定されていれば2パス認識にする
+    vrParams.draft_model = WHISPER_DRAFT_MODEL_NAME;
+#endif
     // ... GPU設定など
 
-    const bool ok = m_voiceRecognitionEngine->initWhisper(vrParams);
-    if (!ok) {
-        qWarning() << "Failed to init VoiceRecognitionEngine";
-        return;
-    }
+    m_voiceRecognitionThread = new QThread(this);
+    m_voiceRecognitionEngine = new VoiceRecognitionEngine();
+    m_voiceRecognitionEngine->moveToThread(m_voiceRecognitionThread);
+    connect(m_voiceRecognitionThread, &QThread::finished,
+            m_voiceRecognitionEngine, &QObject::deleteLater);
 
     // シグナル接続: 音声認識結果 -> handleRecognizedText()
-    connect(m_voiceRecognitionEngine, &VoiceRecognitionEngine::textRecognized,
+    connect(m_voiceRecognitionEngine, &VoiceRecognitionEngine::finalTextRecognized,
             this, &LlamaChatEngine::handleRecognizedText);
+    // 発話中の途中結果 -> interimVoiceText
+    connect(m_voiceRecognitionEngine, &VoiceRecognitionEngine::interimTextRecognized,
+            this, &LlamaChatEngine::handleInterimRecognizedText);
     // whisperが検知した言語が変わったらdetectedVoiceLocaleにセット
     connect(m_voiceRecognitionEngine, &VoiceRecognitionEngine::detectedVoiceLocaleChanged,
             this, &LlamaChatEngine::setDetectedVoiceLocale);
     // オペレーションのフェーズ遷移シグナルの接続
     connect(m_voiceRecognitionEngine, &VoiceRecognitionEngine::changeOperationPhaseTo,
             this, &LlamaChatEngine::setOperationPhase);
+    // whisper のロード完了通知
+    connect(m_voiceRecognitionEngine, &VoiceRecognitionEngine::whisperInitialized,
+            this, &LlamaChatEngine::onWhisperInitialized);
+    // 2パス認識の清書結果 (バックグラウンドスレッドから届く)
+    connect(m_voiceRecognitionEngine, &VoiceRecognitionEngine::transcriptRefined,
+            this, &LlamaChatEngine::onTranscriptRefined);
+    // 読み上げ中にユーザーが話し始めた
+    connect(m_voiceRecognitionEngine, &VoiceRecognitionEngine::bargeInDetected,
+            this, &LlamaChatEngine::onBargeInDetected);
 
-    if (!m_voiceDetector) {
-        m_voiceDetector = new VoiceDetector(vrParams.length_for_inference_ms, this);
-        // VoiceDetectorが音声を取得したら voiceEngine->addAudio(...) へ渡す
-        connect(m_voiceDetector, &VoiceDetector::audioAvailable,
-                m_voiceRecognitionEngine, &VoiceRecognitionEngine::addAudio);
-        // オペレーションのフェーズ遷移シングナルの接続
-        connect(m_voiceDetector, &VoiceDetector::changeOperationPhaseTo,
-                this, &LlamaChatEngine::setOperationPhase);
-        // VoiceDetectorの初期化 (例: init(16kHz), start capturing, etc.)
-        m_voiceDetector->init(/*sampleRate=*/COMMON_SAMPLE_RATE, /*channelCount=*/1);
-    }
+    m_voiceDetectorThread = new QThread(this);
+    m_voiceDetector = new VoiceDetector(vrParams.length_for_inference_ms);
+    m_voiceDetector->moveToThread(m_voiceDetectorThread);
+    connect(m_voiceDetectorThread, &QThread::finished,
+            m_voiceDetector, &QObject::deleteLater);
+    // VoiceDetector が変換済みサンプルを書き込むリングバッファを音声認識エンジンと共有し、
+    // 書き込みの通知で voiceEngine->processAvailableAudio() が読み出す
+    m_voiceRecognitionEngine->setAudioBuffer(m_voiceDetector->audioBuffer());
+    connect(m_voiceDetector, &VoiceDetector::audioAvailable,
+            m_voiceRecognitionEngine, &VoiceRecognitionEngine::processAvailableAudio);
+    // オペレーションのフェーズ遷移シングナルの接続
+    connect(m_voiceDetector, &VoiceDetector::changeOperationPhaseTo,
+            this, &LlamaChatEngine::setOperationPhase);
+
+    m_voiceRecognitionThread->start();
+    m_voiceDetectorThread->start();
+
+    // 重い初期化はそれぞれのスレッド上で実行する
+    VoiceRecognitionEngine *engine = m_voiceRecognitionEngine;
+    QMetaObject::invokeMethod(engine, [engine, vrParams] {
+        engine->initWhisper(vrParams);
+    }, Qt::QueuedConnection);
+
+    // VoiceDetector (マイク) の初期化は最初の開始時まで遅らせる。
+    // 起動直後にマイクを開いてしまわないように
 }
 
-void LlamaChatEngine::startVoiceRecognition()
+//------------------------------------------------------------------------------
+// onWhisperInitialized
+// whisper のロード完了。開始要求が保留されていればここで開始する
+//------------------------------------------------------------------------------
+void LlamaChatEngine::onWhisperInitialized(bool success)
 {
-    if (!m_voiceRecognitionEngine) {
-        initVoiceRecognition();
+    m_whisperReady = success;
+    if (!success) {
+        qWarning() << "Failed to init VoiceRecognitionEngine";
+        // 次に音声認識を有効にしたときにロードし直せるよう、エンジンとスレッドを破棄する
+        shutdownVoiceRecognition();
+        if (m_voiceStartPending || m_voiceRecognitionEnabled) {
+            // ユーザーが音声認識を有効にしていた (起動時の先読みだけなら知らせない)
+            m_voiceStartPending = false;
+            m_voiceRecognitionEnabled = false;
+            setOperationPhase(WaitingUserInput);
+            emit voiceRecognitionInitFailed();
+        }
+        return;
     }
-    if (m_voiceDetector && !m_voiceRecognitionEngine->isRunning()) {
-        m_voiceDetector->setParent(nullptr);
-        m_voiceDetector->moveToThread(m_voiceDetectorThread);
-        connect(m_voiceDetectorThread, &QThread::finished,
-                m_voiceDetector, &QObject::deleteLater);
-        m_voiceDetectorThread->start();
-        // VoiceDetectorスタート
-        QMetaObject::invokeMethod(
-            m_voiceDetector,
-            "resume",
-            Qt::QueuedConnection
-            );
+    if (m_voiceStartPending) {
+        m_voiceStartPending = false;
+        startVoiceRecognition();
+    }
+}
 
-        m_voiceRecognitionEngine->setParent(nullptr);
-        m_voiceRecognitionEngine->moveToThread(m_voiceRecognitionThread);
-        connect(m_voiceRecognitionThread, &QThread::finished,
-                m_voiceRecognitionEngine, &QObject::deleteLater);
-        m_voiceRecognitionThread->start();
-        // VoiceRecognitionEngineスタート
-        QMetaObject::invokeMethod(
-            m_voiceRecognitionEngine,
-            "start",
-            Qt::QueuedConnection
-            );
+void LlamaChatEngine::startVoiceRecognition()
+{
+    if (!m_voiceRecognitionEngine || !m_whisperReady) {
+        // ロード中 (またはロード待ち)。完了時に onWhisperInitialized() から開始する
+        m_voiceStartPending = true;
+        return;
     }
+    // VoiceDetectorスタート (初回のみデバイスを開く)
+    VoiceDetector *detector = m_voiceDetector;
+    QMetaObject::invokeMethod(detector, [detector] {
+        if (!detector->isInitialized()) {
+            // VoiceDetectorの初期化 (例: init(16kHz), start capturing, etc.)
+            detector->init(/*sampleRate=*/COMMON_SAMPLE_RATE, /*channelCount=*/1);
+        }
+        detector->resume();
+    }, Qt::QueuedConnection);
+    // VoiceRecognitionEngineスタート
+    QMetaObject::invokeMethod(
+        m_voiceRecognitionEngine,
+        "start",
+        Qt::QueuedConnection
+        );
 }
 
 void LlamaChatEngine::stopVoiceRecognition()
 {
+    m_voiceRecognitionEnabled = false;
+    m_voiceStartPending = false;
+    m_echoGuardActive = false;
+    m_voicePausedForSpeech = false;
     if (m_voiceDetector) {
         QMetaObject::invokeMethod(
             m_voiceDetector,
@@ -912,9 +1269,32 @@ void LlamaChatEngine::stopVoiceRecognition()
             Qt::QueuedConnection
             );
     }
+    handleInterimRecognizedText(QString());
     setOperationPhase(WaitingUserInput);
 }
 
+//------------------------------------------------------------------------------
+// shutdownVoiceRecognition
+// スレッドを終了させる (各オブジェクトは finished -> deleteLater で自スレッド上で解放)
+//------------------------------------------------------------------------------
+void LlamaChatEngine::shutdownVoiceRecognition()
+{
+    if (m_voiceDetectorThread) {
+        m_voiceDetectorThread->quit();
+        m_voiceDetectorThread->wait();
+        m_voiceDetectorThread->deleteLater();
+        m_voiceDetectorThread = nullptr;
+        m_voiceDetector = nullptr;
+    }
+    if (m_voiceRecognitionThread) {
+        m_voiceRecognitionThread->quit();
+        m_voiceRecognitionThread->wait();
+        m_voiceRecognitionThread->deleteLater();
+        m_voiceRecognitionThread = nullptr;
+        m_voiceRecognitionEngine = nullptr;
+    }
+}
+
 
 bool LlamaChatEngine::whisperModelDownloadInProgress() const
 {
@@ -929,6 +1309,20 @@ void LlamaChatEngine::setWhisperModelDownloadInProgress(bool newWhisperModelDown
     emit whisperModelDownloadInProgressChanged();
 }
 
+bool LlamaChatEngine::bargeInEnabled() const
+{
+    return m_bargeInEnabled;
+}
+
+void LlamaChatEngine::setBargeInEnabled(bool newBargeInEnabled)
+{
+    if (m_bargeInEnabled == newBargeInEnabled)
+        return;
+    // 読み上げ中に切り替えた場合は次の読み上げから反映する
+    m_bargeInEnabled = newBargeInEnabled;
+    emit bargeInEnabledChanged();
+}
+
 double LlamaChatEngine::whisperModelDownloadProgress() const
 {
     return mWhisperModelDownloadProgress;
@@ -957,6 +1351,7 @@ void LlamaChatEngine::setOperationPhase(OperationPhase newOperationPhase)
     }
 
     m_operationPhase = newOperationPhase;
+    ComputeBudgetArbiter::instance().setPhase(m_operationPhase);
     emit operationPhaseChanged();
 }
 
@@ -975,11 +1370,80 @@ QLocale LlamaChatEngine::detectedVoiceLocale() const
 
 void LlamaChatEngine::handleRecognizedText(const QString &text)
 {
+    handleInterimRecognizedText(QString());
+    mPendingVoiceDraft = text;
     // LlamaChatEngineの setUserInput を呼ぶ例
     qDebug() << "[LlamaChatEngine] recognized text => setUserInput:" << text;
     setUserInput(text);
 }
 
+void LlamaChatEngine::handleInterimRecognizedText(const QString &text)
+{
+    if (m_interimVoiceText == text)
+        return;
+    m_interimVoiceText = text;
+    emit interimVoiceTextChanged();
+    requestSpeculativePrefill(text);
+}
+
+//------------------------------------------------------------------------------
+// setDraftInput
+// 入力欄で入力中のテキスト (QML 側で入力が止まってから呼ばれる)。送信前に先読みプリフィルする
+//------------------------------------------------------------------------------
+void LlamaChatEngine::setDraftInput(const QString &draftText)
+{
+    // 送信されるのと同じテキストで先読みする (空白の違いでトークンがずれないように)
+    if (draftText.trimmed().isEmpty()) {
+        mDraftInput.clear();
+        return;
+    }
+    // 応答の生成中は覚えておくだけ (生成が終わったら endLocalGeneration() で先読みする)
+    mDraftInput = draftText;
+    requestSpeculativePrefill(draftText);
+}
+
+//------------------------------------------------------------------------------
+// requestSpeculativePrefill
+// 話している途中の認識結果や入力中のテキストをユーザー発話として、ローカル LLM に
+// 次のターンのプロンプトを先にデコードさせる
+// (送信・確定したら、一致するトークンの後ろだけがデコードされる)
+//------------------------------------------------------------------------------
+void LlamaChatEngine::requestSpeculativePrefill(const QString &userText)
+{
+    if (mCurrentEngineMode != Mode_Local || !mLocalGenerator) {
+        return;
+    }
+    if (userText.isEmpty() || userText == mPrefilledUserText) {
+        return;
+    }
+    if (mInProgress || mPendingLocalGenerations > 0) {
+        // The prefill would run after generate() on a history without the reply
+        // 生成中の履歴で先読みすると、生成の後に (応答を含まない) 古い履歴でデコードしてしまう
+        return;
+    }
+    mPrefilledUserText = userText;
+
+    QList<LlamaChatMessage> messages = mChatHistory;
+    LlamaChatMessage msg;
+    msg.setRole(QStringLiteral("user"));
+    msg.setContent(userText);
+    messages.append(msg);
+
+    // Only the newest interim text / draft is worth prefilling
+    // 先読みするのは最新の途中結果・入力中のテキストだけ
+    const int epoch = ++mPrefillEpoch;
+    mLocalGenerator->supersedePrefill(epoch - 1);
+    LlamaResponseGenerator *generator = mLocalGenerator;
+    QMetaObject::invokeMethod(generator, [generator, messages, epoch] {
+        generator->prefill(messages, epoch);
+    }, Qt::QueuedConnection);
+}
+
+QString LlamaChatEngine::interimVoiceText() const
+{
+    return m_interimVoiceText;
+}
+
 //------------------------------------------------------------------------------
 // modelDownloadInProgress Getter/Setter
 //------------------------------------------------------------------------------
@@ -1091,6 +1555,11 @@ ChatMessageModel* LlamaChatEngine::messages()
     return &mMessages;
 }
 
+SpeechOutputStage* LlamaChatEngine::speechOutput()
+{
+    return &mSpeechOutput;
+}
+
 //------------------------------------------------------------------------------
 // ipAddress Getter/Setter
 //------------------------------------------------------------------------------
@@ -14,6 +14,7 @@
 #include "VoiceDetector.h"
 #include "VoiceRecognitionEngine.h"
 #include "OperationPhase.h"
+#include "SpeechOutputStage.h"
 #include "llama.h"
 
 /*
@@ -37,6 +38,7 @@ class LlamaChatEngine : public QObject
     // QML Properties (QMLプロパティ)
     //--------------------------------------------------------------------------
     Q_PROPERTY(ChatMessageModel* messages READ messages CONSTANT)
+    Q_PROPERTY(SpeechOutputStage* speechOutput READ speechOutput CONSTANT)
     Q_PROPERTY(QString userInput READ userInput WRITE setUserInput RESET resetUserInput NOTIFY userInputChanged FINAL)
     Q_PROPERTY(EngineMode currentEngineMode READ currentEngineMode NOTIFY currentEngineModeChanged FINAL)
     Q_PROPERTY(QString ipAddress READ ipAddress WRITE setIpAddress NOTIFY ipAddressChanged FINAL)
@@ -50,8 +52,10 @@ class LlamaChatEngine : public QObject
     Q_PROPERTY(bool modelDownloadInProgress READ modelDownloadInProgress NOTIFY modelDownloadInProgressChanged FINAL)
     Q_PROPERTY(QLocale detectedVoiceLocale READ detectedVoiceLocale NOTIFY detectedVoiceLocaleChanged FINAL)
     Q_PROPERTY(OperationPhase operationPhase READ operationPhase WRITE setOperationPhase NOTIFY operationPhaseChanged FINAL)
+    Q_PROPERTY(QString interimVoiceText READ interimVoiceText NOTIFY interimVoiceTextChanged FINAL)
     Q_PROPERTY(double whisperModelDownloadProgress READ whisperModelDownloadProgress NOTIFY whisperModelDownloadProgressChanged FINAL)
     Q_PROPERTY(bool whisperModelDownloadInProgress READ whisperModelDownloadInProgress NOTIFY whisperModelDownloadInProgressChanged FINAL)
+    Q_PROPERTY(bool bargeInEnabled READ bargeInEnabled WRITE setBargeInEnabled NOTIFY bargeInEnabledChanged FINAL)
 
 public:
     //--------------------------------------------------------------------------
@@ -85,11 +89,13 @@ public:
     Q_INVOKABLE void setVoiceRecognitionLanguage(const QString &language);
     Q_INVOKABLE void initiateVoiceRecognition();
     Q_INVOKABLE void stopVoiceRecognition();
+    Q_INVOKABLE void setDraftInput(const QString &draftText);
 
     //--------------------------------------------------------------------------
     // QML-Exposed Getters / Setters (QMLに公開されるゲッター/セッター)
     //--------------------------------------------------------------------------
     ChatMessageModel* messages();
+    SpeechOutputStage* speechOutput();
 
     QString userInput() const;
     Q_INVOKABLE void setUserInput(const QString &newUserInput);
@@ -131,12 +137,17 @@ public:
     OperationPhase operationPhase() const;
     void setOperationPhase(OperationPhase newOperationPhase);
 
+    QString interimVoiceText() const;
+
     double whisperModelDownloadProgress() const;
     void setWhisperModelDownloadProgress(double newWhisperModelDownloadProgress);
 
     bool whisperModelDownloadInProgress() const;
     void setWhisperModelDownloadInProgress(bool newWhisperModelDownloadInProgress);
 
+    bool bargeInEnabled() const;
+    void setBargeInEnabled(bool newBargeInEnabled);
+
 signals:
     //--------------------------------------------------------------------------
     // Signals (シグナル)
@@ -154,6 +165,7 @@ signals:
     void modelDownloadInProgressChanged();
     void detectedVoiceLocaleChanged();
     void operationPhaseChanged();
+    void interimVoiceTextChanged();
     void requestGeneration(const QList<LlamaChatMessage>& messages);
     void generationFinishedToQML(const QString& finalResponse);
     void inferenceErrorToQML(const QString &errorMessage);
@@ -161,6 +173,8 @@ signals:
     void whisperModelDownloadFinished(bool success);
     void whisperModelDownloadProgressChanged();
     void whisperModelDownloadInProgressChanged();
+    void bargeInEnabledChanged();
+    void voiceRecognitionInitFailed();   // whisper could not be loaded (retried on the next enable)
 
 private slots:
     //--------------------------------------------------------------------------
@@ -170,10 +184,17 @@ private slots:
     void initAfterDownload(bool success);
     void reinitLocalEngine();
     void handleRecognizedText(const QString &text);
+    void handleInterimRecognizedText(const QString &text);
+    void onTranscriptRefined(const QString &draftText, const QString &refinedText);
+    void onWhisperInitialized(bool success);
     void handleNewUserInput();
     void onPartialResponse(const QString &textSoFar);
     void onGenerationFinished(const QString &finalResponse);
+    void onGenerationCancelled();
     void onInferenceError(const QString &errorMessage);
+    void onSpeechOutputStarted();
+    void onSpeechOutputFinished();
+    void onBargeInDetected();
 
 private:
     //--------------------------------------------------------------------------
@@ -190,8 +211,14 @@ private:
     void downloadModelIfNeededAsync();
     void setCurrentEngineMode(EngineMode newCurrentEngineMode);
 
+    void emitGenerationRequest();
+    void requestSpeculativePrefill(const QString &userText);
+    void endLocalGeneration();
+    void submitQueuedVoiceInput();
+
     void initVoiceRecognition();
     void startVoiceRecognition();
+    void shutdownVoiceRecognition();
 
     //--------------------------------------------------------------------------
     // Constants (定数)
@@ -248,6 +275,24 @@ private:
     //--------------------------------------------------------------------------
     QString          mUserInput;
     ChatMessageModel mMessages;
+    SpeechOutputStage mSpeechOutput;              // Speaks replies sentence by sentence while generating
+    QList<LlamaChatMessage> mChatHistory;          // Messages sent to the generator (生成器に渡す履歴)
+
+    // Latest turn, so a two-pass voice transcript can replace it
+    // 最新ターンの情報 (2パス音声認識の清書で差し替えるため)
+    int     mLocalGenerationCount {0};    // generate() requests sent to mLocalGenerator
+    int     mLastTurnGeneration   {0};    // Generation index of the latest turn (local only)
+    int     mLastUserMessageIndex {-1};   // Row of the latest user message in mMessages
+    int     mLastUserHistoryIndex {-1};   // Index of the latest user message in mChatHistory
+    QString mPendingVoiceDraft;           // Recognized text about to be set as user input
+    QString mLastTurnVoiceDraft;          // Draft transcript of the latest turn (empty if typed)
+    QString mQueuedVoiceInput;            // Utterance recognized while a reply was running (sent when it ends)
+    bool    mHoldQueuedVoiceInput {false}; // Don't send mQueuedVoiceInput (a turn is being replaced)
+    int     mPrefillEpoch {0};            // Speculative prefill requests sent to mLocalGenerator
+    QString mPrefilledUserText;           // User text (interim transcript / draft) of the latest speculative prefill
+    int     mPendingLocalGenerations {0}; // generate() requests not yet finished / cancelled (no prefill meanwhile)
+    int     mStaleLocalGenerations {0};   // Of those, draft turns replaced by a refined transcript (signals ignored)
+    QString mDraftInput;                  // Text being typed in the input field (prefilled once the reply is done)
 
     //--------------------------------------------------------------------------
     // Initialization status (初期化状態)
@@ -275,6 +320,7 @@ private:
     std::optional<QMetaObject::Connection> mRemoteGenerationFinishedToQMLConnection;
     std::optional<QMetaObject::Connection> mRemoteGenerationErrorConnection;
     std::optional<QMetaObject::Connection> mRemoteGenerationErrorToQmlConnection;
+    std::optional<QMetaObject::Connection> mRemoteGenerationCancelledConnection;
 
     // local
     std::optional<QMetaObject::Connection> mLocalRequestGenerationConnection;
@@ -283,12 +329,23 @@ private:
     std::optional<QMetaObject::Connection> mLocalGenerationFinishedToQMLConnection;
     std::optional<QMetaObject::Connection> mLocalGenerationErrorConnection;
     std::optional<QMetaObject::Connection> mLocalGenerationErrorToQmlConnection;
+    std::optional<QMetaObject::Connection> mLocalGenerationCancelledConnection;
 
+    // 音声認識関連のオブジェクトは一度だけ生成し、それぞれ専用スレッドで生かし続ける
+    // (whisper のモデルロードは数秒かかるため、マイクボタン押下のたびに作り直さない)
     VoiceRecognitionEngine* m_voiceRecognitionEngine = nullptr;
     VoiceDetector*          m_voiceDetector = nullptr;
     QLocale                 m_detectedVoiceLocale;
-    QThread*                m_voiceRecognitionThread;
-    QThread*                m_voiceDetectorThread;
+    QThread*                m_voiceRecognitionThread = nullptr;
+    QThread*                m_voiceDetectorThread = nullptr;
+    bool                    m_whisperReady = false;       // whisper コンテキストのロード完了
+    bool                    m_voiceStartPending = false;  // ロード完了後に認識を開始する
+    bool                    m_voiceRecognitionEnabled = false; // ユーザーが音声入力を有効にしている
+    bool                    m_bargeInEnabled = false;     // 読み上げ中もマイクを止めず、話しかけたら中断する
+    bool                    m_echoGuardActive = false;    // 読み上げ中で、VAD がエコーガード中
+    bool                    m_voicePausedForSpeech = false; // 読み上げのためにマイクを止めている
+
+    QString                 m_interimVoiceText;          // 発話中の途中認識結果 (発話終了でクリア)
 
     OperationPhase          m_operationPhase = WaitingUserInput;
 
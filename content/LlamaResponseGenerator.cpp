@@ -1,5 +1,6 @@
 #include "LlamaResponseGenerator.h"
 #include <QDebug>
+#include <algorithm>
 
 /*
   Constructor:
@@ -16,6 +17,7 @@ LlamaResponseGenerator::LlamaResponseGenerator(QObject* parent,
     : QObject(parent)
     , m_model(model)
     , m_ctx(ctx)
+    , m_formatted(ctx ? llama_n_ctx(ctx) : 0)
 {
 }
 
@@ -55,65 +57,47 @@ void LlamaResponseGenerator::generate(const QList<LlamaChatMessage>& messages)
 
     qDebug() << "[LlamaResponseGenerator::generate] messages.size() =" << messages.size();
 
-    // Use static buffers to hold formatted text and track previous length
-    // フォーマット済みテキストや前回長さをstaticで保持
-    static std::vector<char> formattedVec(llama_n_ctx(m_ctx));
-    static int prevLen {0};
+    // Remember where this turn starts so it can be cancelled / rolled back.
+    // A speculative prefill for this turn (if any) starts at the same place.
+    // このターンの開始位置を記録 (中断・巻き戻し用)
+    // 先読みプリフィル済みなら、その開始位置がこのターンの開始位置になる
+    const int generationIndex = ++m_generationIndex;
+    m_turnGenerationIndex = generationIndex;
+    m_turnPrevLen         = m_prevLen;
+    m_turnStartPos        = m_prefillTokens.empty() ? llama_kv_cache_seq_pos_max(m_ctx, 0) + 1
+                                                    : m_prefillStartPos;
+    m_turnRolledBack      = false;
+
+    if (isCancelled(generationIndex)) {
+        rollbackTurn();
+        emit generationCancelled();
+        return;
+    }
 
     // Convert QList<LlamaChatMessage> → std::vector<llama_chat_message>
     std::vector<llama_chat_message> llamaMsgs = toLlamaMessages(messages);
 
-    // Apply chat template to generate prompt
-    // チャットテンプレートを適用してプロンプト生成
-    int newLen = llama_chat_apply_template(m_model,
-                                           nullptr,
-                                           llamaMsgs.data(),
-                                           llamaMsgs.size(),
-                                           true,
-                                           formattedVec.data(),
-                                           formattedVec.size());
-    if (newLen > static_cast<int>(formattedVec.size())) {
-        // Resize if needed
-        formattedVec.resize(newLen);
-        newLen = llama_chat_apply_template(m_model,
-                                           nullptr,
-                                           llamaMsgs.data(),
-                                           llamaMsgs.size(),
-                                           true,
-                                           formattedVec.data(),
-                                           formattedVec.size());
-    }
-    if (newLen < 0) {
-        fprintf(stderr, "[LlamaResponseGenerator] Failed to apply chat template.\n");
+    // Tokens of the newly added portion of the prompt
+    // プロンプトのうち新たに追加された部分のトークン
+    std::vector<llama_token> promptTokens;
+    if (!tokenizeTurnPrompt(llamaMsgs, m_turnStartPos == 0, promptTokens)) {
+        emit generationError("failed to tokenize the prompt");
         return;
     }
 
-    // Extract newly added portion of prompt
-    // 新たに追加されたプロンプト部分を抜き出す
-    std::string promptStd(formattedVec.begin() + prevLen,
-                          formattedVec.begin() + newLen);
+    // Keep the speculatively prefilled tokens that match; decode only the rest.
+    // At least the last token is decoded again to get logits for sampling.
+    // 先読みで入れたトークンのうち一致する部分はそのまま使い、残りだけデコードする
+    // (サンプリング用のロジットを得るため、最後の1トークンは必ずデコードし直す)
+    const size_t reused = keepPrefilledPrefix(promptTokens, promptTokens.size() - 1);
+    m_prefillTokens.clear();
+    if (reused > 0) {
+        qDebug() << "[LlamaResponseGenerator] Reusing" << reused << "of" << promptTokens.size()
+                 << "prompt tokens from speculative prefill.";
+    }
+    promptTokens.erase(promptTokens.begin(), promptTokens.begin() + reused);
 
     std::string response;
-    const int nPromptTokens = -llama_tokenize(m_model,
-                                              promptStd.c_str(),
-                                              promptStd.size(),
-                                              nullptr,
-                                              0,
-                                              true,  // is_prefix
-                                              true); // is_bos
-
-    // Allocate space for tokens
-    // トークンを格納
-    std::vector<llama_token> promptTokens(nPromptTokens);
-    if (llama_tokenize(m_model,
-                       promptStd.c_str(),
-                       promptStd.size(),
-                       promptTokens.data(),
-                       promptTokens.size(),
-                       llama_get_kv_cache_used_cells(m_ctx) == 0,
-                       true) < 0) {
-        emit generationError("failed to tokenize the prompt");
-    }
 
     // Prepare single batch for decoding
     llama_batch batch = llama_batch_get_one(promptTokens.data(), promptTokens.size());
@@ -122,10 +106,18 @@ void LlamaResponseGenerator::generate(const QList<LlamaChatMessage>& messages)
     static constexpr int maxReplyTokens    = 1024;
     static constexpr int extraCutoffTokens = 32;
     int generatedTokenCount = 0;
+    bool cancelled = false;
 
     // Decode tokens until end-of-generation
     // 終了トークンに達するまでデコードし続ける
     while (true) {
+        if (isCancelled(generationIndex)) {
+            cancelled = true;
+            break;
+        }
+        // Yield cores to whisper while speech is being processed (checked per token)
+        // 音声処理中は whisper にコアを譲る (トークンごとに確認)
+        applyThreadBudget();
         if (llama_decode(m_ctx, batch)) {
             emit generationError("failed to decode");
             break;
@@ -166,15 +158,24 @@ void LlamaResponseGenerator::generate(const QList<LlamaChatMessage>& messages)
         }
     }
 
-    // Update prevLen for next call
-    prevLen = llama_chat_apply_template(m_model,
+    if (cancelled) {
+        // Drop this turn from the KV cache; m_prevLen stays at the previous turn
+        // このターンを KV キャッシュから取り除く (m_prevLen は前のターンのまま)
+        qDebug() << "[LlamaResponseGenerator] Generation" << generationIndex << "cancelled.";
+        rollbackTurn();
+        emit generationCancelled();
+        return;
+    }
+
+    // Update m_prevLen for next call
+    m_prevLen = llama_chat_apply_template(m_model,
                                         nullptr,
                                         llamaMsgs.data(),
                                         llamaMsgs.size(),
                                         false,
                                         nullptr,
                                         0);
-    if (prevLen < 0) {
+    if (m_prevLen < 0) {
         fprintf(stderr, "[LlamaResponseGenerator] Failed to apply chat template.\n");
     }
 
@@ -182,6 +183,247 @@ void LlamaResponseGenerator::generate(const QList<LlamaChatMessage>& messages)
     emit generationFinished(QString::fromStdString(response));
 }
 
+/*
+  cancelGeneration(...) / rollbackGeneration(...):
+    - cancelGeneration() only raises an atomic watermark, so it can be called
+      from the GUI thread while generate() is running
+    - rollbackGeneration() runs on the worker thread (queued) and undoes a
+      finished turn
+
+  cancelGeneration(...) / rollbackGeneration(...):
+    - cancelGeneration() は atomic の値を上げるだけなので、generate() 実行中に
+      GUI スレッドから呼んでよい
+    - rollbackGeneration() はワーカースレッド上で (キュー経由で) 実行し、完了済みターンを取り消す
+*/
+void LlamaResponseGenerator::cancelGeneration(int generationIndex)
+{
+    int current = m_cancelUpTo.load(std::memory_order_relaxed);
+    while (current < generationIndex
+           && !m_cancelUpTo.compare_exchange_weak(current, generationIndex, std::memory_order_relaxed)) {
+    }
+}
+
+void LlamaResponseGenerator::rollbackGeneration(int generationIndex)
+{
+    if (generationIndex != m_turnGenerationIndex || m_turnRolledBack) {
+        return;
+    }
+    qDebug() << "[LlamaResponseGenerator] Rolling back generation" << generationIndex;
+    rollbackTurn();
+}
+
+/*
+  prefill(...) / supersedePrefill(...):
+    - prefill() decodes the prompt of the next turn (with an interim voice
+      transcript or the text being typed as the user message) before
+      generate() is requested, in chunks and with a reduced thread budget.
+      The tokens stay in the KV cache past the last turn; a later prefill or
+      generate() keeps the longest matching token prefix and decodes only the
+      rest, so prefill overlaps with the user still speaking
+    - supersedePrefill() is thread-safe (atomic watermark like
+      cancelGeneration()) and makes queued prefills with epoch <= the given
+      one return without decoding
+
+  prefill(...) / supersedePrefill(...):
+    - prefill() は generate() が要求される前に、次のターンのプロンプト
+      (音声認識の途中結果や入力中のテキストをユーザー発話としたもの) を、
+      少しずつ・少ないスレッド数でデコードしておく。
+      トークンは前のターンの後ろに KV キャッシュとして残り、次の prefill() や
+      generate() は一致するトークンの先頭部分を残して、残りだけをデコードする
+      → ユーザーが話している間にプリフィルが済む
+    - supersedePrefill() はスレッドセーフ (cancelGeneration() と同じく atomic の値を上げるだけ)。
+      キューに残っている epoch が指定値以下の prefill() はデコードせずに戻る
+*/
+void LlamaResponseGenerator::prefill(const QList<LlamaChatMessage>& messages, int epoch)
+{
+    if (isPrefillSuperseded(epoch)) {
+        return;
+    }
+    if (m_prefillTokens.empty()) {
+        m_prefillStartPos = llama_kv_cache_seq_pos_max(m_ctx, 0) + 1;
+    }
+
+    std::vector<llama_chat_message> llamaMsgs = toLlamaMessages(messages);
+    std::vector<llama_token> promptTokens;
+    if (!tokenizeTurnPrompt(llamaMsgs, m_prefillStartPos == 0, promptTokens)) {
+        return;
+    }
+
+    // Decode in chunks so a newer draft or the real request does not wait
+    // for a long stale prompt
+    // 古くなった長いプロンプトで新しい要求を待たせないよう、少しずつデコードする
+    static constexpr size_t prefillChunkTokens = 64;
+    for (size_t pos = keepPrefilledPrefix(promptTokens, promptTokens.size());
+         pos < promptTokens.size(); pos += prefillChunkTokens) {
+        if (isPrefillSuperseded(epoch)) {
+            return;
+        }
+        const size_t count = std::min(prefillChunkTokens, promptTokens.size() - pos);
+        applyThreadBudget(ComputeBudgetArbiter::LlmSpeculativePrefill);
+        llama_batch batch = llama_batch_get_one(promptTokens.data() + pos, static_cast<int32_t>(count));
+        if (llama_decode(m_ctx, batch)) {
+            // Drop the partial prefill; generate() decodes the prompt from scratch
+            // 途中まで入ったトークンは捨てる (generate() が最初からデコードする)
+            qWarning() << "[LlamaResponseGenerator] Speculative prefill failed to decode.";
+            llama_kv_cache_seq_rm(m_ctx, 0, m_prefillStartPos, -1);
+            m_prefillTokens.clear();
+            return;
+        }
+        m_prefillTokens.insert(m_prefillTokens.end(), promptTokens.begin() + pos, promptTokens.begin() + pos + count);
+    }
+}
+
+void LlamaResponseGenerator::supersedePrefill(int epoch)
+{
+    int current = m_prefillSupersededUpTo.load(std::memory_order_relaxed);
+    while (current < epoch
+           && !m_prefillSupersededUpTo.compare_exchange_weak(current, epoch, std::memory_order_relaxed)) {
+    }
+}
+
+bool LlamaResponseGenerator::isPrefillSuperseded(int epoch) const
+{
+    return m_prefillSupersededUpTo.load(std::memory_order_relaxed) >= epoch;
+}
+
+/*
+  keepPrefilledPrefix(...):
+    - Keeps at most maxKeep leading tokens of the speculative prefill that
+      match promptTokens and removes the rest from the KV cache
+    - Returns the number of tokens kept
+
+  keepPrefilledPrefix(...):
+    - 先読みプリフィルのトークンのうち promptTokens と先頭から一致する部分 (最大 maxKeep) を残し、
+      残りを KV キャッシュから取り除く
+    - 残したトークン数を返す
+*/
+size_t LlamaResponseGenerator::keepPrefilledPrefix(const std::vector<llama_token> &promptTokens,
+                                                   size_t maxKeep)
+{
+    const size_t limit = std::min({m_prefillTokens.size(), promptTokens.size(), maxKeep});
+    size_t kept = 0;
+    while (kept < limit && m_prefillTokens[kept] == promptTokens[kept]) {
+        ++kept;
+    }
+    if (kept < m_prefillTokens.size()) {
+        llama_kv_cache_seq_rm(m_ctx, 0, m_prefillStartPos + static_cast<llama_pos>(kept), -1);
+        m_prefillTokens.resize(kept);
+    }
+    return kept;
+}
+
+/*
+  tokenizeTurnPrompt(...):
+    - Applies the chat template (with the assistant prefix) and tokenizes the
+      part after m_prevLen, i.e. what the next turn adds to the KV cache
+    - addSpecial: add BOS etc. (only when the KV cache is empty)
+
+  tokenizeTurnPrompt(...):
+    - チャットテンプレートを (アシスタントの書き出し付きで) 適用し、m_prevLen より後ろ、
+      つまり次のターンで KV キャッシュに追加する部分をトークン化する
+    - addSpecial: BOS などを付ける (KV キャッシュが空のときだけ)
+*/
+bool LlamaResponseGenerator::tokenizeTurnPrompt(const std::vector<llama_chat_message> &llamaMsgs,
+                                                bool addSpecial,
+                                                std::vector<llama_token> &tokens)
+{
+    // Apply chat template to generate prompt
+    // チャットテンプレートを適用してプロンプト生成
+    int newLen = llama_chat_apply_template(m_model,
+                                           nullptr,
+                                           llamaMsgs.data(),
+                                           llamaMsgs.size(),
+                                           true,
+                                           m_formatted.data(),
+                                           m_formatted.size());
+    if (newLen > static_cast<int>(m_formatted.size())) {
+        // Resize if needed
+        m_formatted.resize(newLen);
+        newLen = llama_chat_apply_template(m_model,
+                                           nullptr,
+                                           llamaMsgs.data(),
+                                           llamaMsgs.size(),
+                                           true,
+                                           m_formatted.data(),
+                                           m_formatted.size());
+    }
+    if (newLen < 0) {
+        fprintf(stderr, "[LlamaResponseGenerator] Failed to apply chat template.\n");
+        return false;
+    }
+    if (newLen < m_prevLen) {
+        // The messages do not extend the conversation already in the KV cache
+        // メッセージが KV キャッシュにある会話の続きになっていない
+        fprintf(stderr, "[LlamaResponseGenerator] Prompt is shorter than the previous turns.\n");
+        return false;
+    }
+
+    // Extract newly added portion of prompt
+    // 新たに追加されたプロンプト部分を抜き出す
+    std::string promptStd(m_formatted.begin() + m_prevLen,
+                          m_formatted.begin() + newLen);
+
+    const int nPromptTokens = -llama_tokenize(m_model,
+                                              promptStd.c_str(),
+                                              promptStd.size(),
+                                              nullptr,
+                                              0,
+                                              addSpecial,
+                                              true);
+    tokens.resize(nPromptTokens);
+    if (nPromptTokens <= 0
+        || llama_tokenize(m_model,
+                          promptStd.c_str(),
+                          promptStd.size(),
+                          tokens.data(),
+                          tokens.size(),
+                          addSpecial,
+                          true) < 0) {
+        tokens.clear();
+        return false;
+    }
+    return true;
+}
+
+bool LlamaResponseGenerator::isCancelled(int generationIndex) const
+{
+    return m_cancelUpTo.load(std::memory_order_relaxed) >= generationIndex;
+}
+
+void LlamaResponseGenerator::rollbackTurn()
+{
+    llama_kv_cache_seq_rm(m_ctx, 0, m_turnStartPos, -1);
+    m_prefillTokens.clear();
+    m_prevLen        = m_turnPrevLen;
+    m_turnRolledBack = true;
+}
+
+/*
+  applyThreadBudget():
+    - llama uses n_threads for single-token batches and n_threads_batch for
+      prompt batches, so both are set from the arbiter's decode/prefill split
+      (batchWorkload selects the prompt budget: normal or speculative prefill)
+    - Only calls llama_set_n_threads() when the numbers change
+
+  applyThreadBudget():
+    - llama は1トークンのバッチに n_threads、プロンプトのバッチに n_threads_batch を
+      使うので、調停役のデコード / プリフィル配分をそれぞれに設定する
+      (batchWorkload: 通常のプリフィルか先読みのプリフィルか)
+    - 値が変わったときだけ llama_set_n_threads() を呼ぶ
+*/
+void LlamaResponseGenerator::applyThreadBudget(ComputeBudgetArbiter::Workload batchWorkload)
+{
+    const ComputeBudgetArbiter &arbiter = ComputeBudgetArbiter::instance();
+    const int nThreads      = arbiter.threadsFor(ComputeBudgetArbiter::LlmDecode);
+    const int nThreadsBatch = arbiter.threadsFor(batchWorkload);
+    if (nThreads == m_nThreads && nThreadsBatch == m_nThreadsBatch) {
+        return;
+    }
+    m_nThreads      = nThreads;
+    m_nThreadsBatch = nThreadsBatch;
+    llama_set_n_threads(m_ctx, nThreads, nThreadsBatch);
+}
+
 /*
   toLlamaMessages(...):
     - Helper to convert from QList<LlamaChatMessage> to std::vector<llama_chat_message>
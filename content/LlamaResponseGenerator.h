@@ -3,7 +3,10 @@
 
 #include <QObject>
 #include <QString>
+#include <atomic>
+#include <vector>
 #include "llama.h"
+#include "ComputeBudgetArbiter.h"
 #include "rep_LlamaResponseGenerator_replica.h"
 
 /*
@@ -32,6 +35,23 @@ public:
 
     ~LlamaResponseGenerator() override;
 
+    //--------------------------------------------------------------------------
+    // Thread-safe: stop the generation with the given index (1-based, in the
+    // order generate() calls arrive) and roll back its KV cache. Also works if
+    // that generation has not started yet.
+    // スレッドセーフ: 指定番号 (generate() の到着順, 1始まり) の生成を中断し、
+    // その回の KV キャッシュを巻き戻す。まだ開始していない生成にも効く
+    //--------------------------------------------------------------------------
+    void cancelGeneration(int generationIndex);
+
+    //--------------------------------------------------------------------------
+    // Thread-safe: queued prefill() calls with epoch <= the given one are
+    // skipped (a newer interim transcript or the final one has arrived)
+    // スレッドセーフ: キューに残っている epoch 以下の prefill() を読み飛ばす
+    // (より新しい途中結果、または確定結果が届いた)
+    //--------------------------------------------------------------------------
+    void supersedePrefill(int epoch);
+
 public slots:
     //--------------------------------------------------------------------------
     // Generates text from the provided messages, emits partial/final signals
@@ -39,6 +59,23 @@ public slots:
     //--------------------------------------------------------------------------
     void generate(const QList<LlamaChatMessage>& messages);
 
+    //--------------------------------------------------------------------------
+    // Undo a generation that already finished (prompt + reply in the KV cache),
+    // so the same turn can be issued again with different user text.
+    // No-op unless it is the latest generation and not yet rolled back.
+    // 完了済みの生成 (KV キャッシュ上のプロンプトと応答) を取り消し、
+    // 同じターンをユーザー文を差し替えて再発行できるようにする
+    //--------------------------------------------------------------------------
+    void rollbackGeneration(int generationIndex);
+
+    //--------------------------------------------------------------------------
+    // Speculatively decode the prompt of the next turn (e.g. with an interim
+    // voice transcript) so generate() only has to decode what changed.
+    // 次のターンのプロンプト (音声認識の途中結果など) を先にデコードしておき、
+    // generate() では変わった部分だけをデコードする
+    //--------------------------------------------------------------------------
+    void prefill(const QList<LlamaChatMessage>& messages, int epoch);
+
 signals:
     //--------------------------------------------------------------------------
     // Signals for incremental / final output, or error
@@ -47,6 +84,7 @@ signals:
     void partialResponseReady(const QString &textSoFar);
     void generationFinished(const QString &finalResponse);
     void generationError(const QString &errorMessage);
+    void generationCancelled();
     void initialized();
 
 private:
@@ -56,6 +94,13 @@ private:
     //--------------------------------------------------------------------------
     void initializeSampler();
     std::vector<llama_chat_message> toLlamaMessages(const QList<LlamaChatMessage> &userMessages);
+    bool isCancelled(int generationIndex) const;
+    bool isPrefillSuperseded(int epoch) const;
+    bool tokenizeTurnPrompt(const std::vector<llama_chat_message> &llamaMsgs, bool addSpecial,
+                            std::vector<llama_token> &tokens);
+    size_t keepPrefilledPrefix(const std::vector<llama_token> &promptTokens, size_t maxKeep);
+    void rollbackTurn();
+    void applyThreadBudget(ComputeBudgetArbiter::Workload batchWorkload = ComputeBudgetArbiter::LlmPrefill);
 
     //--------------------------------------------------------------------------
     // Member Variables
@@ -64,6 +109,31 @@ private:
     llama_model*   m_model   {nullptr};  // LLaMA model
     llama_context* m_ctx     {nullptr};  // LLaMA context
     llama_sampler* m_sampler {nullptr};  // LLaMA sampler
+
+    // Formatted chat so far and its length already in the KV cache
+    // フォーマット済みチャットと、そのうち KV キャッシュに入っている長さ
+    std::vector<char> m_formatted;
+    int               m_prevLen {0};
+
+    // Cancellation / rollback of the latest turn
+    // 最新ターンの中断・巻き戻し用
+    int              m_generationIndex {0};      // generate() calls started so far
+    std::atomic<int> m_cancelUpTo {0};           // cancel generations with index <= this
+    int              m_turnGenerationIndex {0};
+    int              m_turnPrevLen {0};
+    llama_pos        m_turnStartPos {0};
+    bool             m_turnRolledBack {true};
+
+    // Speculative prefill of the next turn: tokens decoded after the last turn
+    // 次のターンの先読みプリフィル: 前のターンの後ろにデコード済みのトークン
+    std::vector<llama_token> m_prefillTokens;
+    llama_pos        m_prefillStartPos {0};
+    std::atomic<int> m_prefillSupersededUpTo {0};  // skip prefills with epoch <= this
+
+    // Thread counts last handed to llama (from ComputeBudgetArbiter)
+    // 最後に llama に設定したスレッド数 (ComputeBudgetArbiter の配分)
+    int m_nThreads      {0};
+    int m_nThreadsBatch {0};
 };
 
 #endif // LLAMA_RESPONSE_GENERATOR_H
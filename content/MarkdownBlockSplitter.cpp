@@ -0,0 +1,153 @@
+#include "MarkdownBlockSplitter.h"
+
+namespace {
+// 行頭のインデント (3つまでの空白) を飛ばした位置。4つ以上ならインデントされたコードなので -1
+qsizetype contentStart(QStringView line)
+{
+    qsizetype i = 0;
+    while (i < line.size() && line.at(i) == u' ') {
+        ++i;
+    }
+    return i <= 3 ? i : -1;
+}
+
+// ``` / ~~~ の並び (3つ以上) なら、その文字と長さ
+bool fenceRun(QStringView line, QChar &fenceChar, qsizetype &length)
+{
+    const qsizetype start = contentStart(line);
+    if (start < 0 || start >= line.size()) {
+        return false;
+    }
+    const QChar c = line.at(start);
+    if (c != u'`' && c != u'~') {
+        return false;
+    }
+    qsizetype end = start;
+    while (end < line.size() && line.at(end) == c) {
+        ++end;
+    }
+    if (end - start < 3) {
+        return false;
+    }
+    // ``` の後ろの情報文字列 (言語名) に ` は入らない
+    if (c == u'`' && line.sliced(end).contains(u'`')) {
+        return false;
+    }
+    fenceChar = c;
+    length    = end - start;
+    return true;
+}
+
+bool isBlank(QStringView line)
+{
+    return line.trimmed().isEmpty();
+}
+
+// ATX 見出し ("# ..." 〜 "###### ...")
+bool isHeading(QStringView line)
+{
+    const qsizetype start = contentStart(line);
+    if (start < 0) {
+        return false;
+    }
+    qsizetype end = start;
+    while (end < line.size() && line.at(end) == u'#') {
+        ++end;
+    }
+    const qsizetype level = end - start;
+    return level >= 1 && level <= 6 && (end == line.size() || line.at(end) == u' ' || line.at(end) == u'\t');
+}
+} // namespace
+
+void MarkdownBlockSplitter::update(QStringView textSoFar)
+{
+    if (textSoFar.size() < m_lineStart) {
+        clear();
+    }
+    for (qsizetype newline = textSoFar.indexOf(u'\n', m_lineStart); newline >= 0;
+         newline = textSoFar.indexOf(u'\n', m_lineStart)) {
+        processLine(textSoFar, m_lineStart, newline + 1);
+        m_lineStart = newline + 1;
+    }
+
+    // 確定したときと同じ形にするため、末尾の改行は含めない
+    QStringView open = textSoFar.sliced(m_blockStart);
+    while (open.endsWith(u'\n') || open.endsWith(u'\r')) {
+        open.chop(1);
+    }
+    if (open.trimmed().isEmpty()) {
+        m_open.clear();
+    } else {
+        m_open = open.toString();
+    }
+}
+
+void MarkdownBlockSplitter::clear()
+{
+    m_closed.clear();
+    m_open.clear();
+    m_blockStart  = 0;
+    m_lineStart   = 0;
+    m_inFence     = false;
+    m_fenceChar   = QChar();
+    m_fenceLength = 0;
+}
+
+QStringList MarkdownBlockSplitter::blocks() const
+{
+    QStringList all = m_closed;
+    if (!m_open.isEmpty()) {
+        all << m_open;
+    }
+    return all;
+}
+
+void MarkdownBlockSplitter::processLine(QStringView text, qsizetype lineStart, qsizetype lineEnd)
+{
+    QStringView line = text.sliced(lineStart, lineEnd - lineStart);
+    line.chop(1);   // '\n'
+    if (line.endsWith(u'\r')) {
+        line.chop(1);
+    }
+
+    QChar fenceChar;
+    qsizetype fenceLength = 0;
+    if (m_inFence) {
+        // 開始と同じ文字で、同じ長さ以上の並びだけの行で閉じる
+        if (fenceRun(line, fenceChar, fenceLength) && fenceChar == m_fenceChar
+            && fenceLength >= m_fenceLength && isBlank(line.sliced(contentStart(line) + fenceLength))) {
+            m_inFence = false;
+            closeBlock(text, lineEnd);
+        }
+        return;
+    }
+
+    if (isBlank(line)) {
+        closeBlock(text, lineStart);
+        m_blockStart = lineEnd;
+        return;
+    }
+    if (fenceRun(line, fenceChar, fenceLength)) {
+        closeBlock(text, lineStart);
+        m_inFence     = true;
+        m_fenceChar   = fenceChar;
+        m_fenceLength = fenceLength;
+        return;
+    }
+    if (isHeading(line)) {
+        closeBlock(text, lineStart);
+        closeBlock(text, lineEnd);
+    }
+}
+
+void MarkdownBlockSplitter::closeBlock(QStringView text, qsizetype end)
+{
+    QStringView block = text.sliced(m_blockStart, end - m_blockStart);
+    while (block.endsWith(u'\n') || block.endsWith(u'\r')) {
+        block.chop(1);
+    }
+    if (!isBlank(block)) {
+        m_closed << block.toString();
+    }
+    m_blockStart = end;
+}
@@ -0,0 +1,49 @@
+#ifndef MARKDOWNBLOCKSPLITTER_H
+#define MARKDOWNBLOCKSPLITTER_H
+
+#include <QString>
+#include <QStringList>
+#include <QStringView>
+
+/*
+ * MarkdownBlockSplitter:
+ *   - 生成中の Markdown (先頭からの累積テキスト) を、トップレベルのブロック単位に分ける
+ *   - 確定したブロック (後ろに空行が来た段落・リスト・表、閉じたコードブロック、見出し) は以後変わらない
+ *     → 表示側は確定済みのブロックをそのまま残し、末尾の未確定のブロックだけを解析・レイアウトし直せばよい
+ *   - 改行まで届いた行だけを見るので、1回の update() の処理量は増えた分だけ (全体を解析し直さない)
+ *   - ブロックの区切り:
+ *       - コードブロック (``` / ~~~) の外の空行
+ *       - コードブロックの開始行の前と、閉じる行の後ろ
+ *       - 見出し (# ...) の前後
+ *     リストや表は空行がなければ1つのブロックのまま (項目の途中で切らない)
+ */
+class MarkdownBlockSplitter
+{
+public:
+    // textSoFar: 先頭からの累積テキスト。前回までに見た行 (最後の改行まで) は変わっていないこと
+    // (変わった場合は clear() してから渡す)。増えた行だけを処理する。
+    // テキストは保持しない (呼び出し側のバッファを複製しない)
+    void update(QStringView textSoFar);
+    void clear();
+
+    // 確定済みのブロック
+    const QStringList &closedBlocks() const { return m_closed; }
+    // 未確定のブロック (空白だけなら空)
+    const QString &openBlock() const { return m_open; }
+    // 確定済み + 未確定 (表示する順)
+    QStringList blocks() const;
+
+private:
+    void processLine(QStringView text, qsizetype lineStart, qsizetype lineEnd);
+    void closeBlock(QStringView text, qsizetype end);
+
+    QStringList m_closed;
+    QString     m_open;
+    qsizetype   m_blockStart  = 0;     // 未確定のブロックの開始位置
+    qsizetype   m_lineStart   = 0;     // まだ見ていない行の先頭
+    bool        m_inFence     = false; // コードブロックの中
+    QChar       m_fenceChar;           // コードブロックを開いた文字 (` / ~) と長さ
+    qsizetype   m_fenceLength = 0;
+};
+
+#endif // MARKDOWNBLOCKSPLITTER_H
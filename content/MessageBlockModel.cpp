@@ -0,0 +1,85 @@
+#include <algorithm>
+#include "MessageBlockModel.h"
+
+// Constructor: initializes an empty block list
+// コンストラクタ: 空のブロック一覧を初期化
+MessageBlockModel::MessageBlockModel(QObject *parent)
+    : QAbstractListModel(parent) {
+}
+
+int MessageBlockModel::rowCount(const QModelIndex &) const {
+    return static_cast<int>(m_blocks.size());
+}
+
+QVariant MessageBlockModel::data(const QModelIndex &index, int role) const {
+    const int row = index.row();
+    if (row < 0 || row >= static_cast<int>(m_blocks.size()) || role != BlockText) {
+        return QVariant();
+    }
+    return m_blocks.at(row);
+}
+
+QHash<int, QByteArray> MessageBlockModel::roleNames() const {
+    static const QHash<int, QByteArray> s_roleNames {
+        {BlockText, "blockText"},
+    };
+    return s_roleNames;
+}
+
+// Re-splits only what was appended; rows before m_closedRows are left untouched
+// (no dataChanged), so their Text delegates are not parsed or laid out again.
+// 追記された分だけ分け直す。m_closedRows より前の行には通知しないので、
+// その Text デリゲートは解析・レイアウトし直されない
+void MessageBlockModel::setText(QStringView text, bool continuation) {
+    if (!continuation) {
+        // Not a continuation (e.g. a replaced message): start over
+        // 続きではない (差し替えられたメッセージなど): 作り直す
+        m_splitter.clear();
+        m_splitter.update(text);
+        beginResetModel();
+        m_blocks     = m_splitter.blocks();
+        m_closedRows = static_cast<int>(m_splitter.closedBlocks().size());
+        endResetModel();
+        return;
+    }
+
+    m_splitter.update(text);
+    const QStringList next = m_splitter.blocks();
+    const int oldCount  = static_cast<int>(m_blocks.size());
+    const int nextCount = static_cast<int>(next.size());
+
+    // The previously open row may have become closed or still be growing
+    // 前回未確定だった行は、確定したか、まだ伸びている
+    for (int row = m_closedRows; row < std::min(oldCount, nextCount); ++row) {
+        if (m_blocks.at(row) != next.at(row)) {
+            m_blocks[row] = next.at(row);
+            const QModelIndex idx = index(row, 0);
+            emit dataChanged(idx, idx, {BlockText});
+        }
+    }
+    if (nextCount > oldCount) {
+        beginInsertRows(QModelIndex(), oldCount, nextCount - 1);
+        for (int row = oldCount; row < nextCount; ++row) {
+            m_blocks << next.at(row);
+        }
+        endInsertRows();
+    } else if (nextCount < oldCount) {
+        // The open block turned into a separator (e.g. only blank lines so far)
+        // 未確定のブロックが空行だけになった
+        beginRemoveRows(QModelIndex(), nextCount, oldCount - 1);
+        m_blocks.resize(nextCount);
+        endRemoveRows();
+    }
+    m_closedRows = static_cast<int>(m_splitter.closedBlocks().size());
+}
+
+qsizetype MessageBlockModel::storageBytes() const {
+    // m_blocks shares its strings with the splitter
+    // m_blocks の文字列はスプリッタと共有している
+    qsizetype bytes = m_blocks.capacity() * static_cast<qsizetype>(sizeof(QString))
+                      + m_splitter.closedBlocks().capacity() * static_cast<qsizetype>(sizeof(QString));
+    for (const QString &block : m_blocks) {
+        bytes += block.capacity() * static_cast<qsizetype>(sizeof(QChar));
+    }
+    return bytes;
+}
@@ -0,0 +1,37 @@
+#ifndef MESSAGEBLOCKMODEL_H
+#define MESSAGEBLOCKMODEL_H
+
+#include <QAbstractListModel>
+#include "MarkdownBlockSplitter.h"
+
+// Markdown blocks of one chat message, for a Repeater inside the message delegate.
+// Each block is rendered by its own Text item: while a reply is streaming, completed
+// blocks keep their layout and only the trailing (open) block is re-parsed.
+class MessageBlockModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    explicit MessageBlockModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent) const override;
+    QVariant data(const QModelIndex &index, int role) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    // Sets the whole message text. continuation: the text extends the previous one
+    // (lines already seen are unchanged), so only the trailing rows are touched.
+    void setText(QStringView text, bool continuation);
+
+    // Approximate heap bytes held for the block strings
+    qsizetype storageBytes() const;
+
+private:
+    enum Role {
+        BlockText = Qt::UserRole + 1,
+    };
+
+    MarkdownBlockSplitter m_splitter;
+    QStringList           m_blocks;          // Rows as currently published
+    int                   m_closedRows = 0;  // Leading rows that no longer change
+};
+
+#endif // MESSAGEBLOCKMODEL_H
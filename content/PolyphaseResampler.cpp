@@ -0,0 +1,191 @@
+#include "PolyphaseResampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RESAMPLER_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RESAMPLER_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define RESAMPLER_NEON 1
+#endif
+
+namespace {
+constexpr double kPi         = 3.14159265358979323846;
+constexpr double kRolloff    = 0.92;  // カットオフを出力ナイキストの 92% に置く (折り返しを遷移帯域の外へ)
+constexpr double kKaiserBeta = 8.6;   // 阻止域 約 -85dB
+
+// 第1種変形ベッセル関数 I0 (級数展開)
+double besselI0(double x)
+{
+    double sum  = 1.0;
+    double term = 1.0;
+    const double q = x * x / 4.0;
+    for (int k = 1; k < 50; ++k) {
+        term *= q / (double(k) * k);
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+float dot(const float *a, const float *b, int n)
+{
+    int i = 0;
+    float sum = 0.0f;
+
+#if defined(RESAMPLER_AVX)
+    __m256 acc = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    sum = _mm_cvtss_f32(s);
+#elif defined(RESAMPLER_SSE2)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    sum = _mm_cvtss_f32(acc);
+#elif defined(RESAMPLER_NEON)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float32x2_t s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    sum = vget_lane_f32(vpadd_f32(s, s), 0);
+#endif
+
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+} // namespace
+
+void PolyphaseResampler::reset(int inRate, int outRate, int zeroCrossings)
+{
+    m_inRate  = std::max(inRate, 1);
+    m_outRate = std::max(outRate, 1);
+    const int g = std::gcd(m_inRate, m_outRate);
+    m_up   = m_outRate / g;
+    m_down = m_inRate / g;
+
+    m_coeffs.clear();
+    m_taps = 1;
+    if (!isPassthrough()) {
+        // 補間後 (入力 × up) のレートで設計したローパスを位相ごとに分ける
+        //  カットオフは入力・出力のうち低い方のナイキストに合わせる
+        const int    factor = std::max(m_up, m_down);
+        const double fc     = 0.5 * kRolloff / factor;   // [cycles / 補間後サンプル]
+        m_taps = int(std::ceil(2.0 * std::max(zeroCrossings, 1) * factor / m_up));
+        const int    length = m_taps * m_up;
+        const double center = (length - 1) / 2.0;
+        const double i0Beta = besselI0(kKaiserBeta);
+
+        m_coeffs.assign(size_t(length), 0.0f);
+        for (int phase = 0; phase < m_up; ++phase) {
+            float *dst = m_coeffs.data() + size_t(phase) * m_taps;
+            for (int j = 0; j < m_taps; ++j) {
+                const int    m = phase + j * m_up;
+                const double t = m - center;
+                const double x = 2.0 * fc * t;
+                const double sinc = std::abs(x) < 1e-12 ? 1.0 : std::sin(kPi * x) / (kPi * x);
+                const double r = t / (length / 2.0);
+                const double w = std::abs(r) < 1.0 ? besselI0(kKaiserBeta * std::sqrt(1.0 - r * r)) / i0Beta : 0.0;
+                // 補間で入ったゼロの分 up 倍する。窓の新しい側から内積を取れるよう逆順に置く
+                dst[m_taps - 1 - j] = float(2.0 * fc * sinc * w * m_up);
+            }
+        }
+    }
+
+    // 先頭は taps-1 個の無音を履歴として持つ
+    const size_t history = size_t(m_taps - 1);
+    m_buf.assign(std::max(m_buf.capacity(), history), 0.0f);
+    m_end   = history;
+    m_next  = history;
+    m_phase = 0;
+}
+
+void PolyphaseResampler::reserveInput(size_t count)
+{
+    compact();
+    if (m_buf.size() < m_end + count) {
+        m_buf.resize(m_end + count);
+    }
+}
+
+float *PolyphaseResampler::prepareInput(size_t count)
+{
+    reserveInput(count);
+    return m_buf.data() + m_end;
+}
+
+void PolyphaseResampler::commitInput(size_t count)
+{
+    m_end = std::min(m_end + count, m_buf.size());
+}
+
+size_t PolyphaseResampler::available() const
+{
+    if (m_next >= m_end) {
+        return 0;
+    }
+    // 出力 k の入力位置は next + floor((phase + k*down) / up) なので、それが end 未満になる k の数
+    const size_t span = (m_end - m_next) * size_t(m_up) - size_t(m_phase);
+    return (span + size_t(m_down) - 1) / size_t(m_down);
+}
+
+size_t PolyphaseResampler::read(float *dst, size_t maxCount)
+{
+    const size_t n = std::min(maxCount, available());
+    if (isPassthrough()) {
+        std::memcpy(dst, m_buf.data() + m_next, n * sizeof(float));
+        m_next += n;
+        return n;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        const float *coeffs = m_coeffs.data() + size_t(m_phase) * m_taps;
+        const float *window = m_buf.data() + m_next + 1 - m_taps;
+        dst[i] = dot(coeffs, window, m_taps);
+
+        m_phase += m_down;
+        m_next  += size_t(m_phase / m_up);
+        m_phase %= m_up;
+    }
+    return n;
+}
+
+void PolyphaseResampler::skip(size_t count)
+{
+    const size_t total = size_t(m_phase) + count * size_t(m_down);
+    m_next  += total / size_t(m_up);
+    m_phase  = int(total % size_t(m_up));
+    m_next   = std::min(m_next, m_end);
+}
+
+void PolyphaseResampler::compact()
+{
+    // 次の出力の窓 (taps 個) より前は不要なので詰める
+    const size_t history = size_t(m_taps - 1);
+    if (m_next <= history) {
+        return;
+    }
+    const size_t shift = std::min(m_next - history, m_end);
+    std::memmove(m_buf.data(), m_buf.data() + shift, (m_end - shift) * sizeof(float));
+    m_end  -= shift;
+    m_next -= shift;
+}
@@ -0,0 +1,62 @@
+#ifndef POLYPHASERESAMPLER_H
+#define POLYPHASERESAMPLER_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * PolyphaseResampler:
+ *   - モノラル float のストリームを有理比 up/down (例: 48000→16000 は 1/3、44100→16000 は 160/441) で
+ *     変換するポリフェーズ FIR リサンプラ (Kaiser 窓付き sinc)
+ *   - 出力 1 サンプルごとに、対応する位相の係数 (taps 個) と入力の内積を1回とるだけ
+ *     (内積は AVX / SSE / NEON / スカラーをコンパイル時に選択)
+ *   - 入力は prepareInput() が返す領域に直接書き込み (デバイス形式からの変換・ダウンミックスもそこで行う)、
+ *     出力は read() で呼び出し側の領域 (リングバッファ等) に直接書き出す → 中間バッファなし
+ *   - 入力領域は reserveInput() で事前に確保しておけば、以降のコールバックでヒープ確保は起きない
+ */
+class PolyphaseResampler
+{
+public:
+    PolyphaseResampler() = default;
+
+    // zeroCrossings: sinc の片側のゼロ交差数 (大きいほど遷移帯域が狭く、重くなる)
+    void reset(int inRate, int outRate, int zeroCrossings = 16);
+
+    int  inputRate() const { return m_inRate; }
+    int  outputRate() const { return m_outRate; }
+    // レートが同じなら変換不要 (呼び出し側でそのままコピーすればよい)
+    bool isPassthrough() const { return m_up == m_down; }
+    int  tapsPerPhase() const { return m_taps; }
+
+    // 1回に書き込む入力の最大数を見込んで領域を確保しておく
+    void reserveInput(size_t count);
+    // count サンプル分の書き込み先を返す (commitInput() までに書き込むこと)
+    float *prepareInput(size_t count);
+    void commitInput(size_t count);
+
+    // 今ある入力から作れる出力の数
+    size_t available() const;
+    // 出力を最大 maxCount 個 dst に書き出し、書き出した数を返す
+    size_t read(float *dst, size_t maxCount);
+    // 出力 count 個分だけ計算せずに読み進める (書き出し先が溢れたとき)
+    void skip(size_t count);
+
+    size_t memoryBytes() const { return (m_coeffs.capacity() + m_buf.capacity()) * sizeof(float); }
+
+private:
+    void compact();
+
+    int m_inRate  = 0;
+    int m_outRate = 0;
+    int m_up      = 1;   // 補間率 L
+    int m_down    = 1;   // 間引き率 M
+    int m_taps    = 0;   // 1位相あたりの係数の数
+
+    std::vector<float> m_coeffs;   // [位相][taps]。内積を前から取れるよう時間を逆順に並べてある
+    std::vector<float> m_buf;      // 入力 (先頭 taps-1 個は前回までの履歴)
+    size_t m_end   = 0;            // m_buf の有効なサンプル数
+    size_t m_next  = 0;            // 次の出力の窓の最後 (最新) の入力位置
+    int    m_phase = 0;            // 次の出力の位相 [0, up)
+};
+
+#endif // POLYPHASERESAMPLER_H
@@ -60,6 +60,12 @@ bool QtRemoteObjectsRemoteGenerator::remoteInitialized() const
     mRemoteGenerator->remoteInitialized();
 }
 
+bool QtRemoteObjectsRemoteGenerator::cancelGeneration()
+{
+    // レプリカには要求 ID も中断のスロットもないので、応答は最後まで届く
+    return false;
+}
+
 void QtRemoteObjectsRemoteGenerator::setupQObjectConnections()
 {
     connect(mRemoteGenerator,
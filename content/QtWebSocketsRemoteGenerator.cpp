@@ -2,11 +2,33 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QUuid>
 #include <QDebug>
+#include <algorithm>
+
+namespace {
+// このクライアントが開くセッションの番号 (qlt-binary/3。1接続に1会話)
+constexpr quint32 kSessionHandle = 1;
+
+// history が sent の続きか (sent の各メッセージが同じで、後ろに増えている)
+bool continuesHistory(const QList<LlamaChatMessage> &history, const QList<LlamaChatMessage> &sent)
+{
+    if (history.size() <= sent.size()) {
+        return false;
+    }
+    for (qsizetype i = 0; i < sent.size(); ++i) {
+        if (history[i].role() != sent[i].role() || history[i].content() != sent[i].content()) {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
 
 QtWebSocketsRemoteGenerator::QtWebSocketsRemoteGenerator(QObject *parent)
     : RemoteGeneratorInterface{parent},
-    m_remoteInitialized(false)
+    m_remoteInitialized(false),
+    m_sessionId(QUuid::createUuid().toString(QUuid::WithoutBraces))
 {
     // WebSocket のオプションや初期設定
     m_webSocket.ignoreSslErrors();
@@ -40,7 +62,20 @@ void QtWebSocketsRemoteGenerator::generate(const QList<LlamaChatMessage> &messag
         return;
     }
 
-    // 例: JSON 形式で、"action":"generate" とか "data":"..." を送る
+    // 前の要求が終わっていなくても送る (qlt-binary/3 なら並行して、それ以前はサーバーが順に処理する)
+    const quint32 requestId = m_nextRequestId++;
+    if (m_nextRequestId == 0) {
+        m_nextRequestId = 1;   // 0 は接続全体のフレーム用
+    }
+    m_requests.push_back(Request{requestId});
+    m_requests.back().history = messages;   // Resync で送り直す履歴 (共有なのでコピーは起きない)
+
+    if (m_protocolVersion > 0) {
+        sendHistory(messages, requestId);
+        return;
+    }
+
+    // JSON (バイナリ形式を話さないサーバー): "action":"generate" と履歴を送る
     // QList<LlamaChatMessage> を JSON 配列に変換
     QJsonArray msgs;
     for (const auto &m : messages) {
@@ -56,7 +91,6 @@ void QtWebSocketsRemoteGenerator::generate(const QList<LlamaChatMessage> &messag
 
     // シリアライズして WebSocket で送る
     const auto jsonBytes = QJsonDocument(json).toJson(QJsonDocument::Compact);
-    qDebug() << "[QtWebSocketsRemoteGenerator] Sending generate request:" << jsonBytes;
     m_webSocket.sendTextMessage(QString::fromUtf8(jsonBytes));
 }
 
@@ -67,6 +101,11 @@ void QtWebSocketsRemoteGenerator::reinitEngine()
         return;
     }
 
+    if (m_protocolVersion > 0) {
+        m_webSocket.sendBinaryMessage(RemoteWireProtocol::encodeCommand(route(), RemoteWireProtocol::MessageType::Reinit));
+        return;
+    }
+
     // 例: JSONで "action":"reinit" などを送る
     QJsonObject json;
     json["action"] = QStringLiteral("reinit");
@@ -81,27 +120,59 @@ bool QtWebSocketsRemoteGenerator::remoteInitialized() const
     return m_remoteInitialized;
 }
 
+//------------------------------------------------------------------------------
+// 未完了の要求をすべて中断する。残りの応答は捨てる (サーバーが中断を知らなくても表示されない)
+//------------------------------------------------------------------------------
+bool QtWebSocketsRemoteGenerator::cancelGeneration()
+{
+    using RemoteWireProtocol::MessageType;
+
+    bool cancelled = false;
+    for (Request &request : m_requests) {
+        if (request.cancelled) {
+            continue;
+        }
+        request.cancelled = true;
+        if (m_protocolVersion >= 3) {
+            // その要求だけを止める (後から送る要求には影響しない)
+            m_webSocket.sendBinaryMessage(RemoteWireProtocol::encodeCommand(route(request.id), MessageType::Cancel));
+        }
+        cancelled = true;
+    }
+    if (cancelled && m_protocolVersion > 0 && m_protocolVersion < 3) {
+        // ID がないので、実行中の1件だけを止める (待っている要求は最後まで生成され、捨てられる)
+        m_webSocket.sendBinaryMessage(RemoteWireProtocol::encodeCommand(route(), MessageType::Cancel));
+    }
+    // JSON のサーバーには中断を送らない (知らない action への返事が次の要求の応答と紛れるため)
+    if (cancelled) {
+        emit generationCancelled();
+    }
+    return true;
+}
+
 void QtWebSocketsRemoteGenerator::setupQObjectConnections()
 {
     // QtWebSocket のシグナルを受け取り、this のスロットに転送
+    // (再接続のたびに呼ばれるので、前回の接続を外してから繋ぐ)
+    disconnect(&m_webSocket, nullptr, this, nullptr);
 
     // 1) 接続完了
     connect(&m_webSocket, &QWebSocket::connected, this, [this](){
         qDebug() << "[QtWebSocketsRemoteGenerator] onConnected -> WebSocket connected.";
-        // コネクション成功時、何か初期ハンドシェイクしたい場合などあればここで送信
-        // 例: "action":"hello" を送るなど
-        // あるいは、接続直後は remoteInitialized == false としておくなど
-
-        // ここで例えば "fetchRemoteInitStatus" というリクエストを送るなど
-        // QJsonObject request;
-        // request["action"] = "fetchStatus";
-        // m_webSocket.sendTextMessage(QJsonDocument(request).toJson(QJsonDocument::Compact));
+        // バイナリ形式を提案する。返事が来るまで (古いサーバーならずっと) JSON で話す
+        m_protocolVersion = 0;
+        m_webSocket.sendTextMessage(QString::fromUtf8(RemoteWireProtocol::helloRequest()));
     });
 
     // 2) 切断
     connect(&m_webSocket, &QWebSocket::disconnected, this, [this](){
         qDebug() << "[QtWebSocketsRemoteGenerator] onDisconnected -> WebSocket closed.";
         // remoteInitialized の状態をリセット
+        // (セッションの ID と送った履歴は残す。再接続したらサーバーの件数と突き合わせる)
+        // 未完了の要求の応答はもう届かない
+        m_protocolVersion = 0;
+        m_sessionOpen     = false;
+        m_requests.clear();
         setRemoteInitialized(false);
     });
 
@@ -114,48 +185,202 @@ void QtWebSocketsRemoteGenerator::setupQObjectConnections()
                 emit generationError(m_webSocket.errorString());
             });
 
-    // 4) メッセージ受信（テキスト）
+    // 4) メッセージ受信 (JSON はテキスト、RemoteWireProtocol はバイナリ)
     connect(&m_webSocket, &QWebSocket::textMessageReceived,
-            this, [this](const QString &message) {
-                qDebug() << "[QtWebSocketsRemoteGenerator] Received text message:" << message;
-
-                // JSON として解析
-                const QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
-                if (!doc.isObject()) {
-                    qWarning() << "[QtWebSocketsRemoteGenerator] Received non-JSON or invalid JSON message!";
-                    return;
-                }
-                QJsonObject obj = doc.object();
-
-                // "action": "someValue"
-                const QString action = obj.value(QStringLiteral("action")).toString();
-                if (action == QLatin1String("partialResponse")) {
-                    // 例えば "content": "xxx"
-                    const QString content = obj.value(QStringLiteral("content")).toString();
-                    // partialResponseReady(content) シグナルをエミット
-                    emit partialResponseReady(content);
-
-                } else if (action == QLatin1String("generationFinished")) {
-                    // "content" に最終応答がある想定
-                    const QString content = obj.value(QStringLiteral("content")).toString();
-                    emit generationFinished(content);
-
-                } else if (action == QLatin1String("error")) {
-                    // "errorMessage" に何かが入っている
-                    const QString errorMsg = obj.value(QStringLiteral("errorMessage")).toString();
-                    emit generationError(errorMsg);
-
-                } else if (action == QLatin1String("remoteInitializedChanged")) {
-                    // "initialized": bool
-                    const bool initState = obj.value(QStringLiteral("initialized")).toBool();
-                    if (m_remoteInitialized != initState) {
-                        setRemoteInitialized(initState);
-                    }
-
-                } else {
-                    qDebug() << "[QtWebSocketsRemoteGenerator] Received unknown action:" << action;
-                }
-            });
+            this, &QtWebSocketsRemoteGenerator::handleTextMessage);
+    connect(&m_webSocket, &QWebSocket::binaryMessageReceived,
+            this, &QtWebSocketsRemoteGenerator::handleBinaryMessage);
+}
+
+//------------------------------------------------------------------------------
+// JSON のメッセージ (hello と、バイナリ形式を話さないサーバーからの応答)
+//------------------------------------------------------------------------------
+void QtWebSocketsRemoteGenerator::handleTextMessage(const QString &message)
+{
+    // JSON として解析
+    const QJsonDocument doc = QJsonDocument::fromJson(message.toUtf8());
+    if (!doc.isObject()) {
+        qWarning() << "[QtWebSocketsRemoteGenerator] Received non-JSON or invalid JSON message!";
+        return;
+    }
+    QJsonObject obj = doc.object();
+
+    // "action": "someValue"
+    // 生成の応答は、いちばん古い未完了の要求のもの (JSON には要求 ID がない)
+    const QString action = obj.value(QStringLiteral("action")).toString();
+    const auto request = requestFor(0);
+    const bool cancelled = request != m_requests.end() && request->cancelled;
+    if (action == QLatin1String("partialResponse")) {
+        // "content": 先頭からの累積テキスト
+        const QString content = obj.value(QStringLiteral("content")).toString();
+        if (!cancelled) {
+            emit partialResponseReady(content);
+        }
+
+    } else if (action == QLatin1String("generationFinished")) {
+        // "content" に最終応答がある想定
+        const QString content = obj.value(QStringLiteral("content")).toString();
+        if (request != m_requests.end()) {
+            m_requests.erase(request);
+        }
+        if (!cancelled) {
+            emit generationFinished(content);
+        }
+
+    } else if (action == QLatin1String("error")) {
+        // "errorMessage" に何かが入っている
+        const QString errorMsg = obj.value(QStringLiteral("errorMessage")).toString();
+        if (request != m_requests.end()) {
+            m_requests.erase(request);
+        }
+        if (!cancelled) {
+            emit generationError(errorMsg);
+        }
+
+    } else if (action == QLatin1String("remoteInitializedChanged")) {
+        // "initialized": bool
+        const bool initState = obj.value(QStringLiteral("initialized")).toBool();
+        if (m_remoteInitialized != initState) {
+            setRemoteInitialized(initState);
+        }
+
+    } else if (action == QLatin1String("hello")) {
+        // サーバーが選んだ形式。以後の要求と応答はバイナリ
+        const QString protocol = obj.value(QStringLiteral("protocol")).toString();
+        m_protocolVersion = RemoteWireProtocol::protocolVersion(protocol);
+        qDebug() << "[QtWebSocketsRemoteGenerator] wire protocol:"
+                 << (m_protocolVersion > 0 ? protocol : QStringLiteral("json"));
+        if (m_protocolVersion >= 2) {
+            // 同じ ID なら、サーバーに残っている履歴 (と KV キャッシュ) を引き継ぐ
+            m_webSocket.sendBinaryMessage(RemoteWireProtocol::encodeSessionOpen(route(kSessionHandle), m_sessionId));
+        }
+
+    } else {
+        qDebug() << "[QtWebSocketsRemoteGenerator] Received unknown action:" << action;
+    }
+}
+
+//------------------------------------------------------------------------------
+// RemoteWireProtocol のフレーム (トークンごとに届くので、ログは出さない)
+//------------------------------------------------------------------------------
+void QtWebSocketsRemoteGenerator::handleBinaryMessage(const QByteArray &frame)
+{
+    using RemoteWireProtocol::MessageType;
+
+    RemoteWireProtocol::Message message;
+    if (!RemoteWireProtocol::decode(m_protocolVersion, frame, message)) {
+        qWarning() << "[QtWebSocketsRemoteGenerator] Received a malformed frame of" << frame.size() << "bytes";
+        return;
+    }
+
+    const auto request = requestFor(message.route.requestId);
+    const bool known   = request != m_requests.end();
+    switch (message.type) {
+    case MessageType::Delta:
+        if (known && !request->cancelled) {
+            // 増えた分だけをデコードして繋ぐ (ビューには従来どおり累積テキストを渡す)
+            request->responseSoFar += QString(request->decoder.decode(message.text));
+            emit partialResponseReady(request->responseSoFar);
+        }
+        break;
+    case MessageType::Finished:
+        if (known) {
+            const bool cancelled = request->cancelled;
+            m_requests.erase(request);
+            if (!cancelled) {
+                emit generationFinished(QString::fromUtf8(message.text));
+            }
+        }
+        break;
+    case MessageType::Error:
+        if (!known) {
+            // 要求に結びつかないエラー (接続全体)
+            emit generationError(QString::fromUtf8(message.text));
+        } else {
+            const bool cancelled = request->cancelled;
+            m_requests.erase(request);
+            if (!cancelled) {
+                emit generationError(QString::fromUtf8(message.text));
+            }
+        }
+        break;
+    case MessageType::Status:
+        setRemoteInitialized(message.initialized);
+        break;
+    case MessageType::SessionOpened:
+        if (QString::fromUtf8(message.sessionId) != m_sessionId
+            || (m_protocolVersion >= 3 && message.route.requestId != kSessionHandle)) {
+            qWarning() << "[QtWebSocketsRemoteGenerator] SessionOpened for another session:" << message.sessionId;
+            break;
+        }
+        m_sessionOpen        = true;
+        m_serverMessageCount = message.sequence;
+        qDebug() << "[QtWebSocketsRemoteGenerator] session" << m_sessionId << "holds" << message.sequence << "messages";
+        break;
+    case MessageType::Resync:
+        // サーバーの履歴と食い違った (サーバーの再起動など): 全部送り直す。Append は破棄されている
+        if (!known) {
+            qWarning() << "[QtWebSocketsRemoteGenerator] Resync for an unknown request" << message.route.requestId;
+            break;
+        }
+        qDebug() << "[QtWebSocketsRemoteGenerator] server holds" << message.sequence << "messages, expected"
+                 << m_serverMessageCount << "- resending the whole history";
+        // 断られた要求自身の履歴を同じ要求 ID で送り直す (応答はその要求のものとして届く)
+        // (後から送った要求の Append は、サーバーの履歴がこの履歴になった前提で届く)
+        m_webSocket.sendBinaryMessage(RemoteWireProtocol::encodeGenerate(route(request->id), request->history));
+        if (request->cancelled && m_protocolVersion >= 3) {
+            // 送り直した要求も中断済み (応答は捨てる)
+            m_webSocket.sendBinaryMessage(RemoteWireProtocol::encodeCommand(route(request->id), MessageType::Cancel));
+        }
+        m_serverMessageCount = quint64(m_sentHistory.size());
+        break;
+    default:
+        qDebug() << "[QtWebSocketsRemoteGenerator] Ignoring client-to-server frame type" << int(message.type);
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+// 生成の要求をバイナリで送る
+//   qlt-binary/2 でサーバーが前回の履歴を持っていれば、増えたメッセージだけ (Append)
+//   それ以外 (qlt-binary/1、セッション未確立、履歴が続きでない) は全部 (Generate)
+//------------------------------------------------------------------------------
+void QtWebSocketsRemoteGenerator::sendHistory(const QList<LlamaChatMessage> &messages, quint32 requestId)
+{
+    using namespace RemoteWireProtocol;
+
+    const Route to = route(requestId);
+    if (m_protocolVersion < 2) {
+        m_webSocket.sendBinaryMessage(encodeGenerate(to, messages));
+        return;
+    }
+    if (m_sessionOpen && m_serverMessageCount == quint64(m_sentHistory.size())
+        && continuesHistory(messages, m_sentHistory)) {
+        m_webSocket.sendBinaryMessage(encodeAppend(to, messages, m_sentHistory.size()));
+    } else {
+        // 全部送ってサーバーの履歴を置き換える
+        // (SessionOpened より前なら、その件数は古いので次も全部送る)
+        m_webSocket.sendBinaryMessage(encodeGenerate(to, messages));
+    }
+    m_sentHistory        = messages;
+    m_serverMessageCount = m_sessionOpen ? quint64(messages.size()) : 0;
+}
+
+// 合意した版での宛先 (要求 ID とセッション番号は qlt-binary/3 のときだけフレームに載る)
+RemoteWireProtocol::Route QtWebSocketsRemoteGenerator::route(quint32 requestId) const
+{
+    return {m_protocolVersion, requestId, m_protocolVersion >= 2 ? kSessionHandle : 0};
+}
+
+// 応答が属する要求。qlt-binary/3 なら ID で探し、それ以前はいちばん古い未完了の要求
+std::list<QtWebSocketsRemoteGenerator::Request>::iterator QtWebSocketsRemoteGenerator::requestFor(quint32 requestId)
+{
+    if (m_protocolVersion < 3) {
+        return m_requests.begin();
+    }
+    return std::find_if(m_requests.begin(), m_requests.end(), [requestId](const Request &request) {
+        return request.id == requestId;
+    });
 }
 
 void QtWebSocketsRemoteGenerator::setRemoteInitialized(bool remoteInitialized)
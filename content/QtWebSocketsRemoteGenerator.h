@@ -1,9 +1,12 @@
 #ifndef QTWEBSOCKETSREMOTEGENERATOR_H
 #define QTWEBSOCKETSREMOTEGENERATOR_H
 
+#include <QStringDecoder>
 #include <QUrl>
 #include <QWebSocket>
+#include <list>
 #include "RemoteGeneratorInterface.h"
+#include "RemoteWireProtocol.h"
 #include "rep_LlamaResponseGenerator_replica.h"
 
 class QtWebSocketsRemoteGenerator : public RemoteGeneratorInterface
@@ -17,13 +20,38 @@ public slots:
     void generate(const QList<LlamaChatMessage>& messages) override;
     void reinitEngine() override;
     bool remoteInitialized() const override;
+    bool cancelGeneration() override;
 
 private:
+    // 未完了の生成要求。応答は qlt-binary/3 なら ID で、それ以前 (JSON 含む) はいちばん古いものに振り分ける
+    struct Request {
+        quint32                  id = 0;
+        bool                     cancelled = false;   // 残りの応答は捨てる
+        QString                  responseSoFar;       // Delta を繋いだ応答
+        QList<LlamaChatMessage>  history;             // この要求で送った履歴 (Resync で送り直す)
+        QStringDecoder           decoder {QStringDecoder::Utf8};   // 文字の途中で切れた UTF-8 を持ち越す
+    };
+
     void setupQObjectConnections() override;
     void setRemoteInitialized(bool remoteInitialized);
+    void handleTextMessage(const QString &message);
+    void handleBinaryMessage(const QByteArray &frame);
+    void sendHistory(const QList<LlamaChatMessage> &messages, quint32 requestId);
+    RemoteWireProtocol::Route route(quint32 requestId = 0) const;
+    std::list<Request>::iterator requestFor(quint32 requestId);
 
     QWebSocket  m_webSocket;   // 実際の WebSocket 通信オブジェクト
     bool        m_remoteInitialized {false};
+    // hello でサーバーと合意したバイナリ形式 (RemoteWireProtocol) の版。0 なら JSON
+    int         m_protocolVersion {0};
+    // 送った順。同時にいくつも流せる (qlt-binary/3)。Finished / Error で取り除く
+    std::list<Request>  m_requests;
+    quint32             m_nextRequestId {1};
+    // qlt-binary/2 のセッション: サーバーが履歴を持つので、増えたメッセージだけを送る
+    QString                  m_sessionId;                // 起動ごとに作る。再接続しても同じ
+    bool                     m_sessionOpen {false};      // SessionOpened を受け取った
+    quint64                  m_serverMessageCount {0};   // サーバーが持っているはずのメッセージ数
+    QList<LlamaChatMessage>  m_sentHistory;              // 最後に送った履歴 (サーバー側の履歴と同じはず)
 };
 
 #endif // QTWEBSOCKETSREMOTEGENERATOR_H
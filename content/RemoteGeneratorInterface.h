@@ -15,6 +15,9 @@ public slots:
     virtual void generate(const QList<LlamaChatMessage>& messages) = 0;
     virtual void reinitEngine() = 0;
     virtual bool remoteInitialized() const = 0;
+    // Cancels the requests in flight: their remaining output is not delivered and
+    // generationCancelled() is emitted. Returns false if this transport cannot cancel.
+    virtual bool cancelGeneration() = 0;
 
 protected:
     virtual void setupQObjectConnections() = 0;
@@ -23,6 +26,7 @@ signals:
     void partialResponseReady(const QString &textSoFar);
     void generationFinished(const QString &finalResponse);
     void generationError(const QString &errorMessage);
+    void generationCancelled();
     void remoteInitializedChanged(bool remoteInitialized);
 };
 
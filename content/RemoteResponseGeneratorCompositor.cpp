@@ -19,6 +19,10 @@ RemoteResponseGeneratorCompositor::RemoteResponseGeneratorCompositor(QObject *pa
             &RemoteGeneratorInterface::generationError,
             this,
             &RemoteResponseGeneratorCompositor::generationError);
+    connect(mRemoteGenerator,
+            &RemoteGeneratorInterface::generationCancelled,
+            this,
+            &RemoteResponseGeneratorCompositor::generationCancelled);
     connect(mRemoteGenerator,
             &RemoteGeneratorInterface::remoteInitializedChanged,
             this,
@@ -45,6 +49,11 @@ bool RemoteResponseGeneratorCompositor::remoteInitialized() const
     return mRemoteGenerator->remoteInitialized();
 }
 
+bool RemoteResponseGeneratorCompositor::cancelGeneration()
+{
+    return mRemoteGenerator->cancelGeneration();
+}
+
 void RemoteResponseGeneratorCompositor::setupQObjectConnections()
 {
     // No-op
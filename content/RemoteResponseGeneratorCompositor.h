@@ -16,6 +16,7 @@ public slots:
     void generate(const QList<LlamaChatMessage>& messages) override;
     void reinitEngine() override;
     bool remoteInitialized() const override;
+    bool cancelGeneration() override;
 
 private:
     RemoteGeneratorInterface* mRemoteGenerator {nullptr};
@@ -0,0 +1,285 @@
+#include "RemoteWireProtocol.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtEndian>
+#include <algorithm>
+
+namespace RemoteWireProtocol {
+
+namespace {
+constexpr qsizetype kTypeSize   = 1;
+constexpr qsizetype kLengthSize = sizeof(quint32);
+constexpr qsizetype kCountSize  = sizeof(quint16);
+constexpr qsizetype kSeqSize    = sizeof(quint64);
+constexpr qsizetype kIdSize     = sizeof(quint32);
+
+void appendId(QByteArray &out, quint32 id)
+{
+    uchar bytes[kIdSize];
+    qToLittleEndian<quint32>(id, bytes);
+    out.append(reinterpret_cast<const char *>(bytes), kIdSize);
+}
+
+// 種類 + (qlt-binary/3 なら) 要求 ID
+QByteArray beginFrame(const Route &route, MessageType type, qsizetype payloadSize = 0)
+{
+    QByteArray out;
+    out.reserve(kTypeSize + kIdSize + payloadSize);
+    out.append(char(type));
+    if (route.version >= 3) {
+        appendId(out, route.requestId);
+    }
+    return out;
+}
+
+// Generate / Append の中身の先頭 (qlt-binary/3 ならセッション番号)
+void appendSession(QByteArray &out, const Route &route)
+{
+    if (route.version >= 3) {
+        appendId(out, route.session);
+    }
+}
+
+void appendLength(QByteArray &out, quint32 length)
+{
+    uchar bytes[kLengthSize];
+    qToLittleEndian<quint32>(length, bytes);
+    out.append(reinterpret_cast<const char *>(bytes), kLengthSize);
+}
+
+void appendString(QByteArray &out, QByteArrayView utf8)
+{
+    appendLength(out, quint32(utf8.size()));
+    out.append(utf8);
+}
+
+void appendSequence(QByteArray &out, quint64 sequence)
+{
+    uchar bytes[kSeqSize];
+    qToLittleEndian<quint64>(sequence, bytes);
+    out.append(reinterpret_cast<const char *>(bytes), kSeqSize);
+}
+
+// 件数 (u16) + [ロール, 本文] × 件数。上限を超えたら新しい方 (末尾) を残す
+void appendMessages(QByteArray &out, const QList<LlamaChatMessage> &messages, qsizetype from)
+{
+    const qsizetype count = std::min<qsizetype>(messages.size() - from, 0xFFFF);
+    uchar countBytes[kCountSize];
+    qToLittleEndian<quint16>(quint16(count), countBytes);
+    out.append(reinterpret_cast<const char *>(countBytes), kCountSize);
+    for (qsizetype i = messages.size() - count; i < messages.size(); ++i) {
+        appendString(out, messages[i].role().toUtf8());
+        appendString(out, messages[i].content().toUtf8());
+    }
+}
+
+// フレームを先頭から読む (範囲外は失敗)
+class Reader
+{
+public:
+    explicit Reader(QByteArrayView data) : m_data(data) {}
+
+    bool readString(QByteArrayView &utf8)
+    {
+        if (m_data.size() - m_pos < kLengthSize) {
+            return false;
+        }
+        const quint32 length = qFromLittleEndian<quint32>(m_data.data() + m_pos);
+        m_pos += kLengthSize;
+        if (quint64(m_data.size() - m_pos) < length) {
+            return false;
+        }
+        utf8 = m_data.sliced(m_pos, qsizetype(length));
+        m_pos += qsizetype(length);
+        return true;
+    }
+
+    template <typename T>
+    bool read(T &value)
+    {
+        if (m_data.size() - m_pos < qsizetype(sizeof(T))) {
+            return false;
+        }
+        value = qFromLittleEndian<T>(m_data.data() + m_pos);
+        m_pos += sizeof(T);
+        return true;
+    }
+
+    bool readMessages(QList<LlamaChatMessage> &messages)
+    {
+        quint16 count = 0;
+        if (!read(count)) {
+            return false;
+        }
+        messages.reserve(count);
+        for (quint16 i = 0; i < count; ++i) {
+            QByteArrayView role;
+            QByteArrayView content;
+            if (!readString(role) || !readString(content)) {
+                return false;
+            }
+            LlamaChatMessage chatMessage;
+            chatMessage.setRole(QString::fromUtf8(role));
+            chatMessage.setContent(QString::fromUtf8(content));
+            messages << chatMessage;
+        }
+        return true;
+    }
+
+    bool atEnd() const { return m_pos == m_data.size(); }
+
+private:
+    QByteArrayView m_data;
+    qsizetype      m_pos = 0;
+};
+} // namespace
+
+int protocolVersion(QStringView name)
+{
+    if (name == QLatin1String(kBinaryProtocolV3)) {
+        return 3;
+    }
+    if (name == QLatin1String(kBinaryProtocolV2)) {
+        return 2;
+    }
+    if (name == QLatin1String(kBinaryProtocolV1)) {
+        return 1;
+    }
+    return 0;
+}
+
+QByteArray helloRequest()
+{
+    QJsonObject json;
+    json[QStringLiteral("action")]    = QStringLiteral("hello");
+    json[QStringLiteral("protocols")] = QJsonArray {QLatin1String(kBinaryProtocolV3),
+                                                   QLatin1String(kBinaryProtocolV2),
+                                                   QLatin1String(kBinaryProtocolV1)};
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+QByteArray helloReply(int version)
+{
+    QJsonObject json;
+    json[QStringLiteral("action")]   = QStringLiteral("hello");
+    json[QStringLiteral("protocol")] = QLatin1String(version >= 3   ? kBinaryProtocolV3
+                                                     : version == 2 ? kBinaryProtocolV2
+                                                                    : kBinaryProtocolV1);
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+QByteArray encodeGenerate(const Route &route, const QList<LlamaChatMessage> &messages)
+{
+    QByteArray out = beginFrame(route, MessageType::Generate);
+    appendSession(out, route);
+    appendMessages(out, messages, 0);
+    return out;
+}
+
+QByteArray encodeAppend(const Route &route, const QList<LlamaChatMessage> &messages, qsizetype from)
+{
+    from = std::max<qsizetype>(from, messages.size() - 0xFFFF);   // appendMessages の上限に合わせる
+    QByteArray out = beginFrame(route, MessageType::Append);
+    appendSession(out, route);
+    appendSequence(out, quint64(from));
+    appendMessages(out, messages, from);
+    return out;
+}
+
+QByteArray encodeSessionOpen(const Route &route, QStringView sessionId)
+{
+    QByteArray out = beginFrame(route, MessageType::SessionOpen);
+    appendString(out, sessionId.toUtf8());
+    return out;
+}
+
+QByteArray encodeSessionOpened(const Route &route, QStringView sessionId, quint64 messageCount)
+{
+    QByteArray out = beginFrame(route, MessageType::SessionOpened);
+    appendString(out, sessionId.toUtf8());
+    appendSequence(out, messageCount);
+    return out;
+}
+
+QByteArray encodeResync(const Route &route, quint64 messageCount)
+{
+    QByteArray out = beginFrame(route, MessageType::Resync, kSeqSize);
+    appendSequence(out, messageCount);
+    return out;
+}
+
+QByteArray encodeText(const Route &route, MessageType type, QByteArrayView utf8)
+{
+    QByteArray out = beginFrame(route, type, kLengthSize + utf8.size());
+    appendString(out, utf8);
+    return out;
+}
+
+QByteArray encodeText(const Route &route, MessageType type, QStringView text)
+{
+    return encodeText(route, type, QByteArrayView(text.toUtf8()));
+}
+
+QByteArray encodeStatus(const Route &route, bool initialized)
+{
+    QByteArray out = beginFrame(route, MessageType::Status, 1);
+    out.append(char(initialized ? 1 : 0));
+    return out;
+}
+
+QByteArray encodeCommand(const Route &route, MessageType type)
+{
+    return beginFrame(route, type);
+}
+
+bool decode(int version, QByteArrayView frame, Message &message)
+{
+    if (frame.isEmpty()) {
+        return false;
+    }
+    message = Message();
+    message.type = MessageType(quint8(frame.front()));
+    message.route.version = version;
+    Reader reader(frame.sliced(kTypeSize));
+    if (version >= 3 && !reader.read(message.route.requestId)) {
+        return false;
+    }
+    // Generate / Append のセッション番号
+    const auto readSession = [&] {
+        return version < 3 || reader.read(message.route.session);
+    };
+
+    switch (message.type) {
+    case MessageType::Generate:
+        return readSession() && reader.readMessages(message.messages) && reader.atEnd();
+    case MessageType::Append:
+        return readSession() && reader.read(message.sequence) && reader.readMessages(message.messages)
+               && reader.atEnd();
+    case MessageType::SessionOpen:
+        return reader.readString(message.sessionId) && reader.atEnd();
+    case MessageType::SessionOpened:
+        return reader.readString(message.sessionId) && reader.read(message.sequence) && reader.atEnd();
+    case MessageType::Resync:
+        return reader.read(message.sequence) && reader.atEnd();
+    case MessageType::Delta:
+    case MessageType::Finished:
+    case MessageType::Error:
+        return reader.readString(message.text) && reader.atEnd();
+    case MessageType::Status: {
+        quint8 initialized = 0;
+        if (!reader.read(initialized)) {
+            return false;
+        }
+        message.initialized = initialized != 0;
+        return reader.atEnd();
+    }
+    case MessageType::Cancel:
+    case MessageType::Reinit:
+        return reader.atEnd();
+    }
+    return false;
+}
+
+} // namespace RemoteWireProtocol
@@ -0,0 +1,115 @@
+#ifndef REMOTEWIREPROTOCOL_H
+#define REMOTEWIREPROTOCOL_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QList>
+#include <QStringView>
+#include "rep_LlamaResponseGenerator_replica.h"
+
+/*
+ * RemoteWireProtocol:
+ *   - WebSocket でのリモート生成のバイナリ形式 (クライアント・サーバー共通)
+ *   - 接続直後にクライアントが JSON の hello で使える形式を新しい順に送り、サーバーが選んだ名前を返したら
+ *     バイナリに切り替える
+ *       → {"action":"hello","protocols":["qlt-binary/3","qlt-binary/2","qlt-binary/1"]}
+ *       ← {"action":"hello","protocol":"qlt-binary/3"}
+ *     返事がない (古いサーバー) ならそのまま JSON で話す
+ *   - qlt-binary/1: 生成のたびに履歴を全部送る
+ *   - qlt-binary/2: + セッション。サーバーがセッションごとに履歴 (と KV キャッシュ) を持ち、
+ *     クライアントは前回から増えたメッセージだけを送る
+ *       1. 接続したら SessionOpen (クライアントが決めた ID。再接続でも同じ ID を使う)
+ *       2. サーバーは SessionOpened でそのセッションが持っているメッセージ数を返す (知らない ID なら 0)
+ *       3. Append は「サーバーが sequence 件持っている」前提で続きを送る。数が合わなければ
+ *          サーバーは何もせず Resync (持っている件数) を返し、クライアントは Generate で全部送り直す
+ *       Generate はセッションの履歴を丸ごと置き換える (= 再同期)
+ *     件数に数えるのはクライアントが送ったメッセージだけ (サーバーが生成した応答は含めない)
+ *   - qlt-binary/3: + 要求 ID。1つの接続で複数の生成を同時に流せる (Delta などは ID で振り分ける)
+ *       - すべてのフレームの種類の直後に要求 ID (u32)。接続全体に関わるもの (Status / Reinit) は 0
+ *       - SessionOpen / SessionOpened ではこの欄がセッション番号 (クライアントが決める、0 以外)
+ *         → 1つの接続で複数のセッションを開ける
+ *       - Generate / Append の中身の先頭にセッション番号 (u32, 0 = セッションなし: 履歴を全部送る)
+ *       - Cancel はその ID の生成だけを止める。Resync はどの Append が失敗したかを ID で示す
+ *     /1 と /2 では要求は送った順に1つずつ処理され、応答はいちばん古い未完了の要求のもの
+ *   - 1フレーム = 種類 (u8) [+ 要求 ID (u32)] + 中身。文字列は長さ (u32, little endian) + UTF-8
+ *       Generate (C→S) : 件数 (u16) + [ロール, 本文] × 件数
+ *       Delta    (S→C) : 前回から増えた分の文字列 (累積ではない)
+ *       Finished (S→C) : 最終的な応答
+ *       Error    (S→C) : エラーメッセージ
+ *       Status   (S→C) : 初期化済みか (u8)
+ *       Cancel   (C→S) : 実行中の生成を中断 (中断した要求にも Finished か Error を返す)
+ *       Reinit   (C→S) : エンジンを初期化し直す
+ *     qlt-binary/2 で追加:
+ *       SessionOpen   (C→S) : セッション ID (文字列)
+ *       SessionOpened (S→C) : セッション ID + サーバーが持っているメッセージ数 (u64)
+ *       Append        (C→S) : sequence (u64, 追加するメッセージの最初の番号) + 件数 (u16) + [ロール, 本文] × 件数
+ *       Resync        (S→C) : サーバーが持っているメッセージ数 (u64)
+ *   - Delta はトークン単位なので UTF-8 の文字の途中で切れることがある
+ *     (受け取る側は QStringDecoder のように状態を持つデコーダで繋ぐ)
+ */
+namespace RemoteWireProtocol {
+
+// hello で合意するプロトコル名 (形式を変えたら番号を上げる)
+inline constexpr char kBinaryProtocolV1[] = "qlt-binary/1";
+inline constexpr char kBinaryProtocolV2[] = "qlt-binary/2";
+inline constexpr char kBinaryProtocolV3[] = "qlt-binary/3";
+
+// プロトコル名 → 版 (知らない名前・JSON なら 0)
+int protocolVersion(QStringView name);
+
+enum class MessageType : quint8 {
+    Generate = 1,
+    Delta    = 2,
+    Finished = 3,
+    Error    = 4,
+    Status   = 5,
+    Cancel   = 6,
+    Reinit   = 7,
+    // qlt-binary/2
+    SessionOpen   = 8,
+    SessionOpened = 9,
+    Append        = 10,
+    Resync        = 11,
+};
+
+// フレームの宛先。version が 3 未満なら requestId / session は書かない (読むと 0)
+struct Route {
+    int     version   = 1;
+    quint32 requestId = 0;   // SessionOpen / SessionOpened ではセッション番号
+    quint32 session   = 0;   // Generate / Append のセッション番号
+};
+
+// 解析したフレーム。text と sessionId は元のフレームを指す (フレームより長く持たないこと)
+struct Message {
+    MessageType              type = MessageType::Error;
+    Route                    route;
+    QByteArrayView           text;            // Delta / Finished / Error (UTF-8)
+    bool                     initialized = false;   // Status
+    QList<LlamaChatMessage>  messages;        // Generate / Append
+    QByteArrayView           sessionId;       // SessionOpen / SessionOpened (UTF-8)
+    quint64                  sequence = 0;    // Append: 最初の番号, SessionOpened / Resync: サーバーの件数
+};
+
+// JSON の hello (接続直後にクライアントが送る / サーバーが選んだ版を返す)
+QByteArray helloRequest();
+QByteArray helloReply(int version);
+
+QByteArray encodeGenerate(const Route &route, const QList<LlamaChatMessage> &messages);
+// messages の from 番目以降を、sequence = from として送る
+QByteArray encodeAppend(const Route &route, const QList<LlamaChatMessage> &messages, qsizetype from);
+QByteArray encodeSessionOpen(const Route &route, QStringView sessionId);
+QByteArray encodeSessionOpened(const Route &route, QStringView sessionId, quint64 messageCount);
+QByteArray encodeResync(const Route &route, quint64 messageCount);
+// Delta / Finished / Error
+QByteArray encodeText(const Route &route, MessageType type, QByteArrayView utf8);
+QByteArray encodeText(const Route &route, MessageType type, QStringView text);
+QByteArray encodeStatus(const Route &route, bool initialized);
+// Cancel / Reinit
+QByteArray encodeCommand(const Route &route, MessageType type);
+
+// version: 合意した版。壊れたフレーム・知らない種類なら false
+bool decode(int version, QByteArrayView frame, Message &message);
+
+} // namespace RemoteWireProtocol
+
+#endif // REMOTEWIREPROTOCOL_H
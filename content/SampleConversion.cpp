@@ -0,0 +1,174 @@
+#include "SampleConversion.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SAMPLE_CONVERSION_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SAMPLE_CONVERSION_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SAMPLE_CONVERSION_NEON 1
+#endif
+
+namespace SampleConversion {
+
+namespace {
+constexpr float kInt16Scale = 1.0f / 32768.0f;
+constexpr float kInt32Scale = 1.0f / 2147483648.0f;
+
+// アラインされていない可能性があるので memcpy 経由で読む (コンパイラが単一ロードにする)
+template <typename T>
+inline T loadUnaligned(const unsigned char *p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+} // namespace
+
+void int16ToFloat(const void *src, float *dst, size_t count)
+{
+    const unsigned char *in = static_cast<const unsigned char *>(src);
+    size_t i = 0;
+
+#if defined(SAMPLE_CONVERSION_AVX2)
+    const __m256 scale = _mm256_set1_ps(kInt16Scale);
+    for (; i + 16 <= count; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 2));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 2 + 16));
+        const __m256 fa = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a));
+        const __m256 fb = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b));
+        _mm256_storeu_ps(dst + i,     _mm256_mul_ps(fa, scale));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(fb, scale));
+    }
+#elif defined(SAMPLE_CONVERSION_SSE2)
+    const __m128 scale = _mm_set1_ps(kInt16Scale);
+    for (; i + 8 <= count; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 2));
+        // 符号拡張: 上位16bitに詰めてから算術シフト
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(dst + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#elif defined(SAMPLE_CONVERSION_NEON)
+    for (; i + 8 <= count; i += 8) {
+        const int16x8_t v = vreinterpretq_s16_u8(vld1q_u8(in + i * 2));
+        const float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+        const float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+        vst1q_f32(dst + i,     vmulq_n_f32(lo, kInt16Scale));
+        vst1q_f32(dst + i + 4, vmulq_n_f32(hi, kInt16Scale));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        dst[i] = static_cast<float>(loadUnaligned<int16_t>(in + i * 2)) * kInt16Scale;
+    }
+}
+
+void int32ToFloat(const void *src, float *dst, size_t count)
+{
+    const unsigned char *in = static_cast<const unsigned char *>(src);
+    size_t i = 0;
+
+#if defined(SAMPLE_CONVERSION_AVX2)
+    const __m256 scale = _mm256_set1_ps(kInt32Scale);
+    for (; i + 8 <= count; i += 8) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i * 4));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+#elif defined(SAMPLE_CONVERSION_SSE2)
+    const __m128 scale = _mm_set1_ps(kInt32Scale);
+    for (; i + 4 <= count; i += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 4));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+#elif defined(SAMPLE_CONVERSION_NEON)
+    for (; i + 4 <= count; i += 4) {
+        const int32x4_t v = vreinterpretq_s32_u8(vld1q_u8(in + i * 4));
+        vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(v), kInt32Scale));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        dst[i] = static_cast<float>(loadUnaligned<int32_t>(in + i * 4)) * kInt32Scale;
+    }
+}
+
+void floatToFloat(const void *src, float *dst, size_t count)
+{
+    if (count > 0) {
+        std::memcpy(dst, src, count * sizeof(float));
+    }
+}
+
+void uint8ToFloat(const void *src, float *dst, size_t count)
+{
+    const unsigned char *in = static_cast<const unsigned char *>(src);
+    constexpr float kUInt8Scale = 1.0f / 128.0f;
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = (static_cast<float>(in[i]) - 128.0f) * kUInt8Scale;
+    }
+}
+
+void downmixToMono(const float *src, float *dst, size_t frames, int channels)
+{
+    if (channels <= 1) {
+        if (dst != src && frames > 0) {
+            std::memmove(dst, src, frames * sizeof(float));
+        }
+        return;
+    }
+
+    size_t i = 0;
+    if (channels == 2) {
+        // ステレオは (L + R) / 2。書き込み位置は読み込み位置より常に手前なので in-place でも壊れない
+#if defined(SAMPLE_CONVERSION_AVX2) || defined(SAMPLE_CONVERSION_SSE2)
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; i + 4 <= frames; i += 4) {
+            const __m128 a = _mm_loadu_ps(src + i * 2);       // L0 R0 L1 R1
+            const __m128 b = _mm_loadu_ps(src + i * 2 + 4);   // L2 R2 L3 R3
+            const __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_add_ps(l, r), half));
+        }
+#elif defined(SAMPLE_CONVERSION_NEON)
+        for (; i + 4 <= frames; i += 4) {
+            const float32x4x2_t lr = vld2q_f32(src + i * 2);
+            vst1q_f32(dst + i, vmulq_n_f32(vaddq_f32(lr.val[0], lr.val[1]), 0.5f));
+        }
+#endif
+        for (; i < frames; ++i) {
+            dst[i] = (src[i * 2] + src[i * 2 + 1]) * 0.5f;
+        }
+        return;
+    }
+
+    const float scale = 1.0f / static_cast<float>(channels);
+    for (; i < frames; ++i) {
+        const float *frame = src + i * size_t(channels);
+        float sum = 0.0f;
+        for (int c = 0; c < channels; ++c) {
+            sum += frame[c];
+        }
+        dst[i] = sum * scale;
+    }
+}
+
+const char *backendName()
+{
+#if defined(SAMPLE_CONVERSION_AVX2)
+    return "AVX2";
+#elif defined(SAMPLE_CONVERSION_SSE2)
+    return "SSE2";
+#elif defined(SAMPLE_CONVERSION_NEON)
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+} // namespace SampleConversion
@@ -0,0 +1,37 @@
+#ifndef SAMPLECONVERSION_H
+#define SAMPLECONVERSION_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * SampleConversion:
+ *   - オーディオデバイスから届いた PCM を [-1.0f, +1.0f] の float に変換するカーネル群
+ *   - コンパイル時のターゲットに応じて AVX2 / SSE2 / NEON / スカラー実装を選択
+ *   - 入力ポインタのアラインメントは問わない (デバイスのバッファは 2 バイト境界のこともある)
+ *   - dst は呼び出し側で確保済みの領域 (リングバッファ等) に直接書き込む
+ */
+namespace SampleConversion {
+
+// int16 → float (1/32768 でスケーリング)
+void int16ToFloat(const void *src, float *dst, size_t count);
+
+// int32 → float (1/2^31 でスケーリング)
+void int32ToFloat(const void *src, float *dst, size_t count);
+
+// float → float (コピーのみ)
+void floatToFloat(const void *src, float *dst, size_t count);
+
+// uint8 → float ((x - 128) / 128)
+void uint8ToFloat(const void *src, float *dst, size_t count);
+
+// インターリーブされた channels チャンネルの float を平均してモノラルにする (frames フレーム分)
+//  dst == src の in-place でもよい
+void downmixToMono(const float *src, float *dst, size_t frames, int channels);
+
+// 実際に使われている SIMD 実装名 ("AVX2", "SSE2", "NEON", "scalar")
+const char *backendName();
+
+} // namespace SampleConversion
+
+#endif // SAMPLECONVERSION_H
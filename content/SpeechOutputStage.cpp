@@ -0,0 +1,295 @@
+#include "SpeechOutputStage.h"
+
+#include <QDebug>
+
+namespace {
+constexpr int kFirstClauseMinChars = 16;   // 最初の1文は、この長さを超えたら読点・カンマでも切る
+constexpr int kClauseMinChars      = 48;   // 2文目以降
+constexpr int kMaxSegmentChars     = 200;  // 区切りがないまま長くなったら空白の位置で切る
+
+// 直後に空白がなくても区切る文末 (日本語・中国語)
+bool isCjkTerminator(QChar c)
+{
+    return c == u'。' || c == u'！' || c == u'？';
+}
+
+bool isCjkClauseMark(QChar c)
+{
+    return c == u'、' || c == u'，' || c == u'；' || c == u'：';
+}
+
+// 後ろに空白が来たときだけ区切る文末・節
+bool isLatinTerminator(QChar c)
+{
+    return c == u'.' || c == u'!' || c == u'?';
+}
+
+bool isLatinClauseMark(QChar c)
+{
+    return c == u',' || c == u';' || c == u':';
+}
+
+// 前の文に含める閉じ括弧・引用符
+bool isCloser(QChar c)
+{
+    switch (c.unicode()) {
+    case u'」': case u'』': case u'）': case u'】': case u'〉': case u'》':
+    case u'"': case u'\'': case u')': case u']': case u'”': case u'’':
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool hasSpeakableText(const QString &text)
+{
+    for (const QChar c : text) {
+        if (c.isLetterOrNumber()) {
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+//------------------------------------------------------------------------------
+// SentenceSegmenter
+//------------------------------------------------------------------------------
+void SentenceSegmenter::append(const QString &delta, QStringList &segments)
+{
+    m_pending += delta;
+    for (qsizetype boundary = findBoundary(); boundary > 0; boundary = findBoundary()) {
+        const QString segment = m_pending.left(boundary).trimmed();
+        m_pending.remove(0, boundary);
+        m_scanFrom = 0;
+        if (hasSpeakableText(segment)) {
+            segments << segment;
+            ++m_emitted;
+        }
+    }
+}
+
+QString SentenceSegmenter::flush()
+{
+    const QString rest = m_pending.trimmed();
+    clear();
+    return hasSpeakableText(rest) ? rest : QString();
+}
+
+void SentenceSegmenter::clear()
+{
+    m_pending.clear();
+    m_scanFrom = 0;
+    m_emitted  = 0;
+}
+
+qsizetype SentenceSegmenter::findBoundary()
+{
+    const qsizetype n = m_pending.size();
+    const int clauseMin = m_emitted == 0 ? kFirstClauseMinChars : kClauseMinChars;
+
+    for (qsizetype i = m_scanFrom; i < n; ++i) {
+        const QChar c = m_pending.at(i);
+        if (c == u'\n') {
+            return i + 1;
+        }
+
+        const bool longEnough = i + 1 >= clauseMin;
+        const bool cjk   = isCjkTerminator(c) || (isCjkClauseMark(c) && longEnough);
+        const bool latin = isLatinTerminator(c) || (isLatinClauseMark(c) && longEnough);
+        if (!cjk && !latin) {
+            continue;
+        }
+
+        // 閉じ括弧・引用符まで含め、その次の文字を見てから決める
+        qsizetype end = i + 1;
+        while (end < n && isCloser(m_pending.at(end))) {
+            ++end;
+        }
+        if (end >= n) {
+            m_scanFrom = i;   // 続きが届いたらここから見直す
+            return -1;
+        }
+        if (cjk) {
+            // 「元気？」と… のように括弧の後に文が続くときは区切らない
+            if (end > i + 1 && !m_pending.at(end).isSpace() && !isCjkTerminator(m_pending.at(end))) {
+                continue;
+            }
+            return end;
+        }
+        if (!m_pending.at(end).isSpace() || (c == u'.' && isAbbreviationBefore(i))) {
+            continue;
+        }
+        return end;
+    }
+    m_scanFrom = n;
+
+    // 区切りのないまま長くなった → 最後の空白 (なければ上限の位置) で切る
+    if (n >= kMaxSegmentChars) {
+        const qsizetype space = m_pending.lastIndexOf(u' ', kMaxSegmentChars - 1);
+        return space >= clauseMin ? space + 1 : kMaxSegmentChars;
+    }
+    return -1;
+}
+
+bool SentenceSegmenter::isAbbreviationBefore(qsizetype dot) const
+{
+    // "." の直前の語 (e.g. のように途中の "." も含める)
+    qsizetype start = dot;
+    while (start > 0 && (m_pending.at(start - 1).isLetterOrNumber() || m_pending.at(start - 1) == u'.')) {
+        --start;
+    }
+    const QString word = m_pending.mid(start, dot - start);
+    if (word.isEmpty()) {
+        return false;
+    }
+    // イニシャル ("J. Smith")
+    if (word.size() == 1 && word.at(0).isUpper()) {
+        return true;
+    }
+    // 箇条書きの番号 ("1. ...") は番号だけで読み上げない
+    bool isNumber = false;
+    word.toInt(&isNumber);
+    if (isNumber && m_pending.left(start).trimmed().isEmpty()) {
+        return true;
+    }
+    static const QStringList abbreviations {
+        QStringLiteral("mr"), QStringLiteral("mrs"), QStringLiteral("ms"), QStringLiteral("dr"),
+        QStringLiteral("prof"), QStringLiteral("st"), QStringLiteral("vs"), QStringLiteral("jr"),
+        QStringLiteral("sr"), QStringLiteral("no"), QStringLiteral("e.g"), QStringLiteral("i.e"),
+    };
+    return abbreviations.contains(word.toLower());
+}
+
+//------------------------------------------------------------------------------
+// SpeechOutputStage
+//------------------------------------------------------------------------------
+SpeechOutputStage::SpeechOutputStage(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void SpeechOutputStage::setTextToSpeech(QTextToSpeech *tts)
+{
+    if (m_tts == tts) {
+        return;
+    }
+    if (m_tts) {
+        disconnect(m_tts, nullptr, this, nullptr);
+        cancel();
+    }
+    m_tts = tts;
+    if (m_tts) {
+        connect(m_tts, &QTextToSpeech::stateChanged, this, &SpeechOutputStage::onTtsStateChanged);
+    }
+    emit textToSpeechChanged();
+}
+
+void SpeechOutputStage::appendResponse(const QString &textSoFar)
+{
+    if (m_discardRest) {
+        return;
+    }
+    // 末尾が UTF-8 の途中で切れていると置換文字になる → 次の途中出力で正しい文字に置き換わるので保留
+    qsizetype length = textSoFar.size();
+    while (length > 0 && textSoFar.at(length - 1) == QChar::ReplacementCharacter) {
+        --length;
+    }
+    const QString text = textSoFar.left(length);
+
+    if (!m_responseOpen || !text.startsWith(m_received)) {
+        // 新しい応答 (読み上げ済み・キュー内の文はそのまま)
+        m_segmenter.clear();
+        m_received.clear();
+        m_responseOpen = true;
+    }
+
+    QStringList segments;
+    m_segmenter.append(text.mid(m_received.size()), segments);
+    m_received = text;
+    enqueueSegments(segments);
+}
+
+void SpeechOutputStage::finishResponse(const QString &finalResponse)
+{
+    if (m_discardRest) {
+        m_discardRest = false;
+        return;
+    }
+    appendResponse(finalResponse);
+
+    QStringList segments;
+    const QString rest = m_segmenter.flush();
+    if (!rest.isEmpty()) {
+        segments << rest;
+    }
+    enqueueSegments(segments);
+    m_received.clear();
+    m_responseOpen = false;
+
+    // 読み上げが生成に追いついてキューが空なら、ここで終わり
+    if (m_speaking && m_outstanding == 0) {
+        setSpeaking(false);
+    }
+}
+
+void SpeechOutputStage::cancel()
+{
+    m_discardRest = false;
+    m_segmenter.clear();
+    m_received.clear();
+    m_responseOpen = false;
+    m_outstanding  = 0;
+    if (m_tts && m_speaking) {
+        m_tts->stop(QTextToSpeech::BoundaryHint::Immediate);
+    }
+    setSpeaking(false);
+}
+
+void SpeechOutputStage::interrupt()
+{
+    const bool responseOpen = m_responseOpen;
+    cancel();
+    m_discardRest = responseOpen;
+}
+
+void SpeechOutputStage::onTtsStateChanged(QTextToSpeech::State state)
+{
+    if (state != QTextToSpeech::Ready && state != QTextToSpeech::Error) {
+        return;
+    }
+    if (state == QTextToSpeech::Error) {
+        qWarning() << "[SpeechOutputStage] text-to-speech error:" << m_tts->errorString();
+    }
+    // キューに入れた文をすべて読み終えた。生成中なら次の文を待つ (speaking のまま)
+    m_outstanding = 0;
+    if (!m_responseOpen) {
+        setSpeaking(false);
+    }
+}
+
+void SpeechOutputStage::enqueueSegments(const QStringList &segments)
+{
+    if (!m_tts) {
+        return;
+    }
+    for (const QString &segment : segments) {
+        setSpeaking(true);
+        ++m_outstanding;
+        m_tts->enqueue(segment);
+    }
+}
+
+void SpeechOutputStage::setSpeaking(bool speaking)
+{
+    if (m_speaking == speaking) {
+        return;
+    }
+    m_speaking = speaking;
+    emit speakingChanged();
+    if (speaking) {
+        emit speechStarted();
+    } else {
+        emit speechFinished();
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef SPEECHOUTPUTSTAGE_H
+#define SPEECHOUTPUTSTAGE_H
+
+#include <QObject>
+#include <QPointer>
+#include <QString>
+#include <QStringList>
+#include <QTextToSpeech>
+
+/*
+ * SentenceSegmenter:
+ *   - LLM の出力を少しずつ受け取り、読み上げ単位 (文、長い文は節) が揃った時点で切り出す
+ *   - 日本語の句点 (。！？) は直後に空白がなくても区切る。英語などの . ! ? は後ろに空白が来てから区切る
+ *     (小数 "3.14" や略語 "Mr." "e.g." では区切らない)
+ *   - 閉じ括弧・引用符 (」』）" など) は前の文に含める
+ *   - 区切りのないまま長くなった文は読点・カンマで切る (最初の1文は早めに切って読み上げを早く始める)
+ */
+class SentenceSegmenter
+{
+public:
+    // delta を追加し、読み上げられる単位が揃えば segments に追加する
+    void append(const QString &delta, QStringList &segments);
+    // 残りをすべて返す (応答の終わり)
+    QString flush();
+    void clear();
+
+private:
+    qsizetype findBoundary();
+    bool isAbbreviationBefore(qsizetype dot) const;
+
+    QString   m_pending;
+    qsizetype m_scanFrom = 0;   // ここより前は区切りがないことを確認済み
+    int       m_emitted  = 0;   // この応答で切り出した数
+};
+
+/*
+ * SpeechOutputStage:
+ *   - LLM の途中出力 (partialResponseReady の累積テキスト) から差分を取り出して SentenceSegmenter に流し、
+ *     区切りが揃った文から QTextToSpeech::enqueue() する
+ *     → 最初の音声が出るまでの時間が「応答全体の生成時間」ではなく「最初の1文の生成時間」になる
+ *   - 生成が読み上げより遅く、キューが一時的に空になっても speaking のまま (途中でマイクを再開しない)
+ *   - speechStarted(): 最初の文をキューに入れた / speechFinished(): 応答が終わり、すべて読み上げた (または cancel())
+ *   - LlamaChatEngine が所有し、QML から textToSpeech (App.qml の TextToSpeech) を設定する
+ */
+class SpeechOutputStage : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(QTextToSpeech* textToSpeech READ textToSpeech WRITE setTextToSpeech NOTIFY textToSpeechChanged FINAL)
+    Q_PROPERTY(bool speaking READ isSpeaking NOTIFY speakingChanged FINAL)
+
+public:
+    explicit SpeechOutputStage(QObject *parent = nullptr);
+
+    QTextToSpeech *textToSpeech() const { return m_tts; }
+    void setTextToSpeech(QTextToSpeech *tts);
+    bool isSpeaking() const { return m_speaking; }
+
+public slots:
+    // 生成中の応答 (先頭からの累積テキスト)
+    void appendResponse(const QString &textSoFar);
+    // 応答の生成完了。残りを読み上げに回す
+    void finishResponse(const QString &finalResponse);
+    // 読み上げを止め、未処理のテキストを捨てる (生成の中断・やり直し)
+    void cancel();
+    // 読み上げだけ止める (割り込み)。生成中の応答の残りは finishResponse() まで読み上げない
+    void interrupt();
+
+signals:
+    void textToSpeechChanged();
+    void speakingChanged();
+    void speechStarted();
+    void speechFinished();
+
+private slots:
+    void onTtsStateChanged(QTextToSpeech::State state);
+
+private:
+    void enqueueSegments(const QStringList &segments);
+    void setSpeaking(bool speaking);
+
+    QPointer<QTextToSpeech> m_tts;
+    SentenceSegmenter       m_segmenter;
+    QString                 m_received;            // この応答で受け取ったテキスト
+    bool                    m_responseOpen = false; // 生成中 (finishResponse() 待ち)
+    int                     m_outstanding  = 0;     // キューに入れて読み終わっていない文の数
+    bool                    m_discardRest  = false; // interrupt() 後、この応答の残りを捨てる
+    bool                    m_speaking     = false;
+};
+
+#endif // SPEECHOUTPUTSTAGE_H
@@ -0,0 +1,233 @@
+#include "StreamingVad.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+// ノイズフロアの追従速度 (1フレームあたり)
+constexpr float kFloorFallRate  = 0.2f;    // 静かになったらすぐ下げる
+constexpr float kFloorRiseRate  = 0.05f;   // 無声フレームではゆっくり上げる
+constexpr float kFloorDriftRate = 0.002f;  // 有声フレームでもごくゆっくり追従 (定常ノイズ対策)
+constexpr float kMinNoiseFloor  = 1e-5f;
+// エコーフロアの追従速度 (ガード開始直後の学習中は速く、その後はゆっくり。
+// しきい値を超えたフレームは割り込みの声かもしれないので、さらにゆっくり)
+constexpr float kEchoCalibrationRate = 0.3f;
+constexpr float kEchoRiseRate        = 0.05f;
+constexpr float kEchoFallRate        = 0.02f;
+constexpr float kEchoDriftRate       = 0.005f;
+constexpr float kPi = 3.14159265358979f;
+
+int msToFrames(int ms, int frameMs)
+{
+    return std::max(1, (ms + frameMs - 1) / frameMs);
+}
+} // namespace
+
+void StreamingVad::reset(const StreamingVadParams &params, uint64_t position)
+{
+    m_params = params;
+    m_params.frame_ms = std::clamp(m_params.frame_ms, 10, 30);
+
+    m_frameSamples     = size_t(m_params.sample_rate) * m_params.frame_ms / 1000;
+    m_minSpeechFrames  = msToFrames(m_params.min_speech_ms, m_params.frame_ms);
+    m_hangoverFrames   = msToFrames(m_params.hangover_ms, m_params.frame_ms);
+    m_prerollSamples   = uint64_t(m_params.sample_rate) * std::max(m_params.preroll_ms, 0) / 1000;
+    m_maxSpeechSamples = uint64_t(m_params.sample_rate) * std::max(m_params.max_speech_ms, 0) / 1000;
+    m_echoMinSpeechFrames   = msToFrames(m_params.echo_min_speech_ms, m_params.frame_ms);
+    m_echoCalibrationFrames = msToFrames(m_params.echo_calibration_ms, m_params.frame_ms);
+
+    // 1次ハイパス: y[n] = a * (y[n-1] + x[n] - x[n-1]),  a = RC / (RC + dt)
+    if (m_params.freq_thold > 0.0f) {
+        const float rc = 1.0f / (2.0f * kPi * m_params.freq_thold);
+        const float dt = 1.0f / float(m_params.sample_rate);
+        m_hpAlpha = rc / (rc + dt);
+    } else {
+        m_hpAlpha = 0.0f;
+    }
+    m_hpPrevIn  = 0.0f;
+    m_hpPrevOut = 0.0f;
+
+    m_partial.assign(m_frameSamples, 0.0f);
+    m_partialCount = 0;
+
+    m_position    = position;
+    m_streamStart = position;
+
+    m_noiseFloor  = 0.0f;
+    m_floorInited = false;
+
+    m_inSpeech      = false;
+    m_loudRun       = 0;
+    m_silentRun     = 0;
+    m_loudRunStart  = position;
+    m_speechStart   = position;
+    m_lastVoicedEnd = position;
+
+    m_echoGuard           = false;
+    m_echoFloor           = 0.0f;
+    m_echoCalibrationLeft = 0;
+}
+
+void StreamingVad::setEchoGuard(bool active)
+{
+    if (m_echoGuard == active) {
+        return;
+    }
+    m_echoGuard = active;
+    if (active) {
+        // 学習し直す (前回の読み上げと音量・スピーカー位置が同じとは限らない)
+        m_echoFloor           = 0.0f;
+        m_echoCalibrationLeft = m_echoCalibrationFrames;
+        if (!m_inSpeech) {
+            m_loudRun = 0;
+        }
+    }
+}
+
+void StreamingVad::process(const float *samples, size_t count, uint64_t firstSample, std::vector<VadEvent> &events)
+{
+    if (count == 0 || m_frameSamples == 0) {
+        return;
+    }
+    if (firstSample != m_position) {
+        // 取りこぼしがあった: 端数フレームは捨ててフレーム境界を取り直す
+        m_partialCount = 0;
+        m_position     = firstSample;
+    }
+
+    // 前回の端数を埋める
+    if (m_partialCount > 0) {
+        const size_t take = std::min(count, m_frameSamples - m_partialCount);
+        std::copy(samples, samples + take, m_partial.begin() + m_partialCount);
+        m_partialCount += take;
+        samples += take;
+        count   -= take;
+        m_position += take;
+        if (m_partialCount < m_frameSamples) {
+            return;
+        }
+        processFrame(m_partial.data(), m_position - m_frameSamples, events);
+        m_partialCount = 0;
+    }
+
+    // 丸ごと入っているフレームはコピーせずに処理
+    while (count >= m_frameSamples) {
+        processFrame(samples, m_position, events);
+        samples    += m_frameSamples;
+        count      -= m_frameSamples;
+        m_position += m_frameSamples;
+    }
+
+    if (count > 0) {
+        std::copy(samples, samples + count, m_partial.begin());
+        m_partialCount = count;
+        m_position    += count;
+    }
+}
+
+void StreamingVad::processFrame(const float *frame, uint64_t frameStart, std::vector<VadEvent> &events)
+{
+    // ハイパスを通しつつ平均絶対振幅を求める (フィルタ状態はフレームをまたいで保持)
+    float energy = 0.0f;
+    if (m_hpAlpha > 0.0f) {
+        float prevIn  = m_hpPrevIn;
+        float prevOut = m_hpPrevOut;
+        for (size_t i = 0; i < m_frameSamples; ++i) {
+            const float x = frame[i];
+            prevOut = m_hpAlpha * (prevOut + x - prevIn);
+            prevIn  = x;
+            energy += std::fabs(prevOut);
+        }
+        m_hpPrevIn  = prevIn;
+        m_hpPrevOut = prevOut;
+    } else {
+        for (size_t i = 0; i < m_frameSamples; ++i) {
+            energy += std::fabs(frame[i]);
+        }
+    }
+    energy /= float(m_frameSamples);
+
+    if (!m_floorInited) {
+        m_noiseFloor  = std::max(energy, kMinNoiseFloor);
+        m_floorInited = true;
+    }
+
+    float threshold = std::max(m_params.min_energy, m_noiseFloor / m_params.vad_thold);
+    int   minSpeechFrames = m_minSpeechFrames;
+    if (m_echoGuard) {
+        const bool  calibrating = m_echoCalibrationLeft > 0;
+        const float echoThreshold = m_echoFloor * m_params.echo_margin;
+        // 発話中でなければエコーフロアを学習する (発話中のフレームはユーザーの声を含むので使わない)
+        //  しきい値を超えたフレームは声かもしれないので、ごくゆっくりしか追従させない
+        if (!m_inSpeech) {
+            float rate = energy > m_echoFloor ? (calibrating ? kEchoCalibrationRate : kEchoRiseRate) : kEchoFallRate;
+            if (!calibrating && energy > echoThreshold) {
+                rate = kEchoDriftRate;
+            }
+            m_echoFloor += rate * (energy - m_echoFloor);
+        }
+        if (calibrating) {
+            --m_echoCalibrationLeft;
+            threshold = std::numeric_limits<float>::max();
+        } else {
+            threshold = std::max(threshold, echoThreshold);
+        }
+        minSpeechFrames = std::max(minSpeechFrames, m_echoMinSpeechFrames);
+    }
+    const bool  voiced    = energy > threshold;
+    const uint64_t frameEnd = frameStart + m_frameSamples;
+
+    // ノイズフロア更新 (エコーガード中は止める。読み上げが終わったらすぐ元の感度に戻れるように)
+    if (!m_echoGuard) {
+        float rate = kFloorRiseRate;
+        if (energy < m_noiseFloor) {
+            rate = kFloorFallRate;
+        } else if (voiced) {
+            rate = kFloorDriftRate;
+        }
+        m_noiseFloor = std::max(kMinNoiseFloor, m_noiseFloor + rate * (energy - m_noiseFloor));
+    }
+
+    if (!m_inSpeech) {
+        if (!voiced) {
+            // エコーガード中は音節の切れ目で数え直さない (割り込みの声はエコーを常に上回るとは限らない)
+            m_loudRun = m_echoGuard ? std::max(m_loudRun - 1, 0) : 0;
+            return;
+        }
+        if (m_loudRun == 0) {
+            m_loudRunStart = frameStart;
+        }
+        if (++m_loudRun < minSpeechFrames) {
+            return;
+        }
+        // 発話開始: プリロール分さかのぼる (reset 前や直前の発話終了より前には戻らない)
+        const uint64_t lowerBound = std::max(m_streamStart, m_lastVoicedEnd);
+        m_speechStart = m_loudRunStart > lowerBound + m_prerollSamples
+                            ? m_loudRunStart - m_prerollSamples
+                            : lowerBound;
+        m_inSpeech      = true;
+        m_silentRun     = 0;
+        m_lastVoicedEnd = frameEnd;
+        events.push_back({VadEvent::SpeechStart, m_speechStart});
+        return;
+    }
+
+    if (voiced) {
+        m_silentRun     = 0;
+        m_lastVoicedEnd = frameEnd;
+    } else {
+        ++m_silentRun;
+    }
+
+    const bool hangoverExpired = m_silentRun >= m_hangoverFrames;
+    const bool tooLong = m_maxSpeechSamples > 0 && frameEnd - m_speechStart >= m_maxSpeechSamples;
+    if (hangoverExpired || tooLong) {
+        const uint64_t end = tooLong && !hangoverExpired ? frameEnd : m_lastVoicedEnd;
+        m_inSpeech      = false;
+        m_loudRun       = 0;
+        m_silentRun     = 0;
+        m_lastVoicedEnd = end;
+        events.push_back({VadEvent::SpeechEnd, end});
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef STREAMINGVAD_H
+#define STREAMINGVAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * StreamingVad:
+ *   - 録音データを届いた順に 10〜30ms のフレーム単位で処理する逐次型 VAD
+ *   - vad_simple() のように毎回数秒分をフィルタし直さず、
+ *     ハイパスフィルタの状態とノイズフロア (フレームエネルギーの移動平均) を持ち回る
+ *   - 発話開始はプリロール分さかのぼった位置、発話終了は最後の有声フレームの終わりを
+ *     絶対サンプル位置 (AudioHistoryBuffer と同じ通し番号) で通知する
+ *   - 発話終了の検出遅延は hangover_ms + 1フレーム程度
+ *   - エコーガード (setEchoGuard): 読み上げ中もマイクを止めずに割り込み (barge-in) を検出するためのモード
+ *     読み上げ音声そのものは参照できないので、「読み上げ中である」ことを参照にし、その間のマイクのエネルギーから
+ *     エコーの大きさ (エコーフロア) を学習して、それを十分に上回る音が長めに続いたときだけ発話開始とする
+ */
+struct StreamingVadParams {
+    int   sample_rate   = 16000;
+    int   frame_ms      = 20;
+    float vad_thold     = 0.6f;     // ノイズフロア / フレームエネルギー がこれ未満なら有声 (vad_simple と同じ向き)
+    float freq_thold    = 100.0f;   // ハイパスのカットオフ [Hz] (0 以下で無効)
+    float min_energy    = 0.002f;   // 有声とみなす最小エネルギー (平均絶対振幅)
+    int   min_speech_ms = 60;       // これ以上続いたら発話開始 (クリック音などを除外)
+    int   hangover_ms   = 100;      // 無声がこれだけ続いたら発話終了
+    int   preroll_ms    = 200;      // 発話開始位置をさかのぼる量 (子音の立ち上がりを取りこぼさない)
+    int   max_speech_ms = 30000;    // これを超えたら強制的に発話終了 (定常ノイズで張り付かないように)
+
+    // エコーガード中の設定
+    float echo_margin         = 2.5f;  // エコーフロアの何倍を超えたら有声とみなすか
+    int   echo_min_speech_ms  = 150;   // 発話開始とみなすまでの長さ (通常より長く取り、エコーの山を除外)
+    int   echo_calibration_ms = 300;   // ガード開始直後はエコーフロアの学習だけ行う
+};
+
+struct VadEvent {
+    enum Type { SpeechStart, SpeechEnd };
+    Type     type;
+    uint64_t sample;   // 絶対サンプル位置
+};
+
+class StreamingVad
+{
+public:
+    StreamingVad() = default;
+
+    // 状態を初期化する。position は次に渡すサンプルの絶対位置
+    void reset(const StreamingVadParams &params, uint64_t position = 0);
+
+    // 連続したサンプル列を処理し、発生したイベントを events に追加する
+    //  firstSample が前回の続きでなければ (取りこぼし等) 途中のフレームを捨てて同期し直す
+    void process(const float *samples, size_t count, uint64_t firstSample, std::vector<VadEvent> &events);
+
+    bool  inSpeech() const { return m_inSpeech; }
+    float noiseFloor() const { return m_noiseFloor; }
+
+    // 読み上げ (スピーカー出力) 中は true にする。false にするとすぐ通常の判定に戻る
+    void  setEchoGuard(bool active);
+    bool  echoGuardActive() const { return m_echoGuard; }
+    float echoFloor() const { return m_echoFloor; }
+    // 処理済みサンプルの次の絶対位置
+    uint64_t position() const { return m_position; }
+
+private:
+    void processFrame(const float *frame, uint64_t frameStart, std::vector<VadEvent> &events);
+
+    StreamingVadParams m_params;
+    size_t   m_frameSamples       = 320;
+    int      m_minSpeechFrames    = 3;
+    int      m_hangoverFrames     = 5;
+    uint64_t m_prerollSamples     = 0;
+    uint64_t m_maxSpeechSamples   = 0;
+
+    // ハイパスフィルタの状態 (1次 IIR)
+    float    m_hpAlpha  = 0.0f;
+    float    m_hpPrevIn = 0.0f;
+    float    m_hpPrevOut = 0.0f;
+
+    // フレーム境界をまたいだ端数サンプル
+    std::vector<float> m_partial;
+    size_t   m_partialCount = 0;
+
+    uint64_t m_position      = 0;  // 次に届くはずのサンプル位置
+    uint64_t m_streamStart   = 0;  // reset() 時の位置 (プリロールはこれより前に戻らない)
+
+    float    m_noiseFloor    = 0.0f;
+    bool     m_floorInited   = false;
+
+    bool     m_inSpeech      = false;
+    int      m_loudRun       = 0;  // 連続した有声フレーム数 (発話開始前)
+    int      m_silentRun     = 0;  // 連続した無声フレーム数 (発話中)
+    uint64_t m_loudRunStart  = 0;
+    uint64_t m_speechStart   = 0;
+    uint64_t m_lastVoicedEnd = 0;
+
+    // エコーガード
+    bool     m_echoGuard            = false;
+    float    m_echoFloor            = 0.0f;
+    int      m_echoCalibrationLeft  = 0;   // 学習だけ行う残りフレーム数
+    int      m_echoMinSpeechFrames  = 10;
+    int      m_echoCalibrationFrames = 15;
+};
+
+#endif // STREAMINGVAD_H
@@ -1,10 +1,12 @@
 #include "VoiceDetector.h"
 
-#include <QMediaDevices>
 #include <QAudioFormat>
 #include <QDebug>
 #include <QThread>
-#include <cstring> // memcpy
+#include <algorithm>
+#include "AudioCaptureSource.h"
+#include "SampleConversion.h"
+#include "common.h" // COMMON_SAMPLE_RATE
 
 //-------------------------
 // Pullモード用のカスタム QIODevice 実装
@@ -34,58 +36,52 @@ public:
             return data_len_in_bytes; // 受け取るだけ受け取って破棄
         }
 
-        // AudioSource が実際に使用しているフォーマットを取得
-        const QAudioFormat actualFormat = m_voice_detector->m_audioSource->format();
-        const QAudioFormat::SampleFormat sf = actualFormat.sampleFormat();
-
-        std::vector<float> chunkVec;  // ここに float 値として格納する
-
-        switch (sf) {
-        case QAudioFormat::Float: {
-            // 既存のとおり float として解釈
-            const size_t sample_counts = static_cast<size_t>(data_len_in_bytes / sizeof(float));
-            chunkVec.resize(sample_counts);
-
-            const float *audio_samples = reinterpret_cast<const float*>(data);
-            for (size_t i = 0; i < sample_counts; i++) {
-                chunkVec[i] = audio_samples[i];
-            }
-            break;
-        }
-        case QAudioFormat::Int16: {
-            // int16_t として解釈 → float に変換
-            const size_t sample_counts = static_cast<size_t>(data_len_in_bytes / sizeof(qint16));
-            chunkVec.resize(sample_counts);
-
-            const qint16 *audio_samples = reinterpret_cast<const qint16*>(data);
-            for (size_t i = 0; i < sample_counts; i++) {
-                // 32768.0f で割ることで [-1.0f, +1.0f] 程度の浮動小数に変換
-                chunkVec[i] = static_cast<float>(audio_samples[i]) / 32768.0f;
-            }
-            break;
+        // init() 時に決めた、AudioSource が実際に使用しているフォーマットの変換関数
+        if (!m_voice_detector->m_convert) {
+            return data_len_in_bytes;
         }
-        case QAudioFormat::Int32: {
-            // int32_t → float
-            const size_t sample_counts = static_cast<size_t>(data_len_in_bytes / sizeof(qint32));
-            chunkVec.resize(sample_counts);
-
-            const qint32 *audio_samples = reinterpret_cast<const qint32*>(data);
-            // float への正規化の仕方は int32 の場合スケールが 2^31 (約2.147e9)
-            constexpr float kMaxInt32Inv = 1.0f / 2147483648.0f;
-            for (size_t i = 0; i < sample_counts; i++) {
-                chunkVec[i] = static_cast<float>(audio_samples[i]) * kMaxInt32Inv;
-            }
-            break;
+        const size_t bytes_per_sample = m_voice_detector->m_bytes_per_sample;
+        AudioRingBuffer &ring = *m_voice_detector->m_audioBuffer;
+        AudioRingBuffer::Region region;
+        size_t sample_counts = 0;
+
+        if (!m_voice_detector->m_needs_resample) {
+            // デバイスが最初から指定レートのモノラル
+            //  変換しながらリングバッファに直接書き込む (中間バッファなし)
+            sample_counts = static_cast<size_t>(data_len_in_bytes) / bytes_per_sample;
+            region = ring.beginWrite(sample_counts);
+            m_voice_detector->m_convert(data, region.first, region.firstCount);
+            m_voice_detector->m_convert(data + region.firstCount * bytes_per_sample, region.second, region.secondCount);
+        } else {
+            // リサンプラの入力領域に float 変換 → その場でモノラルにダウンミックスし、
+            // 変換後のサンプルをリングバッファの空き領域へ直接書き出す
+            //  (Qt はフレーム単位で渡してくるので端数のバイトは来ない前提)
+            PolyphaseResampler &resampler = m_voice_detector->m_resampler;
+            const int channels = m_voice_detector->m_device_channels;
+            const size_t frames = static_cast<size_t>(data_len_in_bytes) / (bytes_per_sample * size_t(channels));
+            float *in = resampler.prepareInput(frames * size_t(channels));
+            m_voice_detector->m_convert(data, in, frames * size_t(channels));
+            SampleConversion::downmixToMono(in, in, frames, channels);
+            resampler.commitInput(frames);
+
+            sample_counts = resampler.available();
+            region = ring.beginWrite(sample_counts);
+            resampler.read(region.first, region.firstCount);
+            resampler.read(region.second, region.secondCount);
+            // 書ききれなかった分は読み捨てる (下で溢れとして数える)
+            resampler.skip(sample_counts - region.totalCount());
         }
-        // もし他のフォーマット (UInt8など) が来る場合は追加
-        default:
-            // このフォーマットには対応していない or 実装していないので無視
-            qWarning() << "[VoicePullIODevice] Unsupported sampleFormat" << sf;
-            return data_len_in_bytes;
+        ring.commitWrite(region.totalCount());
+
+        if (region.totalCount() < sample_counts) {
+            // コンシューマが追いついていない → 溢れた分は捨てる
+            ring.noteDropped(sample_counts - region.totalCount());
         }
 
-        // 変換後 chunkVec を送信
-        emit m_voice_detector->audioAvailable(chunkVec);
+        // 通知済みで未処理なら再通知しない (キューイベントの確保を抑える)
+        if (region.totalCount() > 0 && ring.requestConsumerWakeup()) {
+            emit m_voice_detector->audioAvailable();
+        }
 
         return data_len_in_bytes;
     }
@@ -102,17 +98,19 @@ private:
 VoiceDetector::VoiceDetector(int len_ms, QObject *parent)
     : QObject(parent)
     , m_len_ms(len_ms)
+    , m_audioBuffer(std::make_shared<AudioRingBuffer>(
+          static_cast<size_t>(COMMON_SAMPLE_RATE) * static_cast<size_t>(len_ms) / 1000))
 {
     m_running = false;
 }
 
 VoiceDetector::~VoiceDetector()
 {
-    // 終了時にオーディオソースを停止して破棄
-    if (m_audioSource) {
-        m_audioSource->stop();
-        delete m_audioSource;
-        m_audioSource = nullptr;
+    // 終了時に入力元を停止して破棄
+    if (m_source) {
+        m_source->stop();
+        delete m_source;
+        m_source = nullptr;
     }
     // pull用のIODeviceも削除
     if (m_pullDevice) {
@@ -121,6 +119,22 @@ VoiceDetector::~VoiceDetector()
     }
 }
 
+void VoiceDetector::setCaptureSource(AudioCaptureSource *source)
+{
+    if (m_initialized) {
+        qWarning() << "[VoiceDetector] capture source must be set before init()";
+        return;
+    }
+    if (m_source == source) {
+        return;
+    }
+    delete m_source;
+    m_source = source;
+    if (m_source) {
+        m_source->setParent(this);
+    }
+}
+
 bool VoiceDetector::init(int sampleRate, int channelCount)
 {
     if (m_initialized) {
@@ -130,80 +144,87 @@ bool VoiceDetector::init(int sampleRate, int channelCount)
 
     m_sample_rate = sampleRate;
 
-    // 1) デバイス取得
-    const QAudioDevice device = QMediaDevices::defaultAudioInput();
-    if (!device.isNull()) {
-        qDebug() << "[VoiceDetector] default audio input device:"
-                 << device.description();
-    }
-
-    // 2) まずは「Float + ユーザー指定のsampleRate/channelCount」で試みる
-    QAudioFormat formatWanted;
-    formatWanted.setSampleRate(m_sample_rate);
-    formatWanted.setChannelCount(channelCount);
-    formatWanted.setSampleFormat(QAudioFormat::Float);
-
-    // 3) サポートチェック
-    if (!device.isFormatSupported(formatWanted)) {
-        // Floatがサポートされない場合 → デバイスの preferredFormat にフォールバック
-        qDebug() << "[VoiceDetector] Float format is NOT supported. Fallback to device's preferred format.";
-
-        QAudioFormat preferred = device.preferredFormat();
-        // 必要に応じてチャンネル数やサンプルレートを自分で上書きするか、
-        // デバイス推奨のまま使うかは要検討 (ここでは sampleRate, channelCount を上書き例に)
-        preferred.setSampleRate(m_sample_rate);
-        preferred.setChannelCount(channelCount);
-
-        // それでもサポートされない場合は仕方がないので device.preferredFormat() をまるごと受け入れる
-        if (!device.isFormatSupported(preferred)) {
-            qWarning() << "[VoiceDetector] Even the adjusted preferred format is not fully supported.";
-            qWarning() << "[VoiceDetector] preferredFormat.sampleFormat=" << preferred.sampleFormat()
-                       << " sampleRate=" << preferred.sampleRate()
-                       << " channelCount=" << preferred.channelCount();
-            qFatal("Cannot proceed.");
-        }
-
-        formatWanted = preferred;
+    if (channelCount != 1) {
+        qWarning() << "[VoiceDetector] only mono output is supported. channelCount =" << channelCount;
+        return false;
     }
 
-    // 4) QAudioSource生成
-    m_audioSource = new QAudioSource(device, formatWanted, this);
-    if (!m_audioSource) {
-        qWarning() << "[VoiceDetector] Failed to create QAudioSource";
+    // 1) 入力元を開く (指定がなければ既定のマイク)
+    //    ネイティブのレート・チャンネル数のまま開き、変換はこちらで行う
+    if (!m_source) {
+        m_source = new MicrophoneCaptureSource(this);
+    }
+    if (!m_source->open()) {
+        qWarning() << "[VoiceDetector] Failed to open capture source" << m_source->description();
         return false;
     }
 
-    // 5) pullモード用の QIODevice を作成
+    // 2) pullモード用の QIODevice を作成
     m_pullDevice = new VoicePullIODevice(this, this);
     if (!m_pullDevice->open(QIODevice::WriteOnly)) {
         qWarning() << "[VoiceDetector] Failed to open pullDevice";
         delete m_pullDevice;
         m_pullDevice = nullptr;
-        delete m_audioSource;
-        m_audioSource = nullptr;
+        m_source->stop();
         return false;
     }
 
-    // 6) QAudioSource を start() し、pullDevice に書き込みさせる
-    m_audioSource->start(m_pullDevice);
+    // 3) 実際に使われるフォーマットに合わせて変換経路を決める
+    const QAudioFormat actual = m_source->format();
+    m_sample_format   = actual.sampleFormat();
+    m_device_rate     = actual.sampleRate();
+    m_device_channels = std::max(actual.channelCount(), 1);
+    switch (m_sample_format) {
+    case QAudioFormat::Float:
+        m_bytes_per_sample = sizeof(float);
+        m_convert = &SampleConversion::floatToFloat;
+        break;
+    case QAudioFormat::Int16:
+        // 32768.0f で割ることで [-1.0f, +1.0f] 程度の浮動小数に変換
+        m_bytes_per_sample = sizeof(qint16);
+        m_convert = &SampleConversion::int16ToFloat;
+        break;
+    case QAudioFormat::Int32:
+        // float への正規化の仕方は int32 の場合スケールが 2^31 (約2.147e9)
+        m_bytes_per_sample = sizeof(qint32);
+        m_convert = &SampleConversion::int32ToFloat;
+        break;
+    case QAudioFormat::UInt8:
+        m_bytes_per_sample = sizeof(quint8);
+        m_convert = &SampleConversion::uint8ToFloat;
+        break;
+    default:
+        qWarning() << "[VoiceDetector] Unsupported sampleFormat" << m_sample_format;
+        delete m_pullDevice;
+        m_pullDevice = nullptr;
+        m_source->stop();
+        return false;
+    }
+
+    m_needs_resample = m_device_rate != m_sample_rate || m_device_channels != 1;
+    if (m_needs_resample) {
+        m_resampler.reset(m_device_rate, m_sample_rate);
+        // コールバック1回分 (通常 10〜40ms) より十分大きく確保しておく (超えたときだけ拡張される)
+        m_resampler.reserveInput(static_cast<size_t>(m_device_rate) * m_device_channels / 5);
+    }
 
-    // debug: stateChanged を監視
-    connect(m_audioSource, &QAudioSource::stateChanged,
-            this, [this](QAudio::State newState) {
-                qDebug() << "[VoiceDetector] stateChanged ->" << newState
-                         << "error=" << m_audioSource->error();
-            });
+    // 4) 入力元を start() し、pullDevice に書き込みさせる
+    m_source->start(m_pullDevice);
 
     m_initialized = true;
-    qDebug() << "[VoiceDetector] init done. m_audioSource state =" << m_audioSource->state()
-             << " format.sampleFormat=" << m_audioSource->format().sampleFormat()
-             << " sampleRate=" << m_audioSource->format().sampleRate()
-             << " channelCount=" << m_audioSource->format().channelCount();
+    qDebug() << "[VoiceDetector] init done. source =" << m_source->description()
+             << " conversion backend=" << SampleConversion::backendName()
+             << " resample=" << (m_needs_resample ? QString("%1 Hz x%2 -> %3 Hz mono (%4 taps/phase)")
+                                                          .arg(m_device_rate).arg(m_device_channels)
+                                                          .arg(m_sample_rate).arg(m_resampler.tapsPerPhase())
+                                                    : QString("none"))
+             << " ring capacity=" << m_audioBuffer->capacity()
+             << " format.sampleFormat=" << actual.sampleFormat()
+             << " sampleRate=" << actual.sampleRate()
+             << " channelCount=" << actual.channelCount();
     return true;
 }
 
-
-
 bool VoiceDetector::resume()
 {
     if (!m_initialized) {
@@ -215,11 +236,11 @@ bool VoiceDetector::resume()
         return false;
     }
 
-    // QAudioSourceを再開
-    m_audioSource->resume();
+    // 入力元を再開
     m_running = true;
+    m_source->resume();
 
-    qDebug() << "[VoiceDetector] resume capturing. state =" << m_audioSource->state();
+    qDebug() << "[VoiceDetector] resume capturing." << m_source->description();
     return true;
 }
 
@@ -235,9 +256,9 @@ bool VoiceDetector::pause()
     }
 
     // 一時停止
-    m_audioSource->suspend();
+    m_source->suspend();
     m_running = false;
 
-    qDebug() << "[VoiceDetector] pause capturing. state =" << m_audioSource->state();
+    qDebug() << "[VoiceDetector] pause capturing." << m_source->description();
     return true;
 }
@@ -2,30 +2,39 @@
 #define VOICEDETECTOR_H
 
 #include <QObject>
-#include <QAudioSource>
 #include <QByteArray>
 #include <QAudioFormat>
 #include <QIODevice>
-#include <vector>
+#include <memory>
+#include "AudioRingBuffer.h"
 #include "OperationPhase.h"
+#include "PolyphaseResampler.h"
 
 /*
  * VoiceDetector (pull mode):
- *   - 独自の QIODevice を用いて pull モードでマイク入力を取得
- *   - リングバッファに一定長のサンプルを保持 (m_len_ms分)
- *   - 新規に読み取ったサンプルは audioAvailable(...) シグナルでも通知
+ *   - 独自の QIODevice を用いて pull モードで入力元 (AudioCaptureSource) から PCM を受け取る
+ *     既定の入力元はマイク (MicrophoneCaptureSource)。setCaptureSource() で WAV ファイル等に差し替えられる
+ *   - 入力元はネイティブのサンプルレート・チャンネル数のまま開く (OS 側のリサンプルを避ける)
+ *   - 取得したサンプルは float 変換 → モノラルへのダウンミックス → ポリフェーズリサンプラで
+ *     指定レート (16kHz) に変換し、共有のリングバッファ (AudioRingBuffer) に直接書き込む
+ *     (変換はリサンプラの入力領域上で in-place。m_len_ms 分の容量を事前確保し、コールバックごとのヒープ確保はしない)
+ *   - デバイスが最初から指定レートのモノラルなら、従来どおり変換しながらリングバッファへ直接書き込む
+ *   - 新規サンプルが書き込まれたことを audioAvailable() シグナルで通知
+ *     (コンシューマが読み出すまでは再通知しない)
  *
  * 使用例:
  *   VoiceDetector * detector = new VoiceDetector(10000); // 10秒分バッファ
- *   detector->init(16000, 1);  // サンプリングレート16kHz, mono
+ *   engine->setAudioBuffer(detector->audioBuffer());     // リングバッファを共有
+ *   detector->init(16000, 1);  // リングバッファに書き込むレート 16kHz, mono
  *   detector->resume();        // 録音開始
  *   ...
- *   // シグナル: void audioAvailable(std::vector<float> chunk)
- *   //  これを接続して、音声エンジンに chunk を渡すなど
+ *   // シグナル: void audioAvailable()
+ *   //  これを接続して、音声エンジン側でリングバッファから読み出す
  */
 
 // 前方宣言
 class VoicePullIODevice;
+class AudioCaptureSource;
 
 class VoiceDetector : public QObject
 {
@@ -34,27 +43,48 @@ public:
     explicit VoiceDetector(int len_ms, QObject *parent = nullptr);
     ~VoiceDetector();
 
-    // 初期化： オーディオソースのデバイスを開き、フォーマットを設定
+    // 入力元を差し替える (init() より前に呼ぶこと。所有権はこのオブジェクトに移る)
+    //  呼ばなければ init() で既定のマイクを使う
+    void setCaptureSource(AudioCaptureSource *source);
+    AudioCaptureSource *captureSource() const { return m_source; }
+
+    // 初期化： 入力元をネイティブのフォーマットで開く
+    //  sampleRate/channelCount はリングバッファに書き込む形式 (channelCount は 1 のみ対応)
+    //  対応できるフォーマットで入力元を開けなければ false
     bool init(int sampleRate, int channelCount = 1);
+    bool isInitialized() const { return m_initialized; }
+
+    // 変換済みサンプルの書き込み先 (コンシューマと共有する)
+    std::shared_ptr<AudioRingBuffer> audioBuffer() const { return m_audioBuffer; }
 
 public slots:
     bool resume();
     bool pause();
 
 signals:
-    // pull デバイスから読み取ったサンプルを通知
-    // chunk.size() は今回受け取ったサンプル数
-    void audioAvailable(const std::vector<float> & chunk);
+    // audioBuffer() に新しいサンプルが書き込まれたことを通知
+    void audioAvailable();
     void changeOperationPhaseTo(OperationPhase newPhase);
 
 private:
     bool m_running;   // 実行中フラグ
 
     int  m_len_ms      = 0;       // リングバッファで保持したい長さ[ms]
-    int  m_sample_rate = 0;
+    int  m_sample_rate = 0;       // リングバッファに書き込むレート
+    // 入力元が実際に使っているフォーマット (init() で決まる)
+    QAudioFormat::SampleFormat m_sample_format = QAudioFormat::Unknown;
+    int    m_device_rate     = 0;
+    int    m_device_channels = 0;
+    size_t m_bytes_per_sample = 0;
+    void (*m_convert)(const void *, float *, size_t) = nullptr;
+
+    // デバイスのレート → m_sample_rate (レートが同じでモノラルなら使わない)
+    PolyphaseResampler m_resampler;
+    bool               m_needs_resample = false;
+
+    std::shared_ptr<AudioRingBuffer> m_audioBuffer;
 
-    // Qt Multimedia
-    QAudioSource   *m_audioSource   = nullptr;
+    AudioCaptureSource *m_source    = nullptr;
     VoicePullIODevice *m_pullDevice = nullptr; // pullモード用のカスタムQIODevice
 
     bool m_initialized = false;
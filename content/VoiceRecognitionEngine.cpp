@@ -1,19 +1,36 @@
 #include "VoiceRecognitionEngine.h"
-#include "common.h"   // vad_simple, whisper
+#include "AudioRingBuffer.h"
+#include "ComputeBudgetArbiter.h"
+#include "common.h"   // COMMON_SAMPLE_RATE, similarity
 #include "whisper.h"
 
 #include <QDebug>
 #include <QThread>
+#include <algorithm>
 #include <cstring>
 
 VoiceRecognitionEngine::VoiceRecognitionEngine(QObject *parent)
     : QObject(parent)
 {
+    // 清書は1発話ずつ順番に (モデルのロードもこのスレッドで行う)
+    m_refinePool.setMaxThreadCount(1);
 }
 
 VoiceRecognitionEngine::~VoiceRecognitionEngine()
 {
     stop();
+    // 最終デコード・清書のジョブがコンテキストを使い終わるのを待ってから解放する
+    m_decodePool.reset(nullptr, 0);
+    m_refinePool.clear();
+    m_refinePool.waitForDone();
+    if (m_refineCtx) {
+        whisper_free(m_refineCtx);
+        m_refineCtx = nullptr;
+    }
+    if (m_streamState) {
+        whisper_free_state(m_streamState);
+        m_streamState = nullptr;
+    }
     if (m_ctx) {
         whisper_free(m_ctx);
         m_ctx = nullptr;
@@ -22,28 +39,172 @@ VoiceRecognitionEngine::~VoiceRecognitionEngine()
 
 bool VoiceRecognitionEngine::initWhisper(const VoiceRecParams &params)
 {
+    // 即時認識に使うモデル (2パスなら下書き用の軽いモデル)
+    const std::string decodeModel = params.draft_model.empty() ? params.model : params.draft_model;
+
+    // 同じモデルでロード済みならパラメータだけ更新して再利用する
+    if (m_ctx && decodeModel == m_ctxModel) {
+        m_whisper_params = params;
+        configureDecodePool();
+        configureRefinement(params);
+        emit whisperInitialized(true);
+        return true;
+    }
+    if (m_ctx) {
+        m_whisperReady = false;
+        m_decodePool.reset(nullptr, 0);
+        whisper_free_state(m_streamState);
+        m_streamState = nullptr;
+        whisper_free(m_ctx);
+        m_ctx = nullptr;
+        m_ctxModel.clear();
+    }
+
     m_whisper_params = params;
     whisper_context_params cparams = whisper_context_default_params();
     cparams.use_gpu    = m_whisper_params.use_gpu;
     cparams.flash_attn = m_whisper_params.flash_attn;
 
-    m_ctx = whisper_init_from_file_with_params(m_whisper_params.model.c_str(), cparams);
-    if (!m_ctx) {
+    // モデルの重みだけをロードし、state (KV キャッシュ等) は用途ごとに作る
+    m_ctx = whisper_init_from_file_with_params_no_state(decodeModel.c_str(), cparams);
+    if (m_ctx) {
+        m_streamState = whisper_init_state(m_ctx);
+    }
+    if (!m_ctx || !m_streamState) {
         qWarning() << "[VoiceRecognitionEngine] Failed to init whisper from"
-                   << QString::fromStdString(m_whisper_params.model);
+                   << QString::fromStdString(decodeModel);
+        if (m_ctx) {
+            whisper_free(m_ctx);
+            m_ctx = nullptr;
+        }
+        emit whisperInitialized(false);
         return false;
     }
+    m_ctxModel = decodeModel;
+    configureDecodePool();
     qDebug() << "[VoiceRecognitionEngine] Whisper inited. Model:"
-             << QString::fromStdString(m_whisper_params.model);
+             << QString::fromStdString(decodeModel);
+    m_whisperReady = true;
+    emit whisperInitialized(true);
+
+    // 清書用モデルは即時認識を待たせないようにバックグラウンドでロードする
+    configureRefinement(params);
     return true;
 }
 
-void VoiceRecognitionEngine::addAudio(const std::vector<float> & pcms)
+void VoiceRecognitionEngine::configureDecodePool()
+{
+    const int slots = decodeSlotsFor(m_whisper_params);
+    if (m_decodePool.context() == m_ctx && m_decodePool.size() == slots) {
+        return;
+    }
+    m_decodePool.reset(m_ctx, slots);
+    qDebug() << "[VoiceRecognitionEngine] parallel decodes:" << slots
+             << "x" << whisperThreads(m_whisper_params) << "threads";
+}
+
+int VoiceRecognitionEngine::decodeSlotsFor(const VoiceRecParams &params)
 {
-    // 単純に追加
-    m_capturedAudio.insert(m_capturedAudio.end(), pcms.begin(), pcms.end());
-    // qDebug() << "[VoiceRecognitionEngine] addAudio() => added"
-    //          << pcms.size() << "samples. total buffer size =" << m_capturedAudio.size();
+    // 音声処理中の ASR 配分を whisper 1本あたりのスレッド数 (自動なら 4 を目安) で割る
+    //  残りのコアは LLM 用 (ComputeBudgetArbiter が配分する)
+    const int perDecode = params.n_threads > 0 ? params.n_threads : 4;
+    const int slots     = ComputeBudgetArbiter::instance().peakAsrThreads() / perDecode;
+    return std::clamp(slots, 1, std::max(params.max_parallel_decodes, 1));
+}
+
+int VoiceRecognitionEngine::whisperThreads(const VoiceRecParams &params)
+{
+    if (params.n_threads > 0) {
+        return params.n_threads;
+    }
+    // 呼び出すたびに現在の配分を見る (LLM 実行中か、音声処理中か)
+    //  ASR の配分を、プールの並列デコード + このスレッドのストリーミング認識 (1本) で分ける
+    return ComputeBudgetArbiter::instance().threadsFor(ComputeBudgetArbiter::Asr, decodeSlotsFor(params) + 1);
+}
+
+void VoiceRecognitionEngine::configureRefinement(const VoiceRecParams &params)
+{
+    const std::string refineModel = params.draft_model.empty() ? std::string() : params.model;
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+
+    m_refinePool.start([this, refineModel, cparams] {
+        if (refineModel == m_refineModel) {
+            return;
+        }
+        if (m_refineCtx) {
+            whisper_free(m_refineCtx);
+            m_refineCtx = nullptr;
+        }
+        m_refineModel = refineModel;
+        if (refineModel.empty()) {
+            return;
+        }
+        m_refineCtx = whisper_init_from_file_with_params(refineModel.c_str(), cparams);
+        if (!m_refineCtx) {
+            qWarning() << "[VoiceRecognitionEngine] Failed to init refinement whisper from"
+                       << QString::fromStdString(refineModel);
+            return;
+        }
+        qDebug() << "[VoiceRecognitionEngine] Refinement whisper inited. Model:"
+                 << QString::fromStdString(refineModel);
+    });
+}
+
+void VoiceRecognitionEngine::setAudioBuffer(std::shared_ptr<AudioRingBuffer> buffer)
+{
+    m_audioBuffer = std::move(buffer);
+}
+
+void VoiceRecognitionEngine::processAvailableAudio()
+{
+    if (!m_audioBuffer) return;
+
+    // 読み出す前に通知フラグを下ろす (以降の書き込みは再通知される)
+    m_audioBuffer->consumerAwake();
+
+    const AudioRingBuffer::ConstRegion region = m_audioBuffer->beginRead(m_audioBuffer->readAvailable());
+    // 停止中(pause中)の音声は捨てる。再開時に古い音声を認識しないように
+    if (m_running) {
+        const uint64_t before = m_audioHistory.totalWritten();
+        m_audioHistory.append(region.first, region.firstCount);
+        m_audioHistory.append(region.second, region.secondCount);
+        if (m_whisper_params.incremental_mel) {
+            m_mel.update(m_audioHistory);
+        }
+
+        // 新しく届いた分だけをフレーム単位でVADにかける
+        const AudioHistoryBuffer::View fresh = m_audioHistory.range(before, m_audioHistory.totalWritten());
+        m_vadEvents.clear();
+        m_vad.process(fresh.data, fresh.size, fresh.begin, m_vadEvents);
+    }
+    m_audioBuffer->commitRead(region.totalCount());
+
+    const uint64_t dropped = m_audioBuffer->droppedSamples();
+    if (dropped != m_reportedDroppedSamples) {
+        qWarning() << "[VoiceRecognitionEngine] audio ring buffer overflow. dropped samples total ="
+                   << dropped;
+        m_reportedDroppedSamples = dropped;
+    }
+
+    if (m_running) {
+        for (const VadEvent &event : m_vadEvents) {
+            handleVadEvent(event);
+        }
+        // 発話中は一定間隔で途中結果を出す
+        const uint64_t step = uint64_t(COMMON_SAMPLE_RATE) * std::max(m_whisper_params.stream_step_ms, 100) / 1000;
+        if (m_whisper_params.streaming && m_vad.inSpeech()
+            && m_audioHistory.totalWritten() >= m_lastStreamDecodeAt + step) {
+            streamStep();
+        }
+    }
+    m_vadEvents.clear();
+}
+
+void VoiceRecognitionEngine::setEchoGuard(bool active)
+{
+    m_vad.setEchoGuard(active && m_running);
 }
 
 void VoiceRecognitionEngine::start()
@@ -56,11 +217,28 @@ void VoiceRecognitionEngine::start()
         qWarning() << "[VoiceRecognitionEngine] Please initWhisper() first";
         return;
     }
-    m_running = true;
 
-    m_timer = new QTimer(this);
-    connect(m_timer, &QTimer::timeout, this, &VoiceRecognitionEngine::processVadCheck);
-    m_timer->start(2000); // 2000msごとにVADチェック
+    // 録音履歴は推論区間 + 余裕分だけ確保する。長時間待ち受けてもこれ以上は増えない
+    const size_t capacity = historyCapacityFor(m_whisper_params);
+    if (m_audioHistory.capacity() != capacity) {
+        m_audioHistory.reset(capacity);
+        m_audioHistoryBytes = m_audioHistory.memoryBytes();
+        qDebug() << "[VoiceRecognitionEngine] audio history:" << capacity << "samples,"
+                 << m_audioHistoryBytes.load() / 1024 << "KiB";
+    }
+
+    m_vad.reset(vadParamsFor(m_whisper_params), m_audioHistory.totalWritten());
+    m_speechStart   = m_audioHistory.totalWritten();
+    m_consumedUntil = m_audioHistory.totalWritten();
+    resetStreamState(m_consumedUntil);
+
+    if (m_whisper_params.incremental_mel) {
+        m_mel.reset(whisper_model_n_mels(m_ctx), capacity / IncrementalLogMel::kHop + 1,
+                    m_audioHistory.totalWritten());
+        qDebug() << "[VoiceRecognitionEngine] incremental log-mel:" << m_mel.memoryBytes() / 1024 << "KiB";
+    }
+
+    m_running = true;
 
     qDebug() << "[VoiceRecognitionEngine] start() done.";
 }
@@ -69,15 +247,65 @@ void VoiceRecognitionEngine::stop()
 {
     if (!m_running) return;
     m_running = false;
+    ComputeBudgetArbiter::instance().setSpeechActive(false);
 
-    if (m_timer) {
-        m_timer->stop();
-        m_timer->deleteLater();
-        m_timer = nullptr;
-    }
+    // whisper コンテキストは再開時のために保持し、音声バッファだけ捨てる
+    m_audioHistory.clear();
     qDebug() << "[VoiceRecognitionEngine] stop() done.";
 }
 
+StreamingVadParams VoiceRecognitionEngine::vadParamsFor(const VoiceRecParams &params)
+{
+    StreamingVadParams vadParams;
+    vadParams.sample_rate   = COMMON_SAMPLE_RATE;
+    vadParams.frame_ms      = params.vad_frame_ms;
+    vadParams.vad_thold     = params.vad_thold;
+    vadParams.freq_thold    = params.freq_thold;
+    vadParams.min_energy    = params.vad_min_energy;
+    vadParams.min_speech_ms = params.vad_min_speech_ms;
+    vadParams.hangover_ms   = params.vad_hangover_ms;
+    vadParams.preroll_ms    = std::min(params.vad_preroll_ms, params.history_margin_ms);
+    vadParams.max_speech_ms = params.length_for_inference_ms;
+    vadParams.echo_margin         = params.echo_margin;
+    vadParams.echo_min_speech_ms  = params.echo_min_speech_ms;
+    vadParams.echo_calibration_ms = params.echo_calibration_ms;
+    return vadParams;
+}
+
+bool VoiceRecognitionEngine::transcribeSegment(whisper_context *ctx, whisper_state *state, const VoiceRecParams &params,
+                                               const float *samples, size_t count, std::string &text)
+{
+    text.clear();
+    if (count == 0) {
+        return false;
+    }
+    // whisper_full() は 1秒未満の入力だと何も返さないので、短い区間は無音で延ばす
+    std::vector<float> padded;
+    const size_t minSamples = COMMON_SAMPLE_RATE * 1100 / 1000;
+    if (count < minSamples) {
+        padded.assign(minSamples, 0.0f);
+        std::copy(samples, samples + count, padded.begin());
+        samples = padded.data();
+        count   = padded.size();
+    }
+
+    std::vector<DecodedToken> tokens;
+    int langId = -1;
+    if (!runWhisper(ctx, state, params, {}, samples, count, 0, false, tokens, langId)) {
+        return false;
+    }
+    for (const DecodedToken &token : tokens) {
+        text += token.text;
+    }
+    return true;
+}
+
+size_t VoiceRecognitionEngine::historyCapacityFor(const VoiceRecParams &params) const
+{
+    const int64_t ms = int64_t(params.length_for_inference_ms) + std::max(params.history_margin_ms, 0);
+    return static_cast<size_t>(COMMON_SAMPLE_RATE * ms / 1000);
+}
+
 void VoiceRecognitionEngine::setLanguage(const QString &language) {
     std::string langStd = language.toStdString();
     // チェック
@@ -90,52 +318,282 @@ void VoiceRecognitionEngine::setLanguage(const QString &language) {
     m_whisper_params.language = langStd; // 有効なのでセット
 }
 
-void VoiceRecognitionEngine::processVadCheck()
+void VoiceRecognitionEngine::handleVadEvent(const VadEvent &event)
 {
-    if (!m_running) return;
-    // qDebug() << "[VoiceRecognitionEngine] processVadCheck. buffer size =" << m_capturedAudio.size();
+    const uint64_t padding = uint64_t(COMMON_SAMPLE_RATE) * std::max(m_whisper_params.segment_padding_ms, 0) / 1000;
 
-    if (m_capturedAudio.size() < COMMON_SAMPLE_RATE * 2) {
-        // 2秒分ないとVADチェックできない (例)
+    if (event.type == VadEvent::SpeechStart) {
+        m_speechStart    = event.sample;
+        m_utteranceBegin = std::max(m_speechStart > padding ? m_speechStart - padding : 0, m_consumedUntil);
+        resetStreamState(m_utteranceBegin);
+        if (m_vad.echoGuardActive()) {
+            // 読み上げへの割り込み。以降の判定 (発話終了) は通常の感度に戻す
+            m_vad.setEchoGuard(false);
+            emit bargeInDetected();
+        }
+        // 発話中は LLM のスレッドを減らして音声側にコアを回す
+        ComputeBudgetArbiter::instance().setSpeechActive(true);
+        changeOperationPhaseTo(VadRunning);
         return;
     }
 
-    changeOperationPhaseTo(VadRunning);
-    // 直近2秒分コピー
-    const int sample_counts_for_VAD_check = COMMON_SAMPLE_RATE * 2;
-    if (int(m_capturedAudio.size()) < sample_counts_for_VAD_check) return;
+    // 発話終了 → 検出した区間 (+後ろの余白) のうち未確定部分だけを認識
+    finalizeUtterance(std::min(event.sample + padding, m_audioHistory.totalWritten()));
+}
 
-    std::vector<float> audio_for_inference_new(sample_counts_for_VAD_check);
-    memcpy(audio_for_inference_new.data(), &m_capturedAudio[m_capturedAudio.size() - sample_counts_for_VAD_check], sample_counts_for_VAD_check * sizeof(float));
+void VoiceRecognitionEngine::resetStreamState(uint64_t position)
+{
+    m_committedText.clear();
+    m_committedTokens.clear();
+    m_hypothesis.clear();
+    m_streamPos          = position;
+    m_lastStreamDecodeAt = position;
+}
 
-    // 簡易VAD
-    if (!vad_simple(audio_for_inference_new, COMMON_SAMPLE_RATE, 1000,
-                    m_whisper_params.vad_thold, m_whisper_params.freq_thold, false)) {
-        qDebug() << "[VoiceRecognitionEngine] VAD => no speech detected.";
-        // 無音
+void VoiceRecognitionEngine::streamStep()
+{
+    const uint64_t now = m_audioHistory.totalWritten();
+    m_lastStreamDecodeAt = now;
+
+    if (!decodeRange(m_streamPos, now, true, m_decodeScratch)) {
         return;
     }
 
-    // 音声アリ → length_ms分を取り出して認識
-    const int samples_count_for_inference = (COMMON_SAMPLE_RATE * m_whisper_params.length_for_inference_ms) / 1000;
-    if (int(m_capturedAudio.size()) < samples_count_for_inference) {
-        // データが不十分
-        qDebug() << "[VoiceRecognitionEngine] Not enough data for inference yet.";
-        return;
+    // 前回の仮説と先頭から一致している部分は安定しているとみなして確定する
+    size_t agreed = 0;
+    while (agreed < m_decodeScratch.size() && agreed < m_hypothesis.size()
+           && m_decodeScratch[agreed].id == m_hypothesis[agreed].id) {
+        ++agreed;
+    }
+    // 未確定部分が長くなりすぎたら (一致しないまま喋り続けている) 現在の仮説で確定してしまう
+    const uint64_t maxWindow = uint64_t(COMMON_SAMPLE_RATE) * m_whisper_params.stream_max_window_ms / 1000;
+    if (now - m_streamPos > maxWindow && !m_decodeScratch.empty()) {
+        agreed = m_decodeScratch.size();
     }
 
-    std::vector<float> audio_for_inference(samples_count_for_inference);
-    memcpy(audio_for_inference.data(), &m_capturedAudio[m_capturedAudio.size() - samples_count_for_inference], samples_count_for_inference*sizeof(float));
+    if (agreed > 0) {
+        for (size_t i = 0; i < agreed; ++i) {
+            m_committedText += m_decodeScratch[i].text;
+            m_committedTokens.push_back(m_decodeScratch[i].id);
+        }
+        // 確定したトークンの終わりまで音声を進める (次回からはそれ以降だけをデコード)
+        m_streamPos = std::clamp(m_decodeScratch[agreed - 1].end, m_streamPos, now);
+        m_decodeScratch.erase(m_decodeScratch.begin(), m_decodeScratch.begin() + agreed);
+    }
+    m_hypothesis.swap(m_decodeScratch);
 
-    // qDebug() << "[VoiceRecognitionEngine] VAD => speech detected. Running whisper...";
-    runWhisper(audio_for_inference);
+    std::string interim = m_committedText;
+    for (const DecodedToken &token : m_hypothesis) {
+        interim += token.text;
+    }
+    emit interimTextRecognized(QString::fromUtf8(interim).trimmed());
 }
 
-void VoiceRecognitionEngine::runWhisper(const std::vector<float> & audio_for_inference)
+void VoiceRecognitionEngine::finalizeUtterance(uint64_t end)
 {
-    if (!m_ctx) return;
-
     changeOperationPhaseTo(WhisperRunning);
+
+    // 最後のデコードは未確定の残りだけ
+    //  区間の入力とプロンプトをコピーしてプールで実行し、このスレッドはすぐ次の音声の取り込みに戻る
+    //  (続けて話しても前の発話のデコードを待たずに VAD・ストリーミングを続けられる)
+    struct FinalDecode {
+        VoiceRecParams             params;
+        std::string                committedText;
+        std::vector<whisper_token> prompt;
+        std::vector<float>         input;       // PCM、または whisper_set_mel() 用のメル
+        int                        melLen = 0;  // > 0 ならメル入力
+        int                        nMel   = 0;
+        size_t                     count  = 0;
+        uint64_t                   begin  = 0;
+        std::vector<float>         refinePcm;   // 2パス認識の清書用 (発話全体)
+    };
+    auto job = std::make_shared<FinalDecode>();
+    job->params        = m_whisper_params;
+    job->committedText = m_committedText;
+    job->prompt        = m_committedTokens;
+
+    const AudioHistoryBuffer::View view = inferenceRange(m_streamPos, end);
+    job->count = view.size;
+    job->begin = view.begin;
+    if (!view.empty()) {
+        if (m_whisper_params.incremental_mel && m_mel.isReady()) {
+            // whisper 自身と同じく 30 秒分の無音を後ろに付ける
+            m_mel.buildWhisperInput(m_audioHistory, view.begin, view.end(), 3000, job->input, job->melLen);
+            job->nMel = m_mel.nMel();
+        } else {
+            // whisper_full() は 1秒未満の入力だと何も返さないので、短い区間は無音で延ばす
+            job->input.assign(std::max<size_t>(view.size, COMMON_SAMPLE_RATE * 1100 / 1000), 0.0f);
+            std::copy(view.data, view.data + view.size, job->input.begin());
+        }
+    }
+    // 履歴バッファはデコード中にも上書きされるので、清書に使う発話全体もここでコピーしておく
+    if (!m_whisper_params.draft_model.empty()) {
+        const AudioHistoryBuffer::View whole = m_audioHistory.range(m_utteranceBegin, end);
+        job->refinePcm.assign(std::max<size_t>(whole.size, COMMON_SAMPLE_RATE * 1100 / 1000), 0.0f);
+        std::copy(whole.data, whole.data + whole.size, job->refinePcm.begin());
+    }
+
+    // 成否にかかわらずこの区間は消費済みにする
+    m_consumedUntil = std::max(m_consumedUntil, end);
+    resetStreamState(m_consumedUntil);
+    // 以降はプールのジョブが実行中の間だけ音声処理中として扱われる (AsrScope)
+    ComputeBudgetArbiter::instance().setSpeechActive(false);
+
+    const bool submitted = m_decodePool.submit([this, job](whisper_context *ctx, whisper_state *state) {
+        ComputeBudgetArbiter::AsrScope asrScope;
+        std::string result = job->committedText;
+        int langId = -1;
+        if (state && job->count > 0) {
+            std::vector<DecodedToken> tokens;
+            bool ok = true;
+            const float *samples = job->input.data();
+            if (job->melLen > 0) {
+                samples = nullptr;
+                if (whisper_set_mel_with_state(ctx, state, job->input.data(), job->melLen, job->nMel) != 0) {
+                    qWarning() << "[VoiceRecognitionEngine] whisper_set_mel failed.";
+                    ok = false;
+                }
+            }
+            const size_t count = samples ? job->input.size() : job->count;
+            if (ok && runWhisper(ctx, state, job->params, job->prompt, samples, count, job->begin,
+                                 false, tokens, langId)) {
+                for (const DecodedToken &token : tokens) {
+                    result += token.text;
+                }
+            }
+        }
+
+        // 結果の通知・清書の投入はこのオブジェクトのスレッドで、発話順に行う
+        return WhisperStatePool::Completion([this, job, result, langId] {
+            QMetaObject::invokeMethod(this, [this, job, result, langId] {
+                applyDetectedLanguage(langId);
+
+                // 結果をシグナルで外部へ通知
+                // (途中結果と同じく前後の空白を落とす。LLM の先読みプリフィルとトークンが揃うように)
+                const QString text = QString::fromUtf8(result).trimmed();
+                emit finalTextRecognized(text);
+
+                // 2パス認識なら同じ発話全体を清書モデルにも回す
+                if (!job->refinePcm.empty() && !text.isEmpty()) {
+                    submitRefinement(text, std::move(job->refinePcm));
+                }
+            }, Qt::QueuedConnection);
+        });
+    });
+    if (!submitted) {
+        qWarning() << "[VoiceRecognitionEngine] decode pool is not ready. Utterance dropped.";
+    }
+}
+
+void VoiceRecognitionEngine::submitRefinement(const QString &draftText, std::vector<float> pcm)
+{
+    const VoiceRecParams params = m_whisper_params;
+    m_refinePool.start([this, pcm = std::move(pcm), draftText, params] {
+        if (!m_refineCtx) {
+            return;
+        }
+        ComputeBudgetArbiter::AsrScope asrScope;
+        whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+        wparams.print_progress   = false;
+        wparams.print_special    = false;
+        wparams.print_realtime   = false;
+        wparams.print_timestamps = false;
+        wparams.translate        = false;
+        wparams.single_segment   = true;
+        wparams.language         = params.language.c_str();
+        wparams.n_threads        = whisperThreads(params);
+        if (params.adaptive_audio_ctx) {
+            const int ctx = int((pcm.size() * 50 + COMMON_SAMPLE_RATE - 1) / COMMON_SAMPLE_RATE) + params.audio_ctx_margin;
+            wparams.audio_ctx = std::min(ctx, 1500);
+        }
+
+        const int ret = whisper_full(m_refineCtx, wparams, pcm.data(), int(pcm.size()));
+        if (ret != 0) {
+            qWarning() << "[VoiceRecognitionEngine] refinement whisper_full failed with code:" << ret;
+            return;
+        }
+        QString refined;
+        const int n_segments = whisper_full_n_segments(m_refineCtx);
+        for (int i = 0; i < n_segments; i++) {
+            refined += QString::fromUtf8(whisper_full_get_segment_text(m_refineCtx, i));
+        }
+
+        // 大文字小文字や前後の空白の違いだけなら LLM へ出し直さない
+        const float sim = similarity(draftText.trimmed().toLower().toStdString(),
+                                     refined.trimmed().toLower().toStdString());
+        qDebug() << "[VoiceRecognitionEngine] refined:" << refined << "similarity =" << sim;
+        if (sim < params.refine_similarity_thold && !refined.trimmed().isEmpty()) {
+            emit transcriptRefined(draftText, refined);
+        }
+    });
+}
+
+AudioHistoryBuffer::View VoiceRecognitionEngine::inferenceRange(uint64_t begin, uint64_t end) const
+{
+    if (end <= begin) {
+        return {};
+    }
+    // 区間は推論長で頭打ち (超える分は古い側を捨てる)
+    const uint64_t maxSamples = uint64_t(COMMON_SAMPLE_RATE) * m_whisper_params.length_for_inference_ms / 1000;
+    if (end - begin > maxSamples) {
+        begin = end - maxSamples;
+    }
+    return m_audioHistory.range(begin, end);
+}
+
+bool VoiceRecognitionEngine::decodeRange(uint64_t begin, uint64_t end, bool withTimestamps,
+                                         std::vector<DecodedToken> &tokens)
+{
+    tokens.clear();
+    if (!m_streamState) {
+        return false;
+    }
+    const AudioHistoryBuffer::View view = inferenceRange(begin, end);
+    if (view.empty()) {
+        return false;
+    }
+
+    int langId = -1;
+    bool ok = false;
+    // 計算済みのメルを渡す (PCM から計算し直さないので、エンコーダがすぐ走り出す)
+    //  token_timestamps は PCM のエネルギーを使うので、その場合だけ PCM 経由にする
+    if (!withTimestamps && m_whisper_params.incremental_mel && m_mel.isReady()) {
+        int nLen = 0;
+        // whisper 自身と同じく 30 秒分の無音を後ろに付ける
+        m_mel.buildWhisperInput(m_audioHistory, view.begin, view.end(), 3000, m_melScratch, nLen);
+        if (nLen > 0 && whisper_set_mel_with_state(m_ctx, m_streamState, m_melScratch.data(), nLen, m_mel.nMel()) == 0) {
+            ok = runWhisper(m_ctx, m_streamState, m_whisper_params, m_committedTokens,
+                            nullptr, view.size, view.begin, withTimestamps, tokens, langId);
+            applyDetectedLanguage(langId);
+            return ok;
+        }
+        qWarning() << "[VoiceRecognitionEngine] whisper_set_mel failed. Falling back to PCM input.";
+    }
+
+    // whisper_full() は 1秒未満の入力だと何も返さないので、短い区間は無音で延ばす
+    //  (通常は履歴バッファをコピーせずそのまま渡す)
+    const size_t minSamples = COMMON_SAMPLE_RATE * 1100 / 1000;
+    if (view.size < minSamples) {
+        m_padScratch.assign(minSamples, 0.0f);
+        std::copy(view.data, view.data + view.size, m_padScratch.begin());
+        ok = runWhisper(m_ctx, m_streamState, m_whisper_params, m_committedTokens,
+                        m_padScratch.data(), m_padScratch.size(), view.begin, withTimestamps, tokens, langId);
+    } else {
+        ok = runWhisper(m_ctx, m_streamState, m_whisper_params, m_committedTokens,
+                        view.data, view.size, view.begin, withTimestamps, tokens, langId);
+    }
+    applyDetectedLanguage(langId);
+    return ok;
+}
+
+bool VoiceRecognitionEngine::runWhisper(whisper_context *ctx, whisper_state *state, const VoiceRecParams &params,
+                                        const std::vector<whisper_token> &prompt, const float *samples, size_t count,
+                                        uint64_t begin, bool withTimestamps, std::vector<DecodedToken> &tokens,
+                                        int &langId)
+{
+    langId = -1;
+    if (!ctx || !state) return false;
+
     // Whisper の推論パラメータを設定
     whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
     wparams.print_progress   = false;
@@ -144,40 +602,73 @@ void VoiceRecognitionEngine::runWhisper(const std::vector<float> & audio_for_inf
     wparams.print_timestamps = false;
     wparams.translate        = false;
     wparams.single_segment   = true;
-    wparams.language         = m_whisper_params.language.c_str(); // "auto" or e.g. "en", "ja"
-    wparams.n_threads        = 4; // 適宜
+    wparams.language         = params.language.c_str(); // "auto" or e.g. "en", "ja"
+    wparams.n_threads        = whisperThreads(params);
+    // エンコーダは既定で常に30秒分 (1500) を処理するので、短い区間では区間長に合わせて縮める
+    //  audio_ctx は 1 あたり 20ms
+    //  メル入力の場合も 1秒未満だと何も返さないので、短い区間は後ろの無音ごと 1.1秒として扱う
+    const size_t inputSamples = samples ? count : std::max<size_t>(count, COMMON_SAMPLE_RATE * 1100 / 1000);
+    if (params.adaptive_audio_ctx) {
+        const int audioCtx = int((inputSamples * 50 + COMMON_SAMPLE_RATE - 1) / COMMON_SAMPLE_RATE) + params.audio_ctx_margin;
+        wparams.audio_ctx = std::min(audioCtx, 1500);
+    }
+    if (!samples) {
+        // セットしたメルは30秒分の無音付きなので、音声部分だけをデコードさせる
+        wparams.duration_ms = int(inputSamples * 1000 / COMMON_SAMPLE_RATE);
+    }
+    // 確定済みテキストをプロンプトとして引き継ぐ (文脈が切れないように)
+    //  長すぎる分は whisper 側で n_text_ctx/2 に切り詰められる
+    if (!prompt.empty()) {
+        wparams.prompt_tokens   = prompt.data();
+        wparams.prompt_n_tokens = int(prompt.size());
+    }
+    // ストリーミング中はどこまで確定したかを知るためにトークン単位のタイムスタンプが要る
+    wparams.token_timestamps = withTimestamps;
 
     // 推論実行
-    const int ret = whisper_full(m_ctx, wparams, audio_for_inference.data(), audio_for_inference.size());
+    const int ret = whisper_full_with_state(ctx, state, wparams, samples, samples ? int(count) : 0);
     if (ret != 0) {
         qWarning() << "[VoiceRecognitionEngine] whisper_full failed with code:" << ret;
-        return;
+        return false;
     }
 
     // ■「自動言語検出」を使っている場合、Whisper が検出した言語IDを取得
     //   (もちろん "auto" 以外でも呼び出せますが、英語専用モデルなどでは正しく動作しない場合も)
-    if (strcmp(m_whisper_params.language.c_str(), "auto") == 0) {
-        const int detectedLangId = whisper_full_lang_id(m_ctx);  // -1 の場合は検出失敗
-        if (detectedLangId >= 0) {
-            const char * detectedLangCode = whisper_lang_str(detectedLangId);
-            // 必要であれば、検出言語をメンバ変数に保存するなど:
-            const QLocale locale(QString::fromLatin1(detectedLangCode));
-            setDetectedVoiceLocale(locale);
-        } else {
+    if (strcmp(params.language.c_str(), "auto") == 0) {
+        langId = whisper_full_lang_id_from_state(state);  // -1 の場合は検出失敗
+        if (langId < 0) {
             qWarning() << "[VoiceRecognitionEngine] Failed to detect language.";
         }
     }
 
-    // ■ Whisper の文字起こし結果を取得
-    QString result;
-    int n_segments = whisper_full_n_segments(m_ctx);
+    // ■ Whisper の文字起こし結果をトークン単位で取得 (特殊トークンは除く)
+    const whisper_token eot = whisper_token_eot(ctx);
+    const uint64_t end = begin + count;
+    const int n_segments = whisper_full_n_segments_from_state(state);
     for (int i = 0; i < n_segments; i++) {
-        const char* seg_txt = whisper_full_get_segment_text(m_ctx, i);
-        result += QString::fromUtf8(seg_txt);
+        const int n_tokens = whisper_full_n_tokens_from_state(state, i);
+        for (int j = 0; j < n_tokens; j++) {
+            const whisper_token_data data = whisper_full_get_token_data_from_state(state, i, j);
+            if (data.id >= eot) {
+                continue;
+            }
+            // t1 は 10ms 単位
+            const uint64_t tokenEnd = withTimestamps && data.t1 >= 0
+                                          ? std::min(begin + uint64_t(data.t1) * COMMON_SAMPLE_RATE / 100, end)
+                                          : end;
+            tokens.push_back({data.id, whisper_full_get_token_text_from_state(ctx, state, i, j), tokenEnd});
+        }
     }
+    return true;
+}
 
-    // 結果をシグナルで外部へ通知
-    emit textRecognized(result);
+void VoiceRecognitionEngine::applyDetectedLanguage(int langId)
+{
+    if (langId < 0) {
+        return;
+    }
+    const char * detectedLangCode = whisper_lang_str(langId);
+    setDetectedVoiceLocale(QLocale(QString::fromLatin1(detectedLangCode)));
 }
 
 QLocale VoiceRecognitionEngine::detectedVoiceLocale() const
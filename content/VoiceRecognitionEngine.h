@@ -2,24 +2,72 @@
 #define VOICERECOGNITIONENGINE_H
 
 #include <QObject>
-#include <QTimer>
 #include <QLocale>
+#include <QThreadPool>
+#include <cstdint>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <memory>
 #include "OperationPhase.h"
+#include "AudioHistoryBuffer.h"
+#include "StreamingVad.h"
+#include "IncrementalLogMel.h"
+#include "WhisperStatePool.h"
 
 struct whisper_context;
+struct whisper_state;
+typedef int32_t whisper_token;
+class AudioRingBuffer;
 
 // 簡易パラメータ
 struct VoiceRecParams {
     int   length_for_inference_ms  = 10000;  // 10秒
+    int   history_margin_ms        = 2000;   // 推論区間より前に保持しておく余裕 (発話頭のプリロール用)
     float vad_thold  = 0.6f;
     float freq_thold = 100.0f;
 
+    // フレーム単位VAD (StreamingVad) の設定
+    int   vad_frame_ms      = 20;
+    float vad_min_energy    = 0.002f;
+    int   vad_min_speech_ms = 60;
+    int   vad_hangover_ms   = 100;   // 発話終了の検出遅延はほぼこの値
+    int   vad_preroll_ms    = 200;   // history_margin_ms 以下にすること
+
+    // 割り込み (barge-in): 読み上げ中もマイクを止めず、エコーを十分に上回る声が続いたら割り込みとみなす
+    float echo_margin         = 2.5f;  // 読み上げ中に学習したエコーの大きさの何倍で有声とするか
+    int   echo_min_speech_ms  = 150;   // 割り込みと判定するまでの長さ
+    int   echo_calibration_ms = 300;   // 読み上げ開始直後はエコーの学習だけ行う
+
+    // 発話区間の切り出し
+    int   segment_padding_ms = 80;   // 検出した発話区間の前後に付け足す余白
+    bool  adaptive_audio_ctx = true; // 短い区間ではエンコーダの audio_ctx を区間長に合わせて縮める
+    int   audio_ctx_margin   = 64;   // audio_ctx に足す余裕 (1 = 20ms。小さすぎると認識が崩れる)
+
+    // ストリーミング認識 (発話中に途中結果を出す)
+    bool  streaming            = true;
+    int   stream_step_ms       = 500;   // 発話中、この間隔で未確定部分を再デコード
+    int   stream_max_window_ms = 6000;  // 未確定部分がこれより長くなったら現在の仮説をまるごと確定
+
+    // ログメルを録音と並行して計算しておき whisper_set_mel() で渡す
+    //  (トークン単位のタイムスタンプが要るストリーミング途中のデコードは PCM から)
+    bool  incremental_mel      = true;
+
+    // 発話の最終デコードは WhisperStatePool で並列に実行する
+    //  n_threads: whisper 1本あたりのスレッド数。0 なら ComputeBudgetArbiter の ASR 配分を並列数で割る
+    //  並列数は (音声処理中の ASR 配分 / 1本あたりのスレッド数) で、max_parallel_decodes が上限
+    int   n_threads            = 0;
+    int   max_parallel_decodes = 2;
+
     bool  use_gpu    = true;
     bool  flash_attn = false;
     std::string language = "en";
     std::string model    = WHISPER_MODEL_NAME;
+
+    // 2パス認識: draft_model を指定すると、そのモデル (tiny/base など) で即時に認識して結果を出し、
+    // model のモデルで同じ発話をバックグラウンドで認識し直す (空なら model だけで1パス)
+    std::string draft_model;
+    float refine_similarity_thold = 0.8f;   // 下書きとの similarity() がこれ未満なら清書結果を通知
 };
 
 class VoiceRecognitionEngine : public QObject
@@ -36,45 +84,131 @@ public:
     ~VoiceRecognitionEngine();
 
     // whisper初期化
+    //  - モデルのロードは重い(数秒)ので、必ずこのオブジェクトが属するスレッド上で呼ぶこと
+    //  - 一度ロードしたコンテキストは start()/stop() をまたいで保持し再利用する
+    //  - 完了時に whisperInitialized(bool) を emit
     bool initWhisper(const VoiceRecParams &params);
+    bool isWhisperReady() const { return m_whisperReady; }
 
-    // 録音データを受け取る
-    //  ここは外部(VoiceDetector等)から呼ばれる
-    Q_INVOKABLE void addAudio(const std::vector<float> & pcmf32);
+    // 録音データの供給元 (VoiceDetector と共有するリングバッファ)
+    //  スレッド開始前に一度だけ設定すること
+    void setAudioBuffer(std::shared_ptr<AudioRingBuffer> buffer);
 
     bool isRunning() const { return m_running; }
 
+    // 録音履歴に確保しているメモリ [bytes] (length_for_inference_ms + history_margin_ms で頭打ち)
+    size_t audioHistoryMemoryBytes() const { return m_audioHistoryBytes; }
+
     void setLanguage(const QString & language);
 
     QLocale detectedVoiceLocale() const;
     void setDetectedVoiceLocale(const QLocale &newDetectedVoiceLocale);
 
+    // 録音以外の経路 (バッチ文字起こし等) でも同じ設定で認識するためのヘルパー
+    //  - params から StreamingVad の設定を作る
+    static StreamingVadParams vadParamsFor(const VoiceRecParams &params);
+    //  - 1区間を state で認識して text に入れる (1秒未満は無音で延ばす)。スレッドセーフ
+    static bool transcribeSegment(whisper_context *ctx, whisper_state *state, const VoiceRecParams &params,
+                                  const float *samples, size_t count, std::string &text);
+
 signals:
-    // 音声が認識されテキストが確定したらemit
-    void textRecognized(const QString & text);
+    // 発話中の途中結果 (確定済みテキスト + 未確定の仮説)。発話が終わるまで何度も emit される
+    void interimTextRecognized(const QString & text);
+    // 発話が終わり全文が確定したらemit
+    void finalTextRecognized(const QString & text);
 
     void detectedVoiceLocaleChanged(const QLocale&);
     void changeOperationPhaseTo(OperationPhase newPhase);
+    // エコーガード中 (読み上げ中) にユーザーが話し始めた。続く発話はそのまま認識される
+    void bargeInDetected();
+    // initWhisper() の完了通知 (success == false ならモデルのロードに失敗)
+    void whisperInitialized(bool success);
+    // 2パス認識で、清書モデルの結果が下書き (finalTextRecognized で通知済み) と十分に異なるときにemit
+    //  (バックグラウンドのスレッドから emit される)
+    void transcriptRefined(const QString & draftText, const QString & refinedText);
 
 public slots:
-    // ループ開始/停止 (VAD判定など)
+    // 認識開始/停止 (VAD判定など)
     void start();
     void stop();
 
-private slots:
-    void processVadCheck();
+    // リングバッファに溜まった録音データを取り込む
+    //  VoiceDetector::audioAvailable() から (キュー経由で) 呼ばれる
+    void processAvailableAudio();
 
-private:
-    void runWhisper(const std::vector<float> & pcmf32);
+    // 読み上げ中は true (割り込み検出のため、VAD をエコーガードで動かす)
+    void setEchoGuard(bool active);
 
-    struct whisper_context * m_ctx = nullptr;
+private:
+    // whisper が出力したテキストトークン (特殊トークンは除く)
+    struct DecodedToken {
+        whisper_token id;
+        std::string   text;   // UTF-8。1文字が複数トークンに分かれることもある
+        uint64_t      end;    // トークンの終端 (絶対サンプル位置)
+    };
+
+    void handleVadEvent(const VadEvent &event);
+    void streamStep();
+    void finalizeUtterance(uint64_t end);
+    void resetStreamState(uint64_t position);
+    void configureRefinement(const VoiceRecParams &params);
+    void submitRefinement(const QString &draftText, std::vector<float> pcm);
+    // [begin, end) を committed トークンをプロンプトにしてデコードし、tokens に結果を入れる
+    bool decodeRange(uint64_t begin, uint64_t end, bool withTimestamps, std::vector<DecodedToken> &tokens);
+    // 推論長で頭打ちにした [begin, end) の録音
+    AudioHistoryBuffer::View inferenceRange(uint64_t begin, uint64_t end) const;
+    // state で whisper_full を実行する。samples == nullptr のときは whisper_set_mel() 済みのメルをそのまま使う
+    //  (count は区間長)。プールのスレッドからも呼ぶのでメンバには触らない
+    //  langId: language == "auto" のとき検出した言語 (それ以外・失敗時は -1)
+    static bool runWhisper(whisper_context *ctx, whisper_state *state, const VoiceRecParams &params,
+                           const std::vector<whisper_token> &prompt, const float *samples, size_t count,
+                           uint64_t begin, bool withTimestamps, std::vector<DecodedToken> &tokens, int &langId);
+    void applyDetectedLanguage(int langId);
+    void configureDecodePool();
+    static int decodeSlotsFor(const VoiceRecParams &params);
+    static int whisperThreads(const VoiceRecParams &params);
+    size_t historyCapacityFor(const VoiceRecParams &params) const;
+
+    struct whisper_context * m_ctx = nullptr;    // 即時認識用 (draft_model があればそちら)。state なしでロード
+    struct whisper_state   * m_streamState = nullptr; // 発話中の途中デコード用 (このオブジェクトのスレッド専用)
+    std::string     m_ctxModel;                  // m_ctx にロードしたモデル
     VoiceRecParams  m_whisper_params;
+    WhisperStatePool m_decodePool;               // 発話の最終デコード (m_ctx を共有)
 
-    // 音声保存用
-    std::vector<float> m_capturedAudio;
+    // 2パス認識の清書用。m_refineCtx/m_refineModel は m_refinePool のスレッドからだけ触る
+    //  (プールは1スレッドなのでジョブは順番に実行される)
+    struct whisper_context * m_refineCtx = nullptr;
+    std::string     m_refineModel;
+    QThreadPool     m_refinePool;
 
-    QTimer * m_timer = nullptr;
-    bool     m_running = false;
+    // 音声保存用
+    std::shared_ptr<AudioRingBuffer> m_audioBuffer;
+    AudioHistoryBuffer m_audioHistory;           // 直近の音声だけを保持 (固定容量)
+    std::atomic<size_t> m_audioHistoryBytes {0};
+    uint64_t           m_reportedDroppedSamples = 0;
+
+    StreamingVad          m_vad;
+    std::vector<VadEvent> m_vadEvents;           // process() の出力先 (使い回し)
+    uint64_t              m_speechStart   = 0;   // 現在の発話の開始位置 (絶対サンプル位置)
+    uint64_t              m_utteranceBegin = 0;  // 現在の発話で認識に使う区間の先頭 (余白込み)
+    uint64_t              m_consumedUntil = 0;   // ここより前は認識済み (二重に認識しない)
+    std::vector<float>    m_padScratch;          // 1秒未満の区間を無音で延ばすための作業領域
+
+    IncrementalLogMel     m_mel;                 // 録音と並行して計算するログメル
+    std::vector<float>    m_melScratch;          // whisper_set_mel() に渡す配列 (使い回し)
+
+    // ストリーミング認識の状態 (1発話ごとにリセット)
+    //  m_streamPos より前の音声は committed として確定済み。以降だけを毎回デコードし直す
+    std::string                m_committedText;
+    std::vector<whisper_token> m_committedTokens;   // 次のデコードのプロンプトに使う
+    std::vector<DecodedToken>  m_hypothesis;        // 前回デコードした未確定部分
+    std::vector<DecodedToken>  m_decodeScratch;
+    uint64_t                   m_streamPos = 0;
+    uint64_t                   m_lastStreamDecodeAt = 0;
+
+    // isRunning()/isWhisperReady() は GUI スレッドからも参照されるので atomic
+    std::atomic<bool> m_running {false};
+    std::atomic<bool> m_whisperReady {false};
 
     QLocale m_detectedVoiceLocale;
 };
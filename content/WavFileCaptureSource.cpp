@@ -0,0 +1,177 @@
+#include "WavFileCaptureSource.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QIODevice>
+#include <algorithm>
+#include "dr_wav.h"
+
+struct WavFileCaptureSource::WavReader
+{
+    drwav wav;
+};
+
+namespace {
+constexpr int kPumpIntervalMs = 10;   // 実時間モードのタイマー間隔
+constexpr int kFastChunkMs    = 20;   // 最速モードで1回に流す長さ
+constexpr int kMaxChunkMs     = 100;  // 1回の write() の上限 (マイクのコールバックと同程度に保つ)
+}
+
+WavFileCaptureSource::WavFileCaptureSource(const QString &path, double speed,
+                                           int trailingSilenceMs, QObject *parent)
+    : AudioCaptureSource(parent)
+    , m_path(path)
+    , m_speed(speed)
+    , m_trailingSilenceMs(std::max(trailingSilenceMs, 0))
+    , m_timer(this)
+{
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &WavFileCaptureSource::pump);
+}
+
+WavFileCaptureSource::~WavFileCaptureSource()
+{
+    stop();
+}
+
+bool WavFileCaptureSource::open()
+{
+    if (m_wav) {
+        return true;
+    }
+
+    auto reader = std::make_unique<WavReader>();
+    if (!drwav_init_file(&reader->wav, QFile::encodeName(m_path).constData(), nullptr)) {
+        qWarning() << "[WavFileCaptureSource] failed to open" << m_path;
+        return false;
+    }
+    if (reader->wav.sampleRate == 0 || reader->wav.channels == 0) {
+        qWarning() << "[WavFileCaptureSource] invalid WAV header" << m_path;
+        drwav_uninit(&reader->wav);
+        return false;
+    }
+
+    // dr_wav が float に変換して読むので、形式は常に Float (レート・チャンネル数はファイルのまま)
+    m_format.setSampleFormat(QAudioFormat::Float);
+    m_format.setSampleRate(int(reader->wav.sampleRate));
+    m_format.setChannelCount(int(reader->wav.channels));
+
+    m_totalFrames   = reader->wav.totalPCMFrameCount;
+    m_silenceFrames = quint64(m_trailingSilenceMs) * reader->wav.sampleRate / 1000;
+    m_framesPushed  = 0;
+    m_endOfFileSent = false;
+    m_playedMsBeforeResume = 0;
+    m_chunk.reserve(size_t(reader->wav.sampleRate) * reader->wav.channels * kMaxChunkMs / 1000);
+    m_wav = std::move(reader);
+    return true;
+}
+
+QString WavFileCaptureSource::description() const
+{
+    return QFileInfo(m_path).fileName();
+}
+
+qint64 WavFileCaptureSource::durationMs() const
+{
+    const int rate = m_format.sampleRate();
+    return rate > 0 ? qint64(m_totalFrames * 1000 / quint64(rate)) : 0;
+}
+
+void WavFileCaptureSource::start(QIODevice *sink)
+{
+    // マイクと違い、resume() されるまでは何も書き込まない
+    m_sink = sink;
+}
+
+void WavFileCaptureSource::stop()
+{
+    m_timer.stop();
+    m_sink = nullptr;
+    if (m_wav) {
+        drwav_uninit(&m_wav->wav);
+        m_wav.reset();
+    }
+}
+
+void WavFileCaptureSource::suspend()
+{
+    if (!m_timer.isActive()) {
+        return;
+    }
+    m_timer.stop();
+    if (m_clock.isValid()) {
+        m_playedMsBeforeResume += m_clock.elapsed();
+        m_clock.invalidate();
+    }
+}
+
+void WavFileCaptureSource::resume()
+{
+    if (!m_wav || !m_sink || m_timer.isActive()) {
+        return;
+    }
+    if (m_framesPushed >= m_totalFrames + m_silenceFrames) {
+        return;   // 流し終わっている
+    }
+    m_clock.start();
+    m_timer.start(m_speed > 0.0 ? kPumpIntervalMs : 0);
+}
+
+void WavFileCaptureSource::pump()
+{
+    if (!m_wav || !m_sink) {
+        m_timer.stop();
+        return;
+    }
+
+    const quint64 rate     = quint64(m_format.sampleRate());
+    const int     channels = m_format.channelCount();
+
+    // 今回までに書き込んでおくべきフレーム数
+    quint64 target = 0;
+    if (m_speed > 0.0) {
+        const qint64 playedMs = m_playedMsBeforeResume + (m_clock.isValid() ? m_clock.elapsed() : 0);
+        target = quint64(double(playedMs) * m_speed * double(rate) / 1000.0);
+    } else {
+        target = m_framesPushed + rate * kFastChunkMs / 1000;
+    }
+
+    const quint64 maxChunk = std::max<quint64>(rate * kMaxChunkMs / 1000, 1);
+    while (m_framesPushed < std::min(target, m_totalFrames + m_silenceFrames)) {
+        const quint64 end = std::min(target, m_totalFrames + m_silenceFrames);
+        // ファイル本体と無音を同じ write() に混ぜない (endOfFileReached() の時刻がずれないように)
+        const quint64 limit = m_framesPushed < m_totalFrames ? m_totalFrames : end;
+        const size_t  frames = size_t(std::min({end - m_framesPushed, limit - m_framesPushed, maxChunk}));
+        m_chunk.resize(frames * size_t(channels));
+
+        size_t written = frames;
+        if (m_framesPushed < m_totalFrames) {
+            written = size_t(drwav_read_pcm_frames_f32(&m_wav->wav, frames, m_chunk.data()));
+            if (written < frames) {
+                // ヘッダより短いファイル → 読めたところまでを本体とする
+                qWarning() << "[WavFileCaptureSource] unexpected end of data in" << m_path
+                           << "at frame" << (m_framesPushed + written);
+                m_totalFrames = m_framesPushed + written;
+            }
+        } else {
+            std::fill(m_chunk.begin(), m_chunk.end(), 0.0f);
+        }
+
+        if (written > 0) {
+            m_sink->write(reinterpret_cast<const char *>(m_chunk.data()),
+                          qint64(written * size_t(channels) * sizeof(float)));
+            m_framesPushed += written;
+        }
+
+        if (!m_endOfFileSent && m_framesPushed >= m_totalFrames) {
+            m_endOfFileSent = true;
+            emit endOfFileReached();
+        }
+    }
+
+    if (m_framesPushed >= m_totalFrames + m_silenceFrames) {
+        m_timer.stop();
+        emit finished();
+    }
+}
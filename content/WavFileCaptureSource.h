@@ -0,0 +1,73 @@
+#ifndef WAVFILECAPTURESOURCE_H
+#define WAVFILECAPTURESOURCE_H
+
+#include "AudioCaptureSource.h"
+
+#include <QElapsedTimer>
+#include <QTimer>
+#include <memory>
+#include <vector>
+
+/*
+ * WavFileCaptureSource:
+ *   - WAV ファイルをマイクの代わりに VoiceDetector へ流す入力元 (再現可能なテスト・ベンチマーク用)
+ *   - ファイルのネイティブのレート・チャンネル数のまま float で書き込む (変換経路はマイクと同じになる)
+ *   - speed = 1.0 で実時間、2.0 で2倍速。0 以下ならタイマーの1回ごとに 20ms 分ずつ、待たずに流す
+ *     (実時間モードは経過時間から送るべきフレーム数を決めるので、タイマーの揺らぎで遅れが累積しない)
+ *   - ファイルの後ろに trailingSilenceMs の無音を足す (VAD が発話の終わりを検出できるように)
+ *   - ファイル本体の最後のサンプルを書き込んだ時点で endOfFileReached() を出す
+ *     (= 発話終了の基準時刻。ここから VAD 終了・認識・応答までの遅延を測る)
+ *   - 無音まで書き終えたら finished()
+ *   - resume() で再生開始、suspend() で一時停止 (VoiceDetector の resume()/pause() から呼ばれる)
+ */
+class WavFileCaptureSource : public AudioCaptureSource
+{
+    Q_OBJECT
+public:
+    explicit WavFileCaptureSource(const QString &path, double speed = 1.0,
+                                  int trailingSilenceMs = 1000, QObject *parent = nullptr);
+    ~WavFileCaptureSource() override;
+
+    bool open() override;
+    QAudioFormat format() const override { return m_format; }
+    QString description() const override;
+
+    void start(QIODevice *sink) override;
+    void stop() override;
+    void suspend() override;
+    void resume() override;
+
+    // ファイル本体の長さ[ms] (open() 後に有効。末尾の無音は含まない)
+    qint64 durationMs() const;
+
+signals:
+    // ファイル本体の最後のサンプルを書き込んだ (この後は末尾の無音だけ)
+    void endOfFileReached();
+
+private slots:
+    void pump();
+
+private:
+    struct WavReader;   // dr_wav のハンドル (ヘッダに dr_wav.h を持ち込まない)
+
+    QString      m_path;
+    double       m_speed;
+    int          m_trailingSilenceMs;
+    QAudioFormat m_format;
+
+    std::unique_ptr<WavReader> m_wav;
+    QIODevice *m_sink = nullptr;
+    QTimer     m_timer;
+
+    // 実時間ペースの管理 (suspend() 中の時間は数えない)
+    QElapsedTimer m_clock;
+    qint64 m_playedMsBeforeResume = 0;
+
+    quint64 m_totalFrames    = 0;   // ファイル本体のフレーム数
+    quint64 m_framesPushed   = 0;   // 書き込んだフレーム数 (無音を含む)
+    quint64 m_silenceFrames  = 0;   // 末尾に足す無音のフレーム数
+    bool    m_endOfFileSent  = false;
+    std::vector<float> m_chunk;     // 1回分の書き込みバッファ (インターリーブ)
+};
+
+#endif // WAVFILECAPTURESOURCE_H
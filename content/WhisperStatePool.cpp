@@ -0,0 +1,124 @@
+#include "WhisperStatePool.h"
+#include "whisper.h"
+
+#include <QDebug>
+#include <algorithm>
+
+WhisperStatePool::WhisperStatePool()
+{
+    m_threads.setMaxThreadCount(1);
+}
+
+WhisperStatePool::~WhisperStatePool()
+{
+    reset(nullptr, 0);
+}
+
+void WhisperStatePool::reset(whisper_context *ctx, int size)
+{
+    if (ctx) {
+        // 並列数を変えるだけ: 順番待ちのタスク (認識を待っている発話) も最後まで実行する
+        m_threads.waitForDone();
+    } else {
+        // ctx を解放する前: 未開始のタスクは捨て、実行中のものだけ待つ
+        m_threads.clear();
+        m_threads.waitForDone();
+        if (const int dropped = pending(); dropped > 0) {
+            qDebug() << "[WhisperStatePool] discarded" << dropped << "queued decodes";
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (whisper_state *state : m_states) {
+        whisper_free_state(state);
+    }
+    m_states.clear();
+    m_freeStates.clear();
+    // 捨てたタスクの番号は二度と完了しないので、並べ替えの状態も初期化する
+    m_finished.clear();
+    m_nextSeq        = 0;
+    m_nextCompletion = 0;
+
+    m_ctx  = ctx;
+    m_size = ctx ? std::max(size, 1) : 0;
+    m_threads.setMaxThreadCount(std::max(m_size, 1));
+}
+
+int WhisperStatePool::pending() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return int(m_nextSeq - m_nextCompletion);
+}
+
+bool WhisperStatePool::submit(Task task)
+{
+    uint64_t seq = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_ctx) {
+            return false;
+        }
+        seq = m_nextSeq++;
+    }
+
+    m_threads.start([this, seq, task = std::move(task)] {
+        whisper_state *state = acquireState();
+        Completion completion = task(m_ctx, state);
+        releaseState(state);
+        complete(seq, std::move(completion));
+    });
+    return true;
+}
+
+void WhisperStatePool::waitForDone()
+{
+    m_threads.waitForDone();
+}
+
+whisper_state *WhisperStatePool::acquireState()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_freeStates.empty()) {
+            whisper_state *state = m_freeStates.back();
+            m_freeStates.pop_back();
+            return state;
+        }
+    }
+
+    // 同時に走るタスクはスレッド数 (= size) 以下なので、state も size 個を超えない
+    whisper_state *state = whisper_init_state(m_ctx);
+    if (!state) {
+        qWarning() << "[WhisperStatePool] whisper_init_state failed";
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_states.push_back(state);
+    qDebug() << "[WhisperStatePool] created whisper state" << m_states.size() << "/" << m_size;
+    return state;
+}
+
+void WhisperStatePool::releaseState(whisper_state *state)
+{
+    if (!state) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_freeStates.push_back(state);
+}
+
+void WhisperStatePool::complete(uint64_t seq, Completion completion)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_finished.emplace(seq, std::move(completion));
+
+    // 先頭から番号が揃っている分だけ順に完了処理を呼ぶ
+    while (!m_finished.empty() && m_finished.begin()->first == m_nextCompletion) {
+        Completion next = std::move(m_finished.begin()->second);
+        m_finished.erase(m_finished.begin());
+        ++m_nextCompletion;
+        if (next) {
+            next();
+        }
+    }
+}
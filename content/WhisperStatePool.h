@@ -0,0 +1,71 @@
+#ifndef WHISPERSTATEPOOL_H
+#define WHISPERSTATEPOOL_H
+
+#include <QThreadPool>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+struct whisper_context;
+struct whisper_state;
+
+/*
+ * WhisperStatePool:
+ *   - 1つのロード済みモデル (whisper_context) を共有する whisper_state を最大 size 個持ち、
+ *     独立した発話の認識を size 本まで並列に実行する
+ *     (重みは共有なので、増えるのは state ごとの KV キャッシュと計算バッファだけ)
+ *   - state は必要になった時点で作る (並列に走らなければ1個のまま)
+ *   - タスクは完了処理 (Completion) を返し、完了処理は submit() した順に呼ばれる
+ *     → 後の発話が先に終わっても、結果の通知順は発話順のまま
+ */
+class WhisperStatePool
+{
+public:
+    // タスクの完了後に submit() 順で呼ばれる処理。プールのスレッドから (内部のロックを持ったまま) 呼ばれるので、
+    // 重い処理はせず結果を受け取り側のスレッドへ投げるだけにすること
+    using Completion = std::function<void()>;
+    // 空いている state を1つ占有して実行される。state を作れなかったときは nullptr
+    using Task = std::function<Completion(whisper_context *ctx, whisper_state *state)>;
+
+    WhisperStatePool();
+    ~WhisperStatePool();
+
+    WhisperStatePool(const WhisperStatePool &) = delete;
+    WhisperStatePool &operator=(const WhisperStatePool &) = delete;
+
+    // タスクの終了を待ち、state をすべて解放してから ctx を size 並列で使うように設定し直す
+    // (順番待ちのタスクも実行してから切り替える)。ctx == nullptr なら未開始のタスクは捨てて空にする
+    //  ctx を whisper_free() する前に必ず reset(nullptr, 0) すること
+    void reset(whisper_context *ctx, int size);
+
+    whisper_context *context() const { return m_ctx; }
+    int size() const { return m_size; }
+    // 完了処理がまだ呼ばれていないタスクの数
+    int pending() const;
+
+    // ctx が未設定なら何もせず false
+    bool submit(Task task);
+
+    void waitForDone();
+
+private:
+    whisper_state *acquireState();
+    void releaseState(whisper_state *state);
+    void complete(uint64_t seq, Completion completion);
+
+    whisper_context *m_ctx  = nullptr;
+    int              m_size = 0;
+
+    mutable std::mutex           m_mutex;
+    std::vector<whisper_state *> m_states;       // 作った state すべて
+    std::vector<whisper_state *> m_freeStates;
+    uint64_t                     m_nextSeq = 0;
+    uint64_t                     m_nextCompletion = 0;
+    std::map<uint64_t, Completion> m_finished;   // 順番待ちの完了処理 (並べ替え用)
+
+    QThreadPool m_threads;
+};
+
+#endif // WHISPERSTATEPOOL_H
@@ -7,6 +7,7 @@
 #include <QQuickStyle>
 #include <QDirIterator>
 #include "app_environment.h"
+#include "BatchTranscriber.h"
 
 // リソースシステムに登録されているファイルのパスをすべて列挙する関数
 static void printAllResourcePaths()
@@ -22,6 +23,12 @@ static void printAllResourcePaths()
 }
 
 int main(int argc, char ** argv) {
+    // --batch-transcribe <dir>: GUI を出さずに WAV ファイルを文字起こしして終了する
+    if (BatchTranscriber::isRequested(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        return BatchTranscriber::runFromCommandLine(app.arguments());
+    }
+
     set_qt_environment();
 
     QGuiApplication app(argc, argv);